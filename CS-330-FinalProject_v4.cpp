@@ -1,5 +1,26 @@
 #include <iostream>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>		// GetProcessMemoryInfo, for the benchmark
+#endif
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
@@ -9,9 +30,34 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/constants.hpp>
 
 #include "camera.h"
+#include "glmesh.h"
+#include "imageutils.h"
 #include "shader.h"
+#include "drawlist.h"
+#include "spscqueue.h"
+#include "jobsystem.h"
+#include "frustum.h"
+#include "framepacer.h"
+#include "rendertarget.h"
+#include "queryring.h"
+#include "gbuffer.h"
+#include "lightclusters.h"
+#include "visibilitybuffer.h"
+#include "shadowcascades.h"
+#include "lightmapbaker.h"
+#include "dynamicresolution.h"
+#include "headlesscontext.h"
+#include "pngwriter.h"
+#include "framecapture.h"
+#include "framestate.h"
+#include "gpuprofiler.h"
+#include "cpuprofiler.h"
+#include "drawstats.h"
+#include "gpumemory.h"
+#include "commandline.h"
 
 
 
@@ -23,14 +69,108 @@ namespace
     const int WINDOW_WIDTH = 800;
     const int WINDOW_HEIGHT = 600;
 
-    struct GLMesh {
-        GLuint vao;
-        GLuint vbo;
-        GLuint nVertices;
+    // Everything the renderer needs to draw one frame, captured on the main thread
+    struct FrameSnapshot {
+        glm::mat4 projection;
+        glm::mat4 view;
+        glm::vec3 viewPos;
+        bool orthographic;	// which of the two projections that is
+        int framebufferWidth;
+        int framebufferHeight;
+        unsigned int sceneVersion;
+        FrameState state;	// input versions projection and view were computed for
+        double time;	// seconds since startup, drives animation
+        bool quit;		// tells the render thread to shut down
+    };
+
+    // Shader programs the renderer draws with, created in main once the context exists
+    struct RenderShaders {
+        Shader* object;
+        Shader* lamp;
+        Shader* depth;		// position only, for the depth prepass
+        Shader* gbuffer;	// deferred geometry pass
+        Shader* deferredDirectional;
+        Shader* deferredPoint;
+        Shader* visibility;		// visibility buffer triangle ids
+        Shader* visibilityClassify;
+        Shader* visibilityResolve;
+        Shader* lightmap;		// forward shading from the baked lightmap
+    };
+
+    // How a point light drifts around: it orbits its origin in the xz plane
+    struct PointLightMotion {
+        glm::vec3 origin;
+        float orbitRadius;
+        float speed;		// radians per second
+        float phase;
+    };
+
+    // Where the camera is for one frame of a batch render
+    struct CameraKeyframe {
+        glm::vec3 position;
+        float yaw;
+        float pitch;
+        float zoom;
     };
 
     GLFWwindow* gWindow = nullptr;
 
+    // Headless mode (--headless). There's no window: the context comes from
+    // HeadlessContext and finished frames go into gOutputTarget instead. gHeadlessFrames
+    // frames are rendered at a fixed time step, the last one is optionally written to
+    // gHeadlessOutput, and the program exits. gOutputFramebuffer is where every pipeline
+    // puts its finished frame, 0 (the window) unless headless.
+    bool gHeadless = false;
+    std::string gHeadlessBackend;		// empty picks the first backend that works
+    int gHeadlessFrames = 60;
+    const char* gHeadlessOutput = nullptr;
+    const double HEADLESS_TIME_STEP = 1.0 / 60.0;
+    HeadlessContext gHeadlessContext;
+    RenderTarget gOutputTarget;
+    GLuint gOutputFramebuffer = 0;
+
+    // Batch rendering (--batch FILE). Every camera keyframe in FILE becomes one image,
+    // gBatchOutput followed by the keyframe's number and ".png". Frames are drawn into
+    // the output target like headless ones and read back through gFrameCapture.
+    // With gBatchWorkers > 1 this process renders nothing itself and starts that many
+    // copies of the program instead, each with its own context and a share of the
+    // keyframes (--batch-range).
+    const char* gBatchFile = nullptr;
+    std::string gBatchOutput = "frame_";
+    int gBatchWorkers = 1;
+    int gBatchFirst = 0;
+    int gBatchCount = -1;		// -1 is everything from gBatchFirst on
+
+    // Benchmark (--benchmark FILE). The camera flies along the keyframes in FILE (the
+    // batch format) at the fixed headless time step, ignoring the mouse and keyboard, so
+    // every run draws exactly the same frames. After gBenchmarkWarmup frames parked on
+    // the first keyframe it measures gBenchmarkFrames frames spread evenly over the path
+    // and writes the results to gBenchmarkOutput. Works in a window and headless.
+    // Startup is timed from gProgramStart, set while the program loads, to the first
+    // benchmark frame.
+    const char* gBenchmarkFile = nullptr;
+    const char* gBenchmarkOutput = "benchmark.json";
+    int gBenchmarkFrames = 300;
+    int gBenchmarkWarmup = 30;
+    const std::chrono::steady_clock::time_point gProgramStart = std::chrono::steady_clock::now();
+
+    // Frame capture (--capture PREFIX) writes every frame shown as PREFIX, the frame
+    // number and ".png". gFrameCapture reads frames back a few frames late so the GPU
+    // never waits on it; compressing and writing images runs on gImageEncoders, a job
+    // system of its own, so the renderer doesn't wait on that either. When the encoders
+    // fall too far behind, capture drops frames rather than slow the window down (batch
+    // rendering waits instead, it needs every frame).
+    const char* gCaptureOutput = nullptr;
+    int gCaptureDepth = 3;
+    FrameCapture gFrameCapture;
+    uint64_t gCapturedFrames = 0;
+    int gImageEncoderThreads = 2;
+    JobSystem* gImageEncoders = nullptr;
+    JobCounter* gImagesWritten = nullptr;
+    std::atomic<int> gImagesPending(0);
+    std::atomic<int> gImageWriteFailures(0);
+    int gImagesDropped = 0;
+
 	// Lighting
 	// setting the light pretty far away, but I'm not using attenuation so it shouldn't matter
 	glm::vec3 lightPosition(-15.0f, 20.0f, 15.0f);	
@@ -41,9 +181,111 @@ namespace
     float gLastY = WINDOW_HEIGHT / 2.0F;
     bool gFirstMouse = true;
 
+    // Frame state
+    // Input handling touches gFrameState whenever the camera, projection, framebuffer
+    // size or light changes. UBuildFrameSnapshot only recomputes the projection and view
+    // matrices when their version moved on, and the renderer skips uniform uploads a
+    // program already has (gUniformCache, used on the rendering thread only).
+    FrameState gFrameState;
+    glm::mat4 gProjection;
+    unsigned int gProjectionVersion = 0;
+    glm::mat4 gView;
+    unsigned int gViewVersion = 0;
+    UniformCache gUniformCache;
+
     // Timing
     float gDeltaTime = 0.0f;
-    float gLastFrame = 0.0f;
+    double gLastFrame = 0.0;
+
+    // Frame pacing
+    // gVsyncMode picks the swap interval, gFrameRateCap (0 = off) limits the frame rate
+    // on top of that and gSmoothDelta averages the delta fed to the camera.
+    enum Vsync_Mode {
+        VSYNC_OFF,
+        VSYNC_ON,
+        VSYNC_ADAPTIVE
+    };
+    Vsync_Mode gVsyncMode = VSYNC_ON;
+    double gFrameRateCap = 0.0;
+    bool gSmoothDelta = true;
+    double gFrameStatsInterval = 0.0;	// seconds between frame time logs, 0 = off
+    FramePacer gFramePacer;
+
+    // Depth
+    // gReverseZ draws the scene into gSceneTarget with a floating point depth buffer,
+    // [0, 1] clip depth (glClipControl), depth 1 at the near plane and 0 at an infinitely
+    // far one. gDepthPrepass lays down depth for the static scene first so the shading
+    // pass only runs the Phong shader once per pixel.
+    bool gReverseZ = false;
+    bool gDepthPrepass = false;
+    const float NEAR_PLANE = 0.1f;
+    RenderTarget gSceneTarget;
+
+    // Dynamic resolution (--dynamic-res MS, forward and clustered pipelines). The scene is
+    // drawn into the bottom left corner of gSceneTarget at gDynamicResolution's scale of
+    // the window size and the blit to the window scales it back up. gGpuFrameTime times
+    // each frame on the GPU to pick the next scale from.
+    DynamicResolution gDynamicResolution;
+    QueryRing gGpuFrameTime;
+
+    // Fragment counting (--count-fragments). The prepass counts the samples that pass
+    // its depth test, which is what the shading pass would shade without a prepass.
+    bool gCountFragments = false;
+    QueryRing gPrepassFragments;
+    QueryRing gShadingFragments;
+    QueryRing gRasterizedFragments;		// every fragment the static draws cover, before the depth test
+
+    // Shadows for the directional light (forward and clustered pipelines). Static casters
+    // are cached per cascade, see ShadowCascades. gDynamicDraws is for anything that
+    // moves: it's drawn every frame and composited over the cached shadows. Nothing in
+    // the scene moves yet, so it stays empty.
+    bool gShadows = true;
+    const int SHADOW_MAP_SIZE = 2048;
+    ShadowCascades gShadowCascades;
+    DrawList gDynamicDraws;
+    std::vector<unsigned int> gShadowQueue;		// static draws inside the cascade being drawn
+    std::vector<unsigned int> gDynamicQueue;	// every dynamic draw
+
+    // Baked lighting. --bake-lightmaps traces the directional light, one bounce and
+    // ambient occlusion for the static scene into LIGHTMAP_PATH and exits (see
+    // LightmapBaker). --lightmap loads it and the forward pipeline shades static draws
+    // from it instead of lighting them every frame. gLightmapUvBuffers holds one buffer
+    // of lightmap UVs per static draw, bound as attribute 3 of the draw's VAO.
+    bool gBakeLightmaps = false;
+    int gBakeSamples = 64;
+    bool gUseLightmap = false;
+    const char* const LIGHTMAP_PATH = "Images/scene.lmap";
+    GLuint gLightmapTexture = 0;
+    std::vector<GLuint> gLightmapUvBuffers;
+
+    // Render pipeline
+    // Forward shades every fragment with the one directional light. Deferred writes a
+    // G-buffer and then adds the directional light with a full-screen pass and each point
+    // light with a light volume, so a light only costs the pixels it covers. Clustered is
+    // the forward path with the point lights binned into view frustum clusters, each
+    // fragment only looping over the lights in its cluster. Visibility only rasterizes
+    // triangle ids and then shades every pixel exactly once from them.
+    enum Render_Pipeline {
+        PIPELINE_FORWARD,
+        PIPELINE_DEFERRED,
+        PIPELINE_CLUSTERED,
+        PIPELINE_VISIBILITY
+    };
+    Render_Pipeline gRenderPipeline = PIPELINE_FORWARD;
+    GBuffer gGBuffer;
+    GLuint gEmptyVao = 0;		// the full-screen pass makes its vertices up from gl_VertexID
+    VisibilityBuffer gVisibilityBuffer;
+    unsigned int gVisibilityGeometryVersion = 0;	// scene version the geometry storage buffer holds
+
+    // Point lights (--lights N). The motion is set up once, the render side works out
+    // where each light is for the frame's time and uploads the visible ones.
+    int gNumPointLights = 0;
+    std::vector<PointLightMotion> gPointLightMotion;
+    std::vector<PointLight> gPointLightColors;	// radius and color, positions filled in per frame
+    std::vector<PointLight> gVisiblePointLights;
+    GLuint gPointLightBuffer = 0;		// per instance data for the light volumes
+    LightClusters gLightClusters;
+    const float CLUSTER_FAR_PLANE = 100.0f;		// clusters past this share the last depth slice
     
     // Meshes
 	GLMesh mPlane;
@@ -60,9 +302,91 @@ namespace
 	GLMesh mLeftHedge;
 	GLMesh mTree;
 	GLMesh mTrailer;
+	GLMesh mLightVolume;	// position only sphere, instanced once per point light
+
+	// Textures
+	GLuint gTexPavement;
+	GLuint gTexSteel;
+	GLuint gTexHedge;
+	GLuint gTexGray;
+
+	// Static draws are recorded once and replayed every frame. Anything that changes
+	// the scene content bumps the version so the list gets recorded again.
+	DrawList gStaticDraws;
+	unsigned int gSceneVersion = 0;
 
 	// Ortho boolean
 	bool orthographic = false;
+
+	// Render-on-demand / background throttling
+	// With gRenderOnDemand set the loop sleeps until input, camera movement or
+	// URequestRedraw() asks for a new frame. With gThrottleBackground set an unfocused
+	// window renders at most gBackgroundFrameRate frames per second and a minimized one
+	// doesn't render at all.
+	bool gRenderOnDemand = false;
+	bool gThrottleBackground = false;
+	double gBackgroundFrameRate = 10.0;
+	const double IDLE_WAIT_TIMEOUT = 0.5;	// upper bound on a single blocking wait, in seconds
+	bool gRedrawRequested = true;
+	bool gWindowFocused = true;
+	bool gWindowIconified = false;
+
+	// Framebuffer size, kept up to date by UResizeWindow
+	int gFramebufferWidth = WINDOW_WIDTH;
+	int gFramebufferHeight = WINDOW_HEIGHT;
+
+	// Render thread
+	// With gUseRenderThread set, a second thread owns the GL context and draws the
+	// snapshots the main thread queues up. gFrameDepth is how many frames the main
+	// thread may get ahead of it before it has to wait.
+	bool gUseRenderThread = false;
+	int gFrameDepth = 2;
+
+	// Job system for per-frame CPU work (culling, render queue building).
+	// gWorkerThreads of -1 means one worker per spare hardware thread.
+	JobSystem* gJobs = nullptr;
+	int gWorkerThreads = -1;
+	bool gRunJobBenchmark = false;
+	std::vector<unsigned char> gVisibleDraws;	// culling result, one entry per static draw
+	std::vector<uint64_t> gSortKeys;			// draw order key, one entry per static draw
+	std::vector<unsigned int> gRenderQueue;		// visible static draws in the order they're drawn
+
+	// Draw order. With gSortDraws set opaque draws go roughly front to back (see DrawList::SortKey).
+	bool gSortDraws = true;
+
+	// GPU profiling (--gpu-profile). Every pass is timed by gGpuProfiler, whose rolling
+	// averages go in the window title and, headless, into the log at the end. With
+	// gProfileDrawGroups the forward pipeline draws each part of the scene (the static
+	// draws are tagged with a Draw_Group) on its own so each gets its own time.
+	enum Draw_Group {
+		DRAW_GROUP_PLANE,
+		DRAW_GROUP_HEDGES,
+		DRAW_GROUP_TRAILER,
+		DRAW_GROUP_GUNDAM,
+		DRAW_GROUP_COUNT
+	};
+	const char* const DRAW_GROUP_NAMES[DRAW_GROUP_COUNT] = { "plane", "hedges", "trailer", "gundam" };
+	bool gGpuProfile = false;
+	bool gProfileDrawGroups = false;
+	const char* gGpuProfileCsv = nullptr;
+	GpuProfiler gGpuProfiler;
+	const double PROFILE_TITLE_INTERVAL = 0.5;		// seconds between window title updates
+	std::vector<unsigned int> gGroupQueue;			// one group's share of gRenderQueue
+
+	// CPU profiling (--cpu-profile FILE). Zones on the main, render and job threads
+	// go into gCpuProfiler and are written out as a Chrome trace at exit.
+	const char* gCpuProfileOutput = nullptr;
+	CpuProfiler gCpuProfiler;
+
+	// Draw stats (--draw-stats). DrawStats::Get() always counts the draws, binds, uniform
+	// uploads and buffer uploads of each pass; this shows the last frame's in the title
+	// bar and logs every pass's averages at exit.
+	bool gDrawStats = false;
+
+	// GPU memory (--gpu-memory). GpuMemory::Get() always tracks every texture and buffer
+	// and anything left at exit is reported as a leak; this also logs the totals by
+	// category and every allocation.
+	bool gGpuMemoryReport = false;
 }
 
 // ---------------------------------------------------------------------
@@ -84,35 +408,80 @@ void CreateRightArm(GLMesh& mesh);
 void CreateHead(GLMesh& mesh);
 void CreateLeftHedge(GLMesh& mesh);
 void CreateTrailer(GLMesh& mesh);
+void UCreateLightVolume(GLMesh& mesh);
+void UCreatePointLights(int count);
+void URecordStaticScene(DrawList& drawList);
+void UAddStaticDraw(DrawList& drawList, const GLMesh& mesh, GLuint texture, float shininess);
 // STANDARD FUNCTIONS
 bool UInitialize(int, char* [], GLFWwindow** window);
+bool UCreateWindow(GLFWwindow** window);
+void USetSwapInterval(Vsync_Mode mode);
+void UParseCommandLine(int argc, char* argv[]);
 void UResizeWindow(GLFWwindow* window, int width, int height);
+// FRAME FUNCTIONS
+FrameSnapshot UBuildFrameSnapshot();
+void URenderFrame(const FrameSnapshot& frame, const RenderShaders& shaders);
+void UBeginPass(const char* name);
+void UEndPass();
+void URenderForward(const FrameSnapshot& frame, const RenderShaders& shaders);
+void URenderDeferred(const FrameSnapshot& frame, const RenderShaders& shaders);
+void UDrawLightObject(const FrameSnapshot& frame, Shader& lightShader);
+void URenderVisibility(const FrameSnapshot& frame, const RenderShaders& shaders);
+void UUpdateShadows(const FrameSnapshot& frame, const RenderShaders& shaders);
+void UUpdatePointLights(double time, const glm::mat4& viewProjection);
+void UAssignLightClusters(const FrameSnapshot& frame);
+void URenderThreadMain(SpscQueue<FrameSnapshot>& frames, const RenderShaders& shaders);
+glm::mat4 UReverseInfinitePerspective(float fovy, float aspect, float zNear);
+glm::mat4 UReverseOrtho(float left, float right, float bottom, float top, float zNear, float zFar);
+void UReportFragmentCounts();
+void USetCameraUniforms(Shader& shader, const FrameSnapshot& frame, bool worldSpace = true);
+void USetLightUniforms(Shader& shader, const FrameSnapshot& frame);
+void UReportUniformUploads();
+void UReportGpuProfile();
+void UReportDrawStats();
+void UWriteCpuProfile();
+void UBuildRenderQueue(const glm::mat4& viewProjection, const glm::vec3& viewPos, std::vector<unsigned int>& queue);
+// LIGHTMAPS
+void UBakeLightmaps();
+bool ULoadLightmap();
+LightmapBaker::Settings ULightmapSettings();
+void UAddStaticMeshes(LightmapBaker& baker);
+// HEADLESS
+void URunHeadless(const RenderShaders& shaders);
+bool USaveFramebuffer(GLuint framebuffer, int width, int height, const char* path);
+// BATCH RENDERING
+bool ULoadKeyframes(const char* path, std::vector<CameraKeyframe>& keyframes);
+bool URunBatchWorkers(int argc, char* argv[]);
+void URunBatch(const RenderShaders& shaders);
+// BENCHMARK
+void URunBenchmark(const RenderShaders& shaders);
+CameraKeyframe UInterpolateKeyframes(const std::vector<CameraKeyframe>& keyframes, float t);
+void UWriteSampleStats(std::ostream& out, const std::vector<double>& samples);
+bool UProcessMemory(unsigned long long& resident, unsigned long long& peak);
+std::string UJsonEscape(const std::string& text);
+// FRAME CAPTURE
+void UCaptureFrame(const FrameSnapshot& frame);
+void UWriteCapturedFrame(const unsigned char* pixels, int width, int height, uint64_t frame);
+bool UWriteImageAsync(const unsigned char* rgba, int width, int height, const std::string& path, bool waitIfBusy);
+void UFinishCapture();
+// JOB SYSTEM
+void UJobSystemBenchmark();
+// FRAME SCHEDULING
+bool UWaitForFrame(GLFWwindow* window);
+void URequestRedraw();
 // CLEAN UP FUNCTIONS
 void UDestroyTexture(GLuint textureId);
-void UDestroyMesh(GLMesh& mesh);
+void UDestroyResources();
 // INPUT FUNCTIONS
 void UProcessInput(GLFWwindow* window);
+bool UCameraKeysHeld(GLFWwindow* window);
+void UKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
-
-// Images load Y axis going down, OpenGL goes up. This flips the image.
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
-{
-	for (int j = 0; j < height / 2; j++)
-	{
-		int index1 = j * width * channels;
-		int index2 = (height - 1 - j) * width * channels;
-		for (int i = width * channels; i > 0; --i)
-		{
-			unsigned char tmp = image[index1];
-			image[index1] = image[index2];
-			image[index2] = tmp;
-			++index1;
-			++index2;
-		}
-	}
-}
+void UWindowFocusCallback(GLFWwindow* window, int focused);
+void UWindowIconifyCallback(GLFWwindow* window, int iconified);
+void UWindowRefreshCallback(GLFWwindow* window);
 
 // Borrowed from LearnOpenGL
 // utility function for loading a 2D texture from file
@@ -136,6 +505,7 @@ unsigned int loadTexture(char const* path)
 		glBindTexture(GL_TEXTURE_2D, textureId);
 		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
+		GpuMemory::Get().TrackTexture(textureId, GpuMemory::TEXTURE, path, format, width, height, 1, 0);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -154,6 +524,34 @@ unsigned int loadTexture(char const* path)
 
 int main(int argc, char* argv[])
 {
+	UParseCommandLine(argc, argv);
+	gCpuProfiler.SetEnabled(gCpuProfileOutput != nullptr);
+	gCpuProfiler.SetThreadName("main");
+
+	if (gRunJobBenchmark)
+	{
+		UJobSystemBenchmark();
+		return EXIT_SUCCESS;
+	}
+
+	// the worker processes do the rendering, this one only hands out the keyframes
+	if (gBatchFile && gBatchWorkers > 1)
+		return URunBatchWorkers(argc, argv) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	JobSystem jobs(gWorkerThreads);
+	gJobs = &jobs;
+
+	// only started when there are images to write. The counter is declared first so it
+	// outlives the encoders' workers.
+	JobCounter imagesWritten;
+	std::unique_ptr<JobSystem> imageEncoders;
+	if (gBatchFile || gCaptureOutput)
+	{
+		gImagesWritten = &imagesWritten;
+		imageEncoders.reset(new JobSystem(gImageEncoderThreads));
+		gImageEncoders = imageEncoders.get();
+	}
+
     // Initialize the Window
 	if (!UInitialize(argc, argv, &gWindow))
 		return EXIT_FAILURE;
@@ -161,296 +559,1203 @@ int main(int argc, char* argv[])
 	// Create the Shader Program
 	Shader objectShader("objectVertexShader.vs", "objectFragmentShader.fs");
 	Shader lightShader("lampVertexShader.vs", "lampFragmentShader.fs");
+	Shader depthShader("depthVertexShader.vs", "depthFragmentShader.fs");
+	Shader gbufferShader("gbufferVertexShader.vs", "gbufferFragmentShader.fs");
+	Shader deferredDirectionalShader("fullscreenVertexShader.vs", "deferredDirectionalShader.fs");
+	Shader deferredPointShader("deferredPointVertexShader.vs", "deferredPointFragmentShader.fs");
+	Shader visibilityShader("visibilityVertexShader.vs", "visibilityFragmentShader.fs");
+	Shader visibilityClassifyShader("fullscreenVertexShader.vs", "visibilityClassifyShader.fs");
+	Shader visibilityResolveShader("fullscreenVertexShader.vs", "visibilityResolveShader.fs");
+	Shader lightmapShader("lightmapVertexShader.vs", "lightmapFragmentShader.fs");
+	RenderShaders shaders = { &objectShader, &lightShader, &depthShader, &gbufferShader, &deferredDirectionalShader, &deferredPointShader,
+		&visibilityShader, &visibilityClassifyShader, &visibilityResolveShader, &lightmapShader };
 
 	const char* imgPavement = "Images/pavement.jpg";
 	const char* imgSteel = "Images/steel.jpg";
 	const char* imgHedge = "Images/OpenfootageNETgreen.jpg";
 	const char* imgGray = "Images/plastic.jpg";
 	
-	unsigned int texPavement = loadTexture(imgPavement);
-	unsigned int texSteel = loadTexture(imgSteel);
-	unsigned int texHedge = loadTexture(imgHedge);
-	unsigned int texGray = loadTexture(imgGray);
+	gTexPavement = loadTexture(imgPavement);
+	gTexSteel = loadTexture(imgSteel);
+	gTexHedge = loadTexture(imgHedge);
+	gTexGray = loadTexture(imgGray);
 
 
 	objectShader.use();
 	objectShader.setInt("material.diffuse", 0);		// setting the int that the diffuse map will bind the texture to
 	objectShader.setInt("material.specular", 1);	// setting the int that the specular map will bind the texture to
+	objectShader.setInt("shadowMap", 3);			// the shadow map array goes on unit 3
+
+	gbufferShader.use();
+	gbufferShader.setInt("material.diffuse", 0);
+	gbufferShader.setInt("material.specular", 1);
+
+	// the lighting passes read the G-buffer from units 0-2 (see GBuffer::BindTextures)
+	Shader* lightingShaders[] = { &deferredDirectionalShader, &deferredPointShader };
+	for (Shader* lightingShader : lightingShaders)
+	{
+		lightingShader->use();
+		lightingShader->setInt("gAlbedoSpecular", 0);
+		lightingShader->setInt("gNormalShininess", 1);
+		lightingShader->setInt("gDepth", 2);
+	}
+
+	// visibility ids on unit 0 (see VisibilityBuffer::BindForResolve), the material after them
+	visibilityClassifyShader.use();
+	visibilityClassifyShader.setInt("visibility", 0);
+	visibilityResolveShader.use();
+	visibilityResolveShader.setInt("visibility", 0);
+	visibilityResolveShader.setInt("material.diffuse", 1);
+	visibilityResolveShader.setInt("material.specular", 2);
+
+	lightmapShader.use();
+	lightmapShader.setInt("material.diffuse", 0);
+	lightmapShader.setInt("lightmap", 4);
+	lightmapShader.setFloat("lightmapRange", Lightmap::RGBM_RANGE);
 
 	// Method to instantiate all meshes in one area for readability.
 	// Prevents clutter in the main function
 	MeshConstructor();
+	UCreatePointLights(gNumPointLights);
+
+	if (gBakeLightmaps)
+	{
+		UBakeLightmaps();
+		UDestroyResources();
+		return EXIT_SUCCESS;
+	}
+	if (gUseLightmap && !ULoadLightmap())
+		cout << "WARNING: Couldn't load " << LIGHTMAP_PATH << ", run with --bake-lightmaps first. Lighting static draws at runtime instead" << endl;
+
+	if (gBatchFile || gCaptureOutput)
+	{
+		gFrameCapture.Create(gCaptureDepth);
+		gFrameCapture.SetConsumer(UWriteCapturedFrame);
+	}
+
+	if (gBatchFile)
+	{
+		URunBatch(shaders);
+		UDestroyResources();
+		return EXIT_SUCCESS;
+	}
+	if (gBenchmarkFile)
+	{
+		URunBenchmark(shaders);
+		UFinishCapture();
+		UWriteCpuProfile();
+		UDestroyResources();
+		return EXIT_SUCCESS;
+	}
+	if (gHeadless)
+	{
+		URunHeadless(shaders);
+		UFinishCapture();
+		UReportUniformUploads();
+		UReportGpuProfile();
+		UReportDrawStats();
+		UWriteCpuProfile();
+		UDestroyResources();
+		return EXIT_SUCCESS;
+	}
+
+	// With a render thread the GL context moves over to it and this thread only
+	// handles events, input and the camera, feeding it one snapshot per frame.
+	SpscQueue<FrameSnapshot> frameQueue(gFrameDepth);
+	std::thread renderThread;
+	if (gUseRenderThread)
+	{
+		glfwMakeContextCurrent(NULL);
+		renderThread = std::thread(URenderThreadMain, std::ref(frameQueue), std::cref(shaders));
+	}
 
+	double lastProfileTitle = 0.0;
 	while (!glfwWindowShouldClose(gWindow))
 	{
+		CpuProfiler::Zone frameZone(gCpuProfiler, "frame");
+		{
+			CpuProfiler::Zone zone(gCpuProfiler, "wait");
+
+			// Sleep until a frame is actually needed (on-demand mode / background throttling)
+			if (!UWaitForFrame(gWindow))
+				break;
+
+			// Frame rate limiter
+			gFramePacer.WaitForNextFrame();
+		}
+
 		// per-frame timing
 		// -----------------
 		double currentFrame = glfwGetTime();
-		gDeltaTime = currentFrame - gLastFrame;
+		double rawDelta = currentFrame - gLastFrame;
 		gLastFrame = currentFrame;
+		gFramePacer.RecordFrameTime(rawDelta);
+		gDeltaTime = gSmoothDelta ? gFramePacer.SmoothDelta(rawDelta) : (float)rawDelta;
 
 		// Input
 		// -----
 		UProcessInput(gWindow);
 
-		// Rendering
-		// Enable depth-test
-		glEnable(GL_DEPTH_TEST);
+		FrameSnapshot frame = UBuildFrameSnapshot();
+		if (gUseRenderThread)
+		{
+			// blocks once the render thread falls gFrameDepth frames behind
+			frameQueue.Push(frame);
+		}
+		else
+		{
+			URenderFrame(frame, shaders);
+			UCaptureFrame(frame);
 
-		// Clear the frame and z buffers
-		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			// Swap buffer
+			CpuProfiler::Zone zone(gCpuProfiler, "swap");
+			glfwSwapBuffers(gWindow);
+		}
+		gRedrawRequested = false;
 
-		// Shader configuration
-		objectShader.use();
-		objectShader.setVec3("light.position", lightPosition);
-		
-		// Set the camera view position
-		objectShader.setVec3("viewPos", camera.Position);
+		// the profile and stats are read under a lock, so this works with the render thread too
+		if ((gGpuProfile || gDrawStats) && currentFrame - lastProfileTitle >= PROFILE_TITLE_INTERVAL)
+		{
+			lastProfileTitle = currentFrame;
+			std::string title = WINDOW_TITLE;
+			if (gDrawStats)
+				title += " - " + DrawStats::Get().Summary();
+			if (gGpuProfile)
+				title += " - " + gGpuProfiler.Summary();
+			glfwSetWindowTitle(gWindow, title.c_str());
+		}
+
+		// Poll IO events
+		CpuProfiler::Zone zone(gCpuProfiler, "poll events");
+		glfwPollEvents();
+	}
 
-		// Light Properties
-		objectShader.setVec3("light.ambient", 0.1f, 0.1f, 0.1f);
-		objectShader.setVec3("light.diffuse", 0.7f, 0.7f, 0.7f);
-		objectShader.setVec3("light.specular", 0.8f, 0.8f, 0.8f);
+	if (gUseRenderThread)
+	{
+		// let the render thread drain what's queued, then take the context back
+		FrameSnapshot quit = FrameSnapshot();
+		quit.quit = true;
+		frameQueue.Push(quit);
+		renderThread.join();
+		glfwMakeContextCurrent(gWindow);
+	}
+	UFinishCapture();
+	if (gFrameStatsInterval > 0.0)
+		UReportUniformUploads();
+	UReportGpuProfile();
+	UReportDrawStats();
+	UWriteCpuProfile();
+	UDestroyResources();
+}
 
-		// Material Properties
-		// Pavement is not shiny, set pretty low.
-		objectShader.setFloat("material.shininess", 1.0f);
+// ---------------------------------------------------------
+// FRAME FUNCTIONS
+// ---------------------------------------------------------
+// Captures everything the renderer needs from the camera and window for one frame
+FrameSnapshot UBuildFrameSnapshot()
+{
+	FrameSnapshot frame = FrameSnapshot();
 
-		// view/projection transformations
-		glm::mat4 projection;
+	// view/projection transformations, only worked out again when their inputs changed
+	if (gProjectionVersion != gFrameState.Version(FrameState::PROJECTION))
+	{
 		if (orthographic)
 		{
 			float scale = 50;
-			projection = glm::ortho(-((float)WINDOW_WIDTH / scale), ((float)WINDOW_WIDTH / scale), -((float)WINDOW_HEIGHT / scale), ((float)WINDOW_HEIGHT / scale), 20.0f, -20.0f);
+			if (gReverseZ)
+				gProjection = UReverseOrtho(-((float)WINDOW_WIDTH / scale), ((float)WINDOW_WIDTH / scale), -((float)WINDOW_HEIGHT / scale), ((float)WINDOW_HEIGHT / scale), -20.0f, 20.0f);
+			else
+				gProjection = glm::ortho(-((float)WINDOW_WIDTH / scale), ((float)WINDOW_WIDTH / scale), -((float)WINDOW_HEIGHT / scale), ((float)WINDOW_HEIGHT / scale), 20.0f, -20.0f);
 		}
 		else
 		{
-			projection = glm::perspective(glm::radians(camera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1F, 100.0F);
+			if (gReverseZ)
+				gProjection = UReverseInfinitePerspective(glm::radians(camera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, NEAR_PLANE);
+			else
+				gProjection = glm::perspective(glm::radians(camera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, NEAR_PLANE, 100.0F);
 		}
-		glm::mat4 view = camera.GetViewMatrix();
-		objectShader.setMat4("projection", projection);
-		objectShader.setMat4("view", view);
+		gProjectionVersion = gFrameState.Version(FrameState::PROJECTION);
+	}
+	if (gViewVersion != gFrameState.Version(FrameState::CAMERA))
+	{
+		gView = camera.GetViewMatrix();
+		gViewVersion = gFrameState.Version(FrameState::CAMERA);
+	}
+	frame.projection = gProjection;
+	frame.view = gView;
+	frame.viewPos = camera.Position;
+	frame.orthographic = orthographic;
+	frame.state = gFrameState;
+	frame.framebufferWidth = gFramebufferWidth;
+	frame.framebufferHeight = gFramebufferHeight;
+	frame.sceneVersion = gSceneVersion;
+	frame.time = gLastFrame;
+	frame.quit = false;
+	return frame;
+}
 
-		glm::mat4 model = glm::mat4(1.0f);
-		objectShader.setMat4("model", model);
-	
-		// --------------------
-		// PAVEMENT PLANE
-		// --------------------
-		// bind diffuse map
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texPavement);
-		// bind specular map
-		/* JBLACK - 
-		 * Not particularly needed as I'm using the same image, for
-		 * both the specular and diffuse maps, but I didn't want to mess
-		 * with my shaders any further. */
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texPavement);
-		
-		glBindVertexArray(mPlane.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mPlane.nVertices);
+// Draws one frame. Only touches GL state and the snapshot, so it can run on
+// whichever thread currently owns the context.
+void URenderFrame(const FrameSnapshot& frame, const RenderShaders& shaders)
+{
+	CpuProfiler::Zone zone(gCpuProfiler, "render");
 
-		// --------------------
-		// FRONT HEDGE
-		// --------------------
-		// Bind Hedge Texture
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texHedge);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texHedge);
+	// Only record the static draws again if the scene content changed
+	if (gStaticDraws.IsStale(frame.sceneVersion))
+	{
+		CpuProfiler::Zone recordZone(gCpuProfiler, "record scene");
+		URecordStaticScene(gStaticDraws);
+	}
+
+	gGpuProfiler.BeginFrame();
+	DrawStats::Get().BeginFrame();
+	if (gRenderPipeline == PIPELINE_DEFERRED)
+		URenderDeferred(frame, shaders);
+	else if (gRenderPipeline == PIPELINE_VISIBILITY)
+		URenderVisibility(frame, shaders);
+	else
+		URenderForward(frame, shaders);
+	DrawStats::Get().EndFrame();
+	gGpuProfiler.EndFrame();
+}
+
+// A named render pass: timed on the GPU, and what it submits counted under its name
+void UBeginPass(const char* name)
+{
+	gGpuProfiler.Begin(name);
+	DrawStats::Get().BeginPass(name);
+}
+
+void UEndPass()
+{
+	DrawStats::Get().EndPass();
+	gGpuProfiler.End();
+}
 
-		// Front Hedge
-		glBindVertexArray(mFrontHedge.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mFrontHedge.nVertices);
+// The forward and clustered pipelines: shadows, an optional depth prepass, then every
+// draw shaded in one pass
+void URenderForward(const FrameSnapshot& frame, const RenderShaders& shaders)
+{
+	Shader& objectShader = *shaders.object;
+	Shader& lightShader = *shaders.lamp;
 
-		//Left Hedge
-		glBindVertexArray(mLeftHedge.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mLeftHedge.nVertices);
+	// Static draws read their light from the lightmap in the plain forward pipeline.
+	// Their shadows are baked in, so the cascades are only needed for moving objects.
+	const bool lightmapped = gLightmapTexture != 0 && gRenderPipeline == PIPELINE_FORWARD;
 
-		//Draw the Trailer
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texGray);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texGray);
+	// The scale for this frame comes from the last GPU times that are ready
+	const bool dynamicResolution = gDynamicResolution.Enabled();
+	if (dynamicResolution)
+	{
+		GLuint64 elapsedNs;
+		while (gGpuFrameTime.Poll(elapsedNs))
+			gDynamicResolution.AddMeasurement(elapsedNs / 1.0e6);
+		gGpuFrameTime.Begin();
+	}
+	const int renderWidth = gDynamicResolution.ScaledSize(frame.framebufferWidth);
+	const int renderHeight = gDynamicResolution.ScaledSize(frame.framebufferHeight);
+
+	// Bring the shadow cascades up to date. On a frame where nothing moved this draws nothing.
+	if (gShadows && (!lightmapped || gDynamicDraws.Size() > 0))
+	{
+		CpuProfiler::Zone zone(gCpuProfiler, "shadows");
+		UBeginPass("shadows");
+		UUpdateShadows(frame, shaders);
+		UEndPass();
+	}
+
+	// Reverse-Z needs a floating point depth buffer, which only an offscreen target has.
+	// With dynamic resolution the target is big enough for the largest scale, so changing
+	// the scale only changes the viewport and never reallocates it.
+	const bool offscreen = gReverseZ || dynamicResolution;
+	if (offscreen)
+	{
+		const float maxScale = gDynamicResolution.MaxScale();
+		gSceneTarget.Resize((int)std::ceil(frame.framebufferWidth * maxScale), (int)std::ceil(frame.framebufferHeight * maxScale));
+		gSceneTarget.Bind();
+	}
+	else
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, gOutputFramebuffer);
+	}
+	glViewport(0, 0, renderWidth, renderHeight);
+
+	// Rendering
+	// Enable depth-test. With reverse-Z closer means larger depth.
+	const GLenum depthTest = gReverseZ ? GL_GREATER : GL_LESS;
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(depthTest);
+	glDepthMask(GL_TRUE);
+
+	// Clear the frame and z buffers
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClearDepth(gReverseZ ? 0.0 : 1.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// Plane, hedges, trailer and the gundam parts are all static,
+	// so they come straight out of the recorded draw list.
+	// Anything outside the view gets skipped.
+	UBuildRenderQueue(frame.projection * frame.view, frame.viewPos, gRenderQueue);
+
+	// --------------------
+	// DEPTH PREPASS
+	// --------------------
+	if (gDepthPrepass)
+	{
+		Shader& depthShader = *shaders.depth;
+		depthShader.use();
+		USetCameraUniforms(depthShader, frame);
+
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		UBeginPass("depth prepass");
+		if (gCountFragments)
+			gPrepassFragments.Begin();
+		gStaticDraws.ReplayGeometry(gRenderQueue);
+		if (gCountFragments)
+			gPrepassFragments.End();
+		UEndPass();
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+		// only shade the fragment that won the depth test, and leave depth alone
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+
+	// Shader configuration. Camera, light and settings only go up when they changed.
+	{
+		CpuProfiler::Zone zone(gCpuProfiler, "uniforms");
+		objectShader.use();
+		USetCameraUniforms(objectShader, frame);
+		USetLightUniforms(objectShader, frame);
 
-		glBindVertexArray(mTrailer.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mTrailer.nVertices);
+		const bool clustered = gRenderPipeline == PIPELINE_CLUSTERED;
+		if (gUniformCache.NeedsUpload(objectShader.ID, UniformCache::CONSTANTS, frame.state, 0))
+		{
+			objectShader.setBool("shadowsEnabled", gShadows);
+			objectShader.setBool("clusteredLights", clustered);
+		}
+		if (gShadows)
+			gShadowCascades.SetUniforms(objectShader, 3);
 
+		// Point lights, binned into clusters
+		if (clustered)
+		{
+			UAssignLightClusters(frame);
+			gLightClusters.SetUniforms(objectShader, renderWidth, renderHeight);
+		}
+	}
 
-		// --------------------
-		// GUNDAM PARTS
-		// --------------------
+	// Count every fragment the draws rasterize, whether or not it passes the depth test.
+	// Together with the shaded count that gives how many the depth test threw away.
+	if (gCountFragments)
+	{
+		Shader& depthShader = *shaders.depth;
+		depthShader.use();
+		USetCameraUniforms(depthShader, frame);
+
+		GLint depthFunc;
+		GLboolean depthMask;
+		glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+		glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+		glDepthFunc(GL_ALWAYS);
+		glDepthMask(GL_FALSE);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		gRasterizedFragments.Begin();
+		gStaticDraws.ReplayGeometry(gRenderQueue);
+		gRasterizedFragments.End();
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthFunc(depthFunc);
+		glDepthMask(depthMask);
 
-		// shiny gundam
-		objectShader.setFloat("material.shininess", 64.0f);
+		objectShader.use();
+	}
 
-		// Set texture to steel texture
+	if (lightmapped)
+	{
+		Shader& lightmapShader = *shaders.lightmap;
+		lightmapShader.use();
+		USetCameraUniforms(lightmapShader, frame);
+		glActiveTexture(GL_TEXTURE4);
+		glBindTexture(GL_TEXTURE_2D, gLightmapTexture);
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texSteel);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texSteel);
+		DrawStats::Get().Add(DrawStats::TEXTURE_BINDS);
+	}
 
-		// LEFT FOOT
-		glBindVertexArray(mLeftFoot.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mLeftFoot.nVertices);
+	Shader& staticShader = lightmapped ? *shaders.lightmap : objectShader;
+	if (gCountFragments)
+		gShadingFragments.Begin();
+	if (gProfileDrawGroups)
+	{
+		// one replay per part of the scene so each can be timed, in queue order within a part
+		const std::vector<DrawCommand>& commands = gStaticDraws.Commands();
+		for (unsigned int group = 0; group < DRAW_GROUP_COUNT; ++group)
+		{
+			gGroupQueue.clear();
+			for (unsigned int index : gRenderQueue)
+				if (commands[index].group == group)
+					gGroupQueue.push_back(index);
+			if (gGroupQueue.empty())
+				continue;
+
+			CpuProfiler::Zone zone(gCpuProfiler, DRAW_GROUP_NAMES[group]);
+			UBeginPass(DRAW_GROUP_NAMES[group]);
+			gStaticDraws.Replay(staticShader, gGroupQueue);
+			UEndPass();
+		}
+	}
+	else
+	{
+		CpuProfiler::Zone zone(gCpuProfiler, "static draws");
+		UBeginPass("static draws");
+		gStaticDraws.Replay(staticShader, gRenderQueue);
+		UEndPass();
+	}
+	if (gCountFragments)
+		gShadingFragments.End();
 
-		// RIGHT FOOT
-		glBindVertexArray(mRightFoot.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mRightFoot.nVertices);
+	// moving objects aren't in the prepass, so they go through the regular depth test
+	if (gDynamicDraws.Size() > 0)
+	{
+		objectShader.use();
+		glDepthFunc(depthTest);
+		glDepthMask(GL_TRUE);
+		CpuProfiler::Zone zone(gCpuProfiler, "dynamic draws");
+		UBeginPass("dynamic draws");
+		gDynamicDraws.Replay(objectShader, gDynamicQueue);
+		UEndPass();
+	}
 
-		// LEFT LEG
-		glBindVertexArray(mLeftLeg.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mLeftLeg.nVertices);
+	glDepthFunc(depthTest);
+	glDepthMask(GL_TRUE);
 
-		// RIGHT LEG
-		glBindVertexArray(mRightLeg.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mRightLeg.nVertices);
+	UBeginPass("lamp");
+	UDrawLightObject(frame, lightShader);
+	UEndPass();
 
-		// TORSO
-		glBindVertexArray(mTorso.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mTorso.nVertices);
-		
-		// LEFT ARM
-		glBindVertexArray(mLeftArm.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mLeftArm.nVertices);
-		
-		// RIGHT ARM
-		glBindVertexArray(mRightArm.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mRightArm.nVertices);
-
-		// HEAD
-		glBindVertexArray(mHead.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mHead.nVertices);
-
-		// --------------------
-		// LIGHT OBJECT
-		// --------------------
-		// Draw light object
-		lightShader.use();
-		lightShader.setMat4("projection", projection);
-		lightShader.setMat4("view", view);
-		model = glm::mat4(1.0f);
-		model = glm::translate(model, lightPosition);
-		model = glm::scale(model, glm::vec3(1.2f));
-		lightShader.setMat4("model", model);
+	if (offscreen)
+	{
+		UBeginPass("upscale");
+		gSceneTarget.BlitToDefault(renderWidth, renderHeight, frame.framebufferWidth, frame.framebufferHeight, dynamicResolution ? GL_LINEAR : GL_NEAREST, gOutputFramebuffer);
+		UEndPass();
+	}
 
-		glBindVertexArray(mLight.vao);
-		glDrawArrays(GL_TRIANGLES, 0, mLight.nVertices);
+	if (dynamicResolution)
+		gGpuFrameTime.End();
 
-		// Swap buffer
-		glfwSwapBuffers(gWindow);
+	if (gCountFragments)
+		UReportFragmentCounts();
+}
 
-		// Poll IO events
-		glfwPollEvents();
+// Deferred shading. Draws the visible static geometry into the G-buffer, then lights it:
+// the directional light with one full-screen pass and every point light with a sphere
+// around it, so a light only shades the pixels its volume covers.
+void URenderDeferred(const FrameSnapshot& frame, const RenderShaders& shaders)
+{
+	// With reverse-Z the G-buffer's float depth buffer gets the [0, 1] depth, otherwise
+	// it holds regular depth. Either way it's the same comparisons as the forward path.
+	const GLenum depthTest = gReverseZ ? GL_GREATER : GL_LESS;
+	const glm::mat4 viewProjection = frame.projection * frame.view;
+
+	gGBuffer.Resize(frame.framebufferWidth, frame.framebufferHeight);
+	glViewport(0, 0, frame.framebufferWidth, frame.framebufferHeight);
+
+	// --------------------
+	// GEOMETRY PASS
+	// --------------------
+	gGBuffer.BindGeometry();
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(depthTest);
+	glDepthMask(GL_TRUE);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClearDepth(gReverseZ ? 0.0 : 1.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	UBuildRenderQueue(viewProjection, frame.viewPos, gRenderQueue);
+
+	Shader& gbufferShader = *shaders.gbuffer;
+	gbufferShader.use();
+	USetCameraUniforms(gbufferShader, frame);
+	UBeginPass("g-buffer");
+	gStaticDraws.Replay(gbufferShader, gRenderQueue);
+	UEndPass();
+
+	// --------------------
+	// LIGHTING
+	// --------------------
+	// Lights add up into the accumulation target. Depth is only tested from here on; the
+	// lighting shaders sample the copy of it BindLighting makes.
+	gGBuffer.BindLighting();
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDepthMask(GL_FALSE);
+	gGBuffer.BindTextures(0);
+
+	const glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+	const unsigned int cameraInputs = FrameState::Bit(FrameState::CAMERA) | FrameState::Bit(FrameState::PROJECTION);
+
+	// Directional light. The triangle sits at the far plane and only passes the depth
+	// test where something is in front of it, so empty pixels aren't shaded.
+	Shader& directionalShader = *shaders.deferredDirectional;
+	directionalShader.use();
+	if (gUniformCache.NeedsUpload(directionalShader.ID, UniformCache::CONSTANTS, frame.state, 0))
+	{
+		directionalShader.setFloat("clipDepth", gReverseZ ? 0.0f : 1.0f);
+		directionalShader.setBool("depthZeroToOne", gReverseZ);
+	}
+	if (gUniformCache.NeedsUpload(directionalShader.ID, UniformCache::VIEW_PROJECTION, frame.state, cameraInputs))
+		directionalShader.setMat4("inverseViewProjection", inverseViewProjection);
+	USetCameraUniforms(directionalShader, frame);
+	USetLightUniforms(directionalShader, frame);
+
+	glDepthFunc(gReverseZ ? GL_LESS : GL_GREATER);
+	glBindVertexArray(gEmptyVao);
+	DrawStats::Get().Add(DrawStats::VAO_BINDS);
+	UBeginPass("directional light");
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	DrawStats::Get().Draw(3);
+	UEndPass();
+
+	// Point lights, one instanced draw of the light volume sphere for all of them.
+	// Only back faces are drawn so the volume still covers the screen with the camera
+	// inside it, and they have to be behind the surface for the light to reach it.
+	// Depth clamping keeps volumes that poke through the far plane from being clipped.
+	UUpdatePointLights(frame.time, viewProjection);
+	if (!gVisiblePointLights.empty())
+	{
+		// orphan the old storage so the upload doesn't wait on last frame's draw
+		glBindBuffer(GL_ARRAY_BUFFER, gPointLightBuffer);
+		glBufferData(GL_ARRAY_BUFFER, gPointLightMotion.size() * sizeof(PointLight), NULL, GL_STREAM_DRAW);
+		GpuMemory::Get().TrackBuffer(gPointLightBuffer, GpuMemory::VERTEX_BUFFER, "point lights", gPointLightMotion.size() * sizeof(PointLight));
+		glBufferSubData(GL_ARRAY_BUFFER, 0, gVisiblePointLights.size() * sizeof(PointLight), gVisiblePointLights.data());
+		DrawStats::Get().Add(DrawStats::BUFFER_BYTES, gVisiblePointLights.size() * sizeof(PointLight));
+
+		Shader& pointShader = *shaders.deferredPoint;
+		pointShader.use();
+		USetCameraUniforms(pointShader, frame);
+		if (gUniformCache.NeedsUpload(pointShader.ID, UniformCache::CONSTANTS, frame.state, 0))
+			pointShader.setBool("depthZeroToOne", gReverseZ);
+		if (gUniformCache.NeedsUpload(pointShader.ID, UniformCache::VIEW_PROJECTION, frame.state, cameraInputs))
+			pointShader.setMat4("inverseViewProjection", inverseViewProjection);
+		if (gUniformCache.NeedsUpload(pointShader.ID, UniformCache::SCREEN, frame.state, FrameState::Bit(FrameState::VIEWPORT)))
+			pointShader.setVec2("screenSize", (float)frame.framebufferWidth, (float)frame.framebufferHeight);
+
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_FRONT);
+		glEnable(GL_DEPTH_CLAMP);
+		glDepthFunc(gReverseZ ? GL_LEQUAL : GL_GEQUAL);
+
+		glBindVertexArray(mLightVolume.vao);
+		DrawStats::Get().Add(DrawStats::VAO_BINDS);
+		UBeginPass("point lights");
+		glDrawArraysInstanced(GL_TRIANGLES, 0, mLightVolume.nVertices, (GLsizei)gVisiblePointLights.size());
+		DrawStats::Get().Draw(mLightVolume.nVertices, (int64_t)gVisiblePointLights.size());
+		UEndPass();
+
+		glDisable(GL_DEPTH_CLAMP);
+		glCullFace(GL_BACK);
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_BLEND);
 	}
 
+	// The lamp is unlit, it's drawn forward on top of the lit image against the same depth
+	glDepthFunc(depthTest);
+	glDepthMask(GL_TRUE);
+	UBeginPass("lamp");
+	UDrawLightObject(frame, *shaders.lamp);
+	UEndPass();
+
+	UBeginPass("blit");
+	gGBuffer.BlitToDefault(frame.framebufferWidth, frame.framebufferHeight, gOutputFramebuffer);
+	UEndPass();
 }
 
-// ---------------------------------------------------------
-// MESH CONSTRUCTORS
-// ---------------------------------------------------------
-void MeshConstructor()
+// Visibility buffer rendering. The geometry pass writes only triangle ids and depth, then
+// each pixel is shaded exactly once from those ids, one full-screen pass per material.
+void URenderVisibility(const FrameSnapshot& frame, const RenderShaders& shaders)
 {
-	CreatePlane(mPlane);
-	UCreateLight(mLight);
-	CreateFrontHedge(mFrontHedge);
-	CreateLeftFoot(mLeftFoot);
-	CreateRightFoot(mRightFoot);
-	CreateLeftLeg(mLeftLeg);
-	CreateRightLeg(mRightLeg);
-	CreateTorso(mTorso);
-	CreateLeftArm(mLeftArm);
-	CreateRightArm(mRightArm);
-	CreateHead(mHead);
-	CreateLeftHedge(mLeftHedge);
-	CreateTrailer(mTrailer);
+	const GLenum depthTest = gReverseZ ? GL_GREATER : GL_LESS;
+	const glm::mat4 viewProjection = frame.projection * frame.view;
 
+	gVisibilityBuffer.Resize(frame.framebufferWidth, frame.framebufferHeight);
+	if (gVisibilityGeometryVersion != frame.sceneVersion)
+	{
+		gVisibilityBuffer.BuildGeometry(gStaticDraws);
+		gVisibilityGeometryVersion = frame.sceneVersion;
+		if (gStaticDraws.Materials().size() > (size_t)VisibilityBuffer::MAX_MATERIALS)
+			cout << "WARNING: " << gStaticDraws.Materials().size() << " materials, the visibility pipeline only resolves the first "
+				<< VisibilityBuffer::MAX_MATERIALS << endl;
+	}
+	glViewport(0, 0, frame.framebufferWidth, frame.framebufferHeight);
+
+	// --------------------
+	// ID PASS
+	// --------------------
+	gVisibilityBuffer.BindIds();
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(depthTest);
+	glDepthMask(GL_TRUE);
+	glClearDepth(gReverseZ ? 0.0 : 1.0);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	const GLuint noTriangle[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, noTriangle);
+
+	UBuildRenderQueue(viewProjection, frame.viewPos, gRenderQueue);
+
+	Shader& visibilityShader = *shaders.visibility;
+	visibilityShader.use();
+	USetCameraUniforms(visibilityShader, frame);
+	UBeginPass("id pass");
+	gStaticDraws.ReplayGeometry(gRenderQueue, &visibilityShader);
+	UEndPass();
+
+	// --------------------
+	// MATERIAL CLASSIFY
+	// --------------------
+	// Every covered pixel gets its material as depth, see VisibilityBuffer::MaterialDepth.
+	// The material depth buffer always clears to 1, nothing's there.
+	gVisibilityBuffer.BindMaterial();
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClearDepth(1.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	gVisibilityBuffer.BindForResolve(0);
+
+	glDepthFunc(GL_ALWAYS);
+	shaders.visibilityClassify->use();
+	glBindVertexArray(gEmptyVao);
+	DrawStats::Get().Add(DrawStats::VAO_BINDS);
+	UBeginPass("classify");
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	DrawStats::Get().Draw(3);
+	UEndPass();
+
+	// --------------------
+	// RESOLVE
+	// --------------------
+	// One full-screen triangle per material at that material's depth. The EQUAL test
+	// drops every other pixel before the fragment shader runs.
+	Shader& resolveShader = *shaders.visibilityResolve;
+	resolveShader.use();
+	const unsigned int cameraInputs = FrameState::Bit(FrameState::CAMERA) | FrameState::Bit(FrameState::PROJECTION);
+	if (gUniformCache.NeedsUpload(resolveShader.ID, UniformCache::VIEW_PROJECTION, frame.state, cameraInputs))
+		resolveShader.setMat4("viewProjection", viewProjection);
+	if (gUniformCache.NeedsUpload(resolveShader.ID, UniformCache::SCREEN, frame.state, FrameState::Bit(FrameState::VIEWPORT)))
+		resolveShader.setVec2("screenSize", (float)frame.framebufferWidth, (float)frame.framebufferHeight);
+	USetCameraUniforms(resolveShader, frame);
+	USetLightUniforms(resolveShader, frame);
+
+	glDepthFunc(GL_EQUAL);
+	glDepthMask(GL_FALSE);
+	const std::vector<DrawList::Material>& materials = gStaticDraws.Materials();
+	const GLint shininess = resolveShader.Location("material.shininess");
+	const GLint clipDepth = resolveShader.Location("clipDepth");
+	const size_t resolvedMaterials = std::min(materials.size(), (size_t)VisibilityBuffer::MAX_MATERIALS);
+	UBeginPass("resolve");
+	for (size_t i = 0; i < resolvedMaterials; ++i)
+	{
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, materials[i].diffuseMap);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, materials[i].specularMap);
+		glActiveTexture(GL_TEXTURE0);
+		DrawStats::Get().Add(DrawStats::TEXTURE_BINDS, 2);
+		resolveShader.setFloat(shininess, materials[i].shininess);
+
+		// window depth to clip depth, which depends on glClipControl
+		float materialDepth = VisibilityBuffer::MaterialDepth(i);
+		resolveShader.setFloat(clipDepth, gReverseZ ? materialDepth : materialDepth * 2.0f - 1.0f);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		DrawStats::Get().Draw(3);
+	}
+	UEndPass();
+
+	// The lamp is drawn forward against the scene depth from the id pass
+	gVisibilityBuffer.BindScene();
+	glDepthFunc(depthTest);
+	glDepthMask(GL_TRUE);
+	UBeginPass("lamp");
+	UDrawLightObject(frame, *shaders.lamp);
+	UEndPass();
+
+	UBeginPass("blit");
+	gVisibilityBuffer.BlitToDefault(frame.framebufferWidth, frame.framebufferHeight, gOutputFramebuffer);
+	UEndPass();
 }
 
-void CreatePlane(GLMesh& mesh)
+// Redraws whatever the shadow cascades need this frame: the cached static layer of any
+// cascade that moved and is due, and the dynamic casters on top of every cascade.
+void UUpdateShadows(const FrameSnapshot& frame, const RenderShaders& shaders)
 {
-	GLfloat verts[] = {
-		//Vectors				// Normals			// Texture Coords
-		//------------------------------------------------------------
-		 10.0f, 0.0f, -10.0f,	0.0f, 1.0f, 0.0f,	1.0f, 1.0f,
-		 10.0f, 0.0f,  10.0f,	0.0f, 1.0f, 0.0f,	1.0f, 0.0f,
-		-10.0f, 0.0f,  10.0f,	0.0f, 1.0f, 0.0f,	0.0f, 0.0f,
-		 10.0f, 0.0f, -10.0f,   0.0f, 1.0f, 0.0f,	1.0f, 1.0f,
-		-10.0f, 0.0f, -10.0f,	0.0f, 1.0f, 0.0f,	0.0f, 1.0f,
-		-10.0f, 0.0f,  10.0f,	0.0f, 1.0f, 0.0f,	0.0f, 0.0f,
-	};
+	// the camera looks down the view matrix's -z axis
+	glm::vec3 forward = -glm::vec3(frame.view[0][2], frame.view[1][2], frame.view[2][2]);
+	gShadowCascades.Update(lightPosition, frame.viewPos, forward, frame.sceneVersion);
+
+	gDynamicQueue.resize(gDynamicDraws.Size());
+	for (unsigned int i = 0; i < gDynamicQueue.size(); ++i)
+		gDynamicQueue[i] = i;
+
+	Shader& depthShader = *shaders.depth;
+	depthShader.use();
+	depthShader.setMat4("view", glm::mat4(1.0f));
+	depthShader.setMat4("model", glm::mat4(1.0f));
+	const GLint projection = depthShader.Location("projection");
+
+	// slope scaled bias away from the light against acne. Reverse-Z pushes the other way.
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(gReverseZ ? GL_GREATER : GL_LESS);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(gReverseZ ? -2.0f : 2.0f, gReverseZ ? -4.0f : 4.0f);
+
+	for (int i = 0; i < ShadowCascades::CASCADES; ++i)
+	{
+		depthShader.setMat4(projection, gShadowCascades.ViewProjection(i));
 
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
+		if (gShadowCascades.NeedsStatic(i))
+		{
+			const Frustum frustum(gShadowCascades.ViewProjection(i), gReverseZ);
+			const std::vector<DrawCommand>& commands = gStaticDraws.Commands();
+			gShadowQueue.clear();
+			for (unsigned int draw = 0; draw < commands.size(); ++draw)
+				if (frustum.IntersectsBox(commands[draw].boundsMin, commands[draw].boundsMax))
+					gShadowQueue.push_back(draw);
+
+			gShadowCascades.BeginStatic(i);
+			gStaticDraws.ReplayGeometry(gShadowQueue);
+		}
 
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
+		if (gDynamicDraws.Size() > 0)
+		{
+			gShadowCascades.BeginDynamic(i);
+			gDynamicDraws.ReplayGeometry(gDynamicQueue);
+		}
+	}
 
-	glGenVertexArrays(1, &mesh.vao);
-	glBindVertexArray(mesh.vao);
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	// the depth shader's camera uniforms are the cascades' now
+	gUniformCache.Invalidate(depthShader.ID);
+	gShadowCascades.EndFrame();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-	// Create VBO
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+// Draws the cube that marks where the directional light comes from
+void UDrawLightObject(const FrameSnapshot& frame, Shader& lightShader)
+{
+	lightShader.use();
+	USetCameraUniforms(lightShader, frame, false);
+	if (gUniformCache.NeedsUpload(lightShader.ID, UniformCache::MODEL_MATRIX, frame.state, FrameState::Bit(FrameState::LIGHTS)))
+	{
+		glm::mat4 model = glm::mat4(1.0f);
+		model = glm::translate(model, lightPosition);
+		model = glm::scale(model, glm::vec3(1.2f));
+		lightShader.setMat4("model", model);
+	}
 
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
+	glBindVertexArray(mLight.vao);
+	glDrawArrays(GL_TRIANGLES, 0, mLight.nVertices);
+	DrawStats::Get().Add(DrawStats::VAO_BINDS);
+	DrawStats::Get().Draw(mLight.nVertices);
+}
 
-	// Create Vertex Attribute pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
+// Moves the point lights to where they are at the given time and keeps the ones
+// whose sphere reaches into the view in gVisiblePointLights.
+void UUpdatePointLights(double time, const glm::mat4& viewProjection)
+{
+	const Frustum frustum(viewProjection, gReverseZ);
 
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
+	gVisiblePointLights.clear();
+	for (size_t i = 0; i < gPointLightMotion.size(); ++i)
+	{
+		const PointLightMotion& motion = gPointLightMotion[i];
+		float angle = motion.phase + motion.speed * (float)time;
+		glm::vec3 position = motion.origin + glm::vec3(cos(angle), 0.0f, sin(angle)) * motion.orbitRadius;
+
+		float radius = gPointLightColors[i].positionRadius.w;
+		if (!frustum.IntersectsBox(position - glm::vec3(radius), position + glm::vec3(radius)))
+			continue;
+
+		PointLight light = gPointLightColors[i];
+		light.positionRadius = glm::vec4(position, radius);
+		gVisiblePointLights.push_back(light);
+	}
 
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
 }
 
-void UCreateLight(GLMesh& mesh)
+// Moves the point lights for the frame and bins the visible ones into clusters
+// across the job system, then uploads lights and clusters for the object shader.
+void UAssignLightClusters(const FrameSnapshot& frame)
 {
-	// Position and Color data
-	GLfloat verts[] = {
-		//Positions          //Normals
-		// ------------------------------------------------------
-		//Back Face          //Negative Z Normal  Texture Coords.
-	   -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
-		0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 0.0f,
-		0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
-		0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
-	   -0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f,
-	   -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
+	UUpdatePointLights(frame.time, frame.projection * frame.view);
 
-	   //Front Face         //Positive Z Normal
-	  -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 0.0f,
-	   0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 0.0f,
-	   0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f,
-	   0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f,
-	  -0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f,
-	  -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 0.0f,
+	// exponential slices for perspective, even ones over the orthographic depth range
+	if (frame.orthographic)
+		gLightClusters.Assign(gVisiblePointLights, frame.view, frame.projection, -20.0f, 20.0f, false, *gJobs);
+	else
+		gLightClusters.Assign(gVisiblePointLights, frame.view, frame.projection, NEAR_PLANE, CLUSTER_FAR_PLANE, true, *gJobs);
 
-	  //Left Face          //Negative X Normal
-	 -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-	 -0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
-	 -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-	 -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-	 -0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
-	 -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+	gLightClusters.Create();
+	gLightClusters.Upload(gVisiblePointLights, 0);
+}
 
-	 //Right Face         //Positive X Normal
-	 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
-	 0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
-	 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-	 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
-	 0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
-	 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+// Infinite far plane perspective projection for reverse-Z with [0, 1] clip depth.
+// Depth is zNear / distance: 1 at the near plane, falling towards 0 at infinity,
+// which spreads float precision evenly over the whole range.
+glm::mat4 UReverseInfinitePerspective(float fovy, float aspect, float zNear)
+{
+	const float f = 1.0f / tan(fovy / 2.0f);
+
+	glm::mat4 projection(0.0f);
+	projection[0][0] = f / aspect;
+	projection[1][1] = f;
+	projection[2][3] = -1.0f;
+	projection[3][2] = zNear;
+	return projection;
+}
 
-	 //Bottom Face        //Negative Y Normal
-	-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
-	 0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 1.0f,
+// Orthographic projection for reverse-Z with [0, 1] clip depth: depth 1 at zNear, 0 at zFar
+glm::mat4 UReverseOrtho(float left, float right, float bottom, float top, float zNear, float zFar)
+{
+	glm::mat4 projection(1.0f);
+	projection[0][0] = 2.0f / (right - left);
+	projection[1][1] = 2.0f / (top - bottom);
+	projection[2][2] = 1.0f / (zFar - zNear);
+	projection[3][0] = -(right + left) / (right - left);
+	projection[3][1] = -(top + bottom) / (top - bottom);
+	projection[3][2] = zFar / (zFar - zNear);
+	return projection;
+}
+
+// Uploads projection, view (with viewPos) and, for worldSpace geometry like the static
+// draws, an identity model to the bound program. Skips whichever it already has.
+void USetCameraUniforms(Shader& shader, const FrameSnapshot& frame, bool worldSpace)
+{
+	if (gUniformCache.NeedsUpload(shader.ID, UniformCache::PROJECTION_MATRIX, frame.state, FrameState::Bit(FrameState::PROJECTION)))
+		shader.setMat4("projection", frame.projection);
+	if (gUniformCache.NeedsUpload(shader.ID, UniformCache::VIEW_MATRIX, frame.state, FrameState::Bit(FrameState::CAMERA)))
+	{
+		shader.setMat4("view", frame.view);
+		shader.setVec3("viewPos", frame.viewPos);
+	}
+	if (worldSpace && gUniformCache.NeedsUpload(shader.ID, UniformCache::MODEL_MATRIX, frame.state, 0))
+		shader.setMat4("model", glm::mat4(1.0f));
+}
+
+// Uploads the directional light to the bound program if it doesn't have it yet
+void USetLightUniforms(Shader& shader, const FrameSnapshot& frame)
+{
+	if (!gUniformCache.NeedsUpload(shader.ID, UniformCache::LIGHT, frame.state, FrameState::Bit(FrameState::LIGHTS)))
+		return;
+	shader.setVec3("light.position", lightPosition);
+	shader.setVec3("light.ambient", 0.1f, 0.1f, 0.1f);
+	shader.setVec3("light.diffuse", 0.7f, 0.7f, 0.7f);
+	shader.setVec3("light.specular", 0.8f, 0.8f, 0.8f);
+}
+
+void UReportUniformUploads()
+{
+	cout << "INFO: Uniform groups uploaded " << gUniformCache.Uploads() << " times, skipped " << gUniformCache.Skipped()
+		<< " times because nothing they depend on changed" << endl;
+}
+
+// Logs every pass's GPU time over the profiler's window, with its pipeline statistics
+void UReportGpuProfile()
+{
+	if (!gGpuProfile)
+		return;
+
+	for (const std::string& name : gGpuProfiler.Names())
+	{
+		GpuProfiler::Stats stats;
+		if (!gGpuProfiler.GetStats(name, stats))
+			continue;
+		cout << "INFO: GPU " << name << ": " << stats.averageMs << " ms (p50 " << stats.p50Ms << ", p95 " << stats.p95Ms
+			<< ", p99 " << stats.p99Ms << ", max " << stats.maxMs << ") over " << stats.samples << " frames";
+		if (stats.primitives > 0.0 || stats.fragmentInvocations > 0.0)
+		{
+			cout << ", " << (long long)stats.primitives << " primitives, " << (long long)stats.vertexInvocations << " vertices, "
+				<< (long long)stats.fragmentInvocations << " fragments";
+		}
+		cout << endl;
+	}
+	if (gGpuProfiler.Stalls() > 0)
+		cout << "WARNING: GPU profile waited on query results " << gGpuProfiler.Stalls() << " times" << endl;
+}
+
+// Logs what every pass submitted per frame on average, the passes that nest in
+// another counted on their own
+void UReportDrawStats()
+{
+	if (!gDrawStats)
+		return;
+
+	const std::vector<DrawStats::PassCounts> passes = DrawStats::Get().Passes();
+	for (const DrawStats::PassCounts& pass : passes)
+	{
+		const double* average = pass.average;
+		cout << "INFO: Draw stats " << pass.name << ": " << average[DrawStats::DRAW_CALLS] << " draws, "
+			<< average[DrawStats::VERTICES] << " vertices, " << average[DrawStats::INDICES] << " indices, "
+			<< average[DrawStats::PROGRAM_BINDS] << " program, " << average[DrawStats::VAO_BINDS] << " VAO and "
+			<< average[DrawStats::TEXTURE_BINDS] << " texture binds, " << average[DrawStats::UNIFORM_UPLOADS] << " uniform uploads, "
+			<< average[DrawStats::BUFFER_BYTES] << " buffer bytes per frame" << endl;
+	}
+	cout << "INFO: Draw stats over " << DrawStats::Get().Frames() << " frames, last frame: " << DrawStats::Get().Summary() << endl;
+}
+
+// Saves the CPU zones as a Chrome trace, for chrome://tracing or ui.perfetto.dev
+void UWriteCpuProfile()
+{
+	if (!gCpuProfileOutput)
+		return;
+
+	if (!gCpuProfiler.WriteChromeTrace(gCpuProfileOutput))
+	{
+		cout << "ERROR: Couldn't write " << gCpuProfileOutput << endl;
+		return;
+	}
+	cout << "INFO: Wrote " << gCpuProfiler.Events() << " CPU zones to " << gCpuProfileOutput << endl;
+	if (gCpuProfiler.Dropped() > 0)
+		cout << "WARNING: " << gCpuProfiler.Dropped() << " CPU zones didn't fit in the profiler's buffers" << endl;
+}
+
+// Reads back whatever fragment counts the GPU has finished and logs them every couple of seconds
+void UReportFragmentCounts()
+{
+	static GLuint64 prepassCount = 0;
+	static GLuint64 shadingCount = 0;
+	static GLuint64 rasterizedCount = 0;
+	static int framesSinceReport = 0;
+
+	GLuint64 result;
+	while (gPrepassFragments.Poll(result))
+		prepassCount = result;
+	while (gShadingFragments.Poll(result))
+		shadingCount = result;
+	while (gRasterizedFragments.Poll(result))
+		rasterizedCount = result;
+
+	if (++framesSinceReport < 120)
+		return;
+	framesSinceReport = 0;
+
+	if (gDepthPrepass && prepassCount > 0)
+	{
+		cout << "INFO: Fragments shaded: " << shadingCount << ", without depth prepass: " << prepassCount
+			<< ", saved: " << (GLint64)(prepassCount - shadingCount) << " (" << 100.0 * (1.0 - (double)shadingCount / prepassCount) << "%)" << endl;
+	}
+	else
+	{
+		cout << "INFO: Fragments shaded: " << shadingCount << endl;
+	}
+
+	// Without discard or depth writes in the fragment shader the driver tests depth before
+	// shading, so whatever was rasterized but not shaded was killed by early-Z.
+	if (GLEW_ARB_pipeline_statistics_query && rasterizedCount >= shadingCount)
+	{
+		cout << "INFO: Fragments rasterized: " << rasterizedCount << ", killed by early-Z: " << rasterizedCount - shadingCount
+			<< " (" << (gSortDraws ? "front to back" : "unsorted") << ")" << endl;
+	}
+}
+
+// Builds the frame's render queue: frustum culls the static draws and works out their
+// sort keys across the job system, then puts the visible ones in draw order.
+void UBuildRenderQueue(const glm::mat4& viewProjection, const glm::vec3& viewPos, std::vector<unsigned int>& queue)
+{
+	// commands per job. The current scene fits in one batch and is handled inline.
+	static const size_t CULL_BATCH_SIZE = 256;
+	CpuProfiler::Zone zone(gCpuProfiler, "cull");
+
+	const std::vector<DrawCommand>& commands = gStaticDraws.Commands();
+	const Frustum frustum(viewProjection, gReverseZ);
+	gVisibleDraws.resize(commands.size());
+	gSortKeys.resize(commands.size());
+
+	gJobs->ParallelFor(commands.size(), CULL_BATCH_SIZE, [&](size_t begin, size_t end)
+	{
+		CpuProfiler::Zone batchZone(gCpuProfiler, "cull batch");
+		for (size_t i = begin; i < end; ++i)
+		{
+			const DrawCommand& command = commands[i];
+			gVisibleDraws[i] = frustum.IntersectsBox(command.boundsMin, command.boundsMax) ? 1 : 0;
+			if (gVisibleDraws[i] && gSortDraws)
+			{
+				glm::vec3 center = (command.boundsMin + command.boundsMax) * 0.5f;
+				gSortKeys[i] = DrawList::SortKey(glm::distance(center, viewPos), command.materialId);
+			}
+		}
+	});
+
+	queue.clear();
+	for (unsigned int i = 0; i < commands.size(); ++i)
+		if (gVisibleDraws[i])
+			queue.push_back(i);
+
+	// ties fall back to record order so the order is stable from frame to frame
+	if (gSortDraws)
+	{
+		std::sort(queue.begin(), queue.end(), [](unsigned int a, unsigned int b)
+		{
+			return gSortKeys[a] != gSortKeys[b] ? gSortKeys[a] < gSortKeys[b] : a < b;
+		});
+	}
+}
+
+// Render thread entry point. Owns the GL context until it sees the quit snapshot.
+void URenderThreadMain(SpscQueue<FrameSnapshot>& frames, const RenderShaders& shaders)
+{
+	glfwMakeContextCurrent(gWindow);
+	gCpuProfiler.SetThreadName("render");
+
+	FrameSnapshot frame;
+	for (;;)
+	{
+		{
+			CpuProfiler::Zone zone(gCpuProfiler, "wait for frame");
+			frames.Pop(frame);
+		}
+		if (frame.quit)
+			break;
+
+		CpuProfiler::Zone frameZone(gCpuProfiler, "frame");
+		URenderFrame(frame, shaders);
+		UCaptureFrame(frame);
+		CpuProfiler::Zone zone(gCpuProfiler, "swap");
+		glfwSwapBuffers(gWindow);
+	}
+
+	glfwMakeContextCurrent(NULL);
+}
+
+// ---------------------------------------------------------
+// MESH CONSTRUCTORS
+// ---------------------------------------------------------
+void MeshConstructor()
+{
+	CreatePlane(mPlane);
+	UCreateLight(mLight);
+	CreateFrontHedge(mFrontHedge);
+	CreateLeftFoot(mLeftFoot);
+	CreateRightFoot(mRightFoot);
+	CreateLeftLeg(mLeftLeg);
+	CreateRightLeg(mRightLeg);
+	CreateTorso(mTorso);
+	CreateLeftArm(mLeftArm);
+	CreateRightArm(mRightArm);
+	CreateHead(mHead);
+	CreateLeftHedge(mLeftHedge);
+	CreateTrailer(mTrailer);
+	UCreateLightVolume(mLightVolume);
+
+	// new meshes mean the recorded draws are out of date
+	++gSceneVersion;
+}
+
+// Records a static mesh drawn with the same image for its diffuse and specular maps.
+// The meshes are built in world space, so their bounds are already world space bounds.
+void UAddStaticDraw(DrawList& drawList, const GLMesh& mesh, GLuint texture, float shininess)
+{
+	drawList.Add(mesh.vao, mesh.vbo, mesh.nVertices, mesh.boundsMin, mesh.boundsMax, texture, texture, shininess);
+}
+
+// Records the draws for all of the static scene content. Called again
+// whenever gSceneVersion changes.
+void URecordStaticScene(DrawList& drawList)
+{
+	drawList.Begin(gSceneVersion);
+
+	// --------------------
+	// PAVEMENT PLANE
+	// --------------------
+	// Pavement is not shiny, set pretty low.
+	/* JBLACK - 
+	 * The specular map is the same image as the diffuse map. Not
+	 * particularly needed, but I didn't want to mess with my shaders
+	 * any further. */
+	drawList.SetGroup(DRAW_GROUP_PLANE);
+	UAddStaticDraw(drawList, mPlane, gTexPavement, 1.0f);
+
+	// --------------------
+	// HEDGES
+	// --------------------
+	drawList.SetGroup(DRAW_GROUP_HEDGES);
+	UAddStaticDraw(drawList, mFrontHedge, gTexHedge, 1.0f);
+	UAddStaticDraw(drawList, mLeftHedge, gTexHedge, 1.0f);
+
+	// Trailer
+	drawList.SetGroup(DRAW_GROUP_TRAILER);
+	UAddStaticDraw(drawList, mTrailer, gTexGray, 1.0f);
+
+	// --------------------
+	// GUNDAM PARTS
+	// --------------------
+	// shiny gundam, steel texture
+	drawList.SetGroup(DRAW_GROUP_GUNDAM);
+	UAddStaticDraw(drawList, mLeftFoot, gTexSteel, 64.0f);
+	UAddStaticDraw(drawList, mRightFoot, gTexSteel, 64.0f);
+	UAddStaticDraw(drawList, mLeftLeg, gTexSteel, 64.0f);
+	UAddStaticDraw(drawList, mRightLeg, gTexSteel, 64.0f);
+	UAddStaticDraw(drawList, mTorso, gTexSteel, 64.0f);
+	UAddStaticDraw(drawList, mLeftArm, gTexSteel, 64.0f);
+	UAddStaticDraw(drawList, mRightArm, gTexSteel, 64.0f);
+	UAddStaticDraw(drawList, mHead, gTexSteel, 64.0f);
+}
+
+void CreatePlane(GLMesh& mesh)
+{
+	GLfloat verts[] = {
+		//Vectors				// Normals			// Texture Coords
+		//------------------------------------------------------------
+		 10.0f, 0.0f, -10.0f,	0.0f, 1.0f, 0.0f,	1.0f, 1.0f,
+		 10.0f, 0.0f,  10.0f,	0.0f, 1.0f, 0.0f,	1.0f, 0.0f,
+		-10.0f, 0.0f,  10.0f,	0.0f, 1.0f, 0.0f,	0.0f, 0.0f,
+		 10.0f, 0.0f, -10.0f,   0.0f, 1.0f, 0.0f,	1.0f, 1.0f,
+		-10.0f, 0.0f, -10.0f,	0.0f, 1.0f, 0.0f,	0.0f, 1.0f,
+		-10.0f, 0.0f,  10.0f,	0.0f, 1.0f, 0.0f,	0.0f, 0.0f,
+	};
+
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
+}
+
+void UCreateLight(GLMesh& mesh)
+{
+	// Position and Color data
+	GLfloat verts[] = {
+		//Positions          //Normals
+		// ------------------------------------------------------
+		//Back Face          //Negative Z Normal  Texture Coords.
+	   -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
+		0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 0.0f,
+		0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
+		0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f, 1.0f,
+	   -0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 1.0f,
+	   -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f, 0.0f,
+
+	   //Front Face         //Positive Z Normal
+	  -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 0.0f,
+	   0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 0.0f,
+	   0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f,
+	   0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  1.0f, 1.0f,
+	  -0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 1.0f,
+	  -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,  0.0f, 0.0f,
+
+	  //Left Face          //Negative X Normal
+	 -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+	 -0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
+	 -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
+	 -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
+	 -0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
+	 -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+
+	 //Right Face         //Positive X Normal
+	 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+	 0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f,
+	 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
+	 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 1.0f,
+	 0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  0.0f, 0.0f,
+	 0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f,
+
+	 //Bottom Face        //Negative Y Normal
+	-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
+	 0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 1.0f,
 	 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
 	 0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
 	-0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 0.0f,
@@ -465,32 +1770,7 @@ void UCreateLight(GLMesh& mesh)
    -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f
 	};
 
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
 }
 
 void CreateFrontHedge(GLMesh& mesh)
@@ -548,32 +1828,7 @@ void CreateFrontHedge(GLMesh& mesh)
 	    -4.5f, 0.0f, 3.5f, 		 1.0f,  0.0f,  0.0f,   1.0f, 0.0f
 	};
 
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
 }
 
 void CreateLeftFoot(GLMesh& mesh)
@@ -615,32 +1870,7 @@ void CreateLeftFoot(GLMesh& mesh)
 		2.5f,   0.0f, -1.45f,   1.0f, 0.0f, 0.0f,    1.0f, 0.0f,
 		2.4f,   1.5f,  0.0f,    1.0f, 0.0f, 0.0f,    0.5f, 1.0f
 	};
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
 }
 
 void CreateRightFoot(GLMesh& mesh)
@@ -681,32 +1911,7 @@ void CreateRightFoot(GLMesh& mesh)
 		-2.5f,   0.0f, -1.45f,	1.0f, -1.0f, 0.0f,  1.0f, 0.0f,
 		-2.4f,   1.5f,  0.0f, 	1.0f, -1.0f, 0.0f,  0.5f, 1.0f
 	};
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
 }
 
 void CreateLeftLeg(GLMesh& mesh)
@@ -762,32 +1967,7 @@ void CreateLeftLeg(GLMesh& mesh)
 		1.75f, 5.1f, 0.7f,    	1.0, 0.0f, 0.0f,   0.0f, 1.0f,
 		1.75f, 5.1f, -1.05f,  	1.0, 0.0f, 0.0f,   1.0f, 1.0f,
 	};
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
 }
 
 void CreateRightLeg(GLMesh& mesh)
@@ -843,32 +2023,7 @@ void CreateRightLeg(GLMesh& mesh)
 		-1.75f, 5.1f, 0.7f,   	1.0, 0.0f, 0.0f,   1.0f, 0.0f,
 		-1.75f, 5.1f, -1.05f, 	1.0, 0.0f, 0.0f,   1.0f, 1.0f,
 	};
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
 }
 
 void CreateTorso(GLMesh& mesh)
@@ -924,32 +2079,7 @@ void CreateTorso(GLMesh& mesh)
 	  -1.75f, 9.5f, 1.0f,    	1.0f, 0.0f, 0.0f,   0.0f, 1.0f,
 	  -1.75f, 9.5f, -1.25f, 	1.0f, 0.0f, 0.0f,   1.0f, 1.0f,
 	};
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
 }
 
 void CreateLeftArm(GLMesh& mesh)
@@ -1005,32 +2135,7 @@ void CreateLeftArm(GLMesh& mesh)
 		-1.75f, 9.6f, -0.7f,	0.0f, 0.0f, -1.0f,	0.0f, 1.0f,
 		-1.75f, 5.0f,  0.7f, 	0.0f, 0.0f, -1.0f,	0.0f, 0.0f,
 	};
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
 }
 
 void CreateRightArm(GLMesh& mesh)
@@ -1086,32 +2191,7 @@ void CreateRightArm(GLMesh& mesh)
 		1.75f, 9.6f, -0.7f,		0.0f, 0.0f, -1.0f,	0.0f, 1.0f,
 		1.75f, 5.0f,  0.7f, 	0.0f, 0.0f, -1.0f,	0.0f, 0.0f,
 	};
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
 }
 
 void CreateHead(GLMesh& mesh)
@@ -1167,32 +2247,7 @@ void CreateHead(GLMesh& mesh)
 		0.7f, 10.5f, 0.8f,		1.0f, 0.0f, 0.0f,	0.0f, 1.0f,
 		0.7f, 9.5f,  0.8f,		1.0f, 0.0f, 0.0f,	0.0f, 0.0f,
 	};
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
 }
 
 void CreateLeftHedge(GLMesh& mesh)
@@ -1249,33 +2304,8 @@ void CreateLeftHedge(GLMesh& mesh)
 		 -4.0f, 0.0f, -4.0f, 	 1.0f,  0.0f,  0.0f,   1.0f, 0.0f
 	};
 
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
-}
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
+}
 
 void CreateTrailer(GLMesh& mesh)
 {
@@ -1331,32 +2361,91 @@ void CreateTrailer(GLMesh& mesh)
 		 5.5f, 0.0f, -2.0f, 	-1.0f,  0.0f,  0.0f,    0.0f, 0.0f,
 	};
 
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
+	UCreateMeshBuffers(mesh, verts, sizeof(verts));
+}
 
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
+// Sphere the deferred renderer draws around each point light. Position only, wound
+// counter-clockwise seen from outside. The vertices sit a bit outside the unit sphere so
+// the flat faces between them never cut into it. Its VAO also pulls per-light data
+// from gPointLightBuffer, one entry per instance.
+void UCreateLightVolume(GLMesh& mesh)
+{
+	const int stacks = 8;
+	const int slices = 12;
+	const float scale = 1.0f / (cos(glm::pi<float>() / stacks) * cos(glm::pi<float>() / slices));
 
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
+	auto spherePoint = [&](int stack, int slice)
+	{
+		float theta = glm::pi<float>() * stack / stacks;
+		float phi = 2.0f * glm::pi<float>() * slice / slices;
+		return glm::vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi)) * scale;
+	};
 
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, &mesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	std::vector<glm::vec3> verts;
+	for (int stack = 0; stack < stacks; ++stack)
+	{
+		for (int slice = 0; slice < slices; ++slice)
+		{
+			glm::vec3 a = spherePoint(stack, slice);
+			glm::vec3 b = spherePoint(stack + 1, slice);
+			glm::vec3 c = spherePoint(stack + 1, slice + 1);
+			glm::vec3 d = spherePoint(stack, slice + 1);
+			verts.push_back(a); verts.push_back(c); verts.push_back(b);
+			verts.push_back(a); verts.push_back(d); verts.push_back(c);
+		}
+	}
+	mesh.nVertices = (GLuint)verts.size();
+	mesh.boundsMin = glm::vec3(-scale);
+	mesh.boundsMax = glm::vec3(scale);
 
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
 
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+	glGenBuffers(1, &mesh.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+	glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(glm::vec3), verts.data(), GL_STATIC_DRAW);
+	GpuMemory::Get().TrackBuffer(mesh.vbo, GpuMemory::VERTEX_BUFFER, "light volume", verts.size() * sizeof(glm::vec3));
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
 	glEnableVertexAttribArray(0);
 
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
+	// per light: position and radius, then color
+	glGenBuffers(1, &gPointLightBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, gPointLightBuffer);
+	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(PointLight), (void*)offsetof(PointLight, positionRadius));
+	glEnableVertexAttribArray(3);
+	glVertexAttribDivisor(3, 1);
+	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(PointLight), (void*)offsetof(PointLight, color));
+	glEnableVertexAttribArray(4);
+	glVertexAttribDivisor(4, 1);
+}
 
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+// Scatters count point lights over the pavement with random colors, sizes and orbits.
+// Seeded so every run gets the same lights.
+void UCreatePointLights(int count)
+{
+	std::mt19937 random(330);
+	std::uniform_real_distribution<float> position(-9.0f, 9.0f);
+	std::uniform_real_distribution<float> height(0.3f, 3.0f);
+	std::uniform_real_distribution<float> radius(1.5f, 4.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	gPointLightMotion.resize(count);
+	gPointLightColors.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		PointLightMotion& motion = gPointLightMotion[i];
+		motion.origin = glm::vec3(position(random), height(random), position(random));
+		motion.orbitRadius = 0.5f + unit(random) * 1.5f;
+		motion.speed = (unit(random) - 0.5f) * 2.0f;
+		motion.phase = unit(random) * 2.0f * glm::pi<float>();
+
+		// saturated colors: scale so the brightest channel is 1, then by the intensity
+		glm::vec3 color(unit(random), unit(random), unit(random));
+		color /= std::max(std::max(color.x, color.y), std::max(color.z, 0.001f));
+		gPointLightColors[i].positionRadius = glm::vec4(motion.origin, radius(random));
+		gPointLightColors[i].color = glm::vec4(color * 3.0f, 0.0f);
+	}
+	gVisiblePointLights.reserve(count);
 }
 
 
@@ -1364,6 +2453,115 @@ void CreateTrailer(GLMesh& mesh)
 // STANDARD FUNCTIONS - No changes made beyond this point
 // ---------------------------------------------------------
 bool UInitialize(int, char* [], GLFWwindow** window)
+{
+	// Headless there's no window and no GLFW either, which would need a display to start
+	if (gHeadless)
+	{
+		if (!gHeadlessContext.Create(gHeadlessBackend))
+			return false;
+		cout << "INFO: Headless OpenGL context: " << gHeadlessContext.Backend() << endl;
+	}
+	else if (!UCreateWindow(window))
+	{
+		return false;
+	}
+
+	// GLEW: initialize
+	// ----------------
+	// Note: if using GLEW version 1.13 or earlier
+	glewExperimental = GL_TRUE;
+	GLenum GlewInitResult = glewInit();
+
+	if (GLEW_OK != GlewInitResult)
+	{
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+		// a GLX build of GLEW has loaded the GL functions by then, there's just no X display
+		if (!(gHeadless && GlewInitResult == GLEW_ERROR_NO_GLX_DISPLAY))
+#endif
+		{
+			std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
+			return false;
+		}
+	}
+
+	// Displays GPU OpenGL version
+	cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+
+	// Don't leave the swap interval (and with it frame rate and latency) up to the driver
+	if (!gHeadless)
+		USetSwapInterval(gVsyncMode);
+	gFramePacer.SetTargetFrameRate(gFrameRateCap);
+	gFramePacer.SetLogInterval(gFrameStatsInterval);
+
+	// Reverse-Z only works with [0, 1] clip depth, otherwise the precision gain is lost
+	if (gReverseZ)
+	{
+		if (GLEW_VERSION_4_5 || GLEW_ARB_clip_control)
+		{
+			glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+		}
+		else
+		{
+			cout << "WARNING: glClipControl isn't supported, reverse-Z is disabled" << endl;
+			gReverseZ = false;
+		}
+	}
+
+	// Shadow maps follow whichever depth convention the scene uses
+	if (gShadows)
+		gShadowCascades.Create(SHADOW_MAP_SIZE, gReverseZ);
+
+	// Core profile won't draw without a VAO bound, even when the vertex shader needs no attributes
+	glGenVertexArrays(1, &gEmptyVao);
+
+	// a headless context has nothing to show frames on, they all end up in the output
+	// target. Batch frames go there too, so they're read back at the size asked for.
+	gSceneTarget.SetOwner("scene target");
+	gOutputTarget.SetOwner("output target");
+	if (gHeadless || gBatchFile)
+	{
+		gOutputTarget.Resize(gFramebufferWidth, gFramebufferHeight);
+		gOutputFramebuffer = gOutputTarget.Framebuffer();
+	}
+
+	// the deferred and visibility pipelines size their own targets to the window
+	if (gDynamicResolution.Enabled())
+	{
+		if (gRenderPipeline == PIPELINE_DEFERRED || gRenderPipeline == PIPELINE_VISIBILITY)
+		{
+			cout << "WARNING: Dynamic resolution only works with the forward and clustered pipelines" << endl;
+			gDynamicResolution.SetTarget(0.0);
+		}
+		else
+		{
+			gGpuFrameTime.Create(GL_TIME_ELAPSED);
+		}
+	}
+
+	if (gCountFragments)
+	{
+		// Fragment shader invocations are the exact count, samples passed is close enough without the extension
+		gPrepassFragments.Create(GL_SAMPLES_PASSED);
+		gShadingFragments.Create(GLEW_ARB_pipeline_statistics_query ? GL_FRAGMENT_SHADER_INVOCATIONS_ARB : GL_SAMPLES_PASSED);
+		gRasterizedFragments.Create(GL_SAMPLES_PASSED);
+	}
+
+	if (gGpuProfile)
+	{
+		// Only one query per target can be active, fragment counting already uses the statistics ones
+		bool statistics = GLEW_ARB_pipeline_statistics_query && !gCountFragments;
+		if (GLEW_ARB_pipeline_statistics_query && gCountFragments)
+			cout << "WARNING: GPU profile has no pipeline statistics with --count-fragments" << endl;
+		gGpuProfiler.Create(statistics);
+		if (gGpuProfileCsv && !gGpuProfiler.OpenCsv(gGpuProfileCsv))
+			cout << "ERROR: Failed to open " << gGpuProfileCsv << " for the GPU profile" << endl;
+	}
+
+	return true;
+}
+
+// Creates the window, makes its context current and hooks up the input callbacks
+bool UCreateWindow(GLFWwindow** window)
 {
 	// GLFW: initialize and configure
 	// ------------------------------
@@ -1386,35 +2584,1082 @@ bool UInitialize(int, char* [], GLFWwindow** window)
 		return false;
 	}
 	glfwMakeContextCurrent(*window);
+	glfwGetFramebufferSize(*window, &gFramebufferWidth, &gFramebufferHeight);
 	glfwSetFramebufferSizeCallback(*window, UResizeWindow);
 	glfwSetCursorPosCallback(*window, UMousePositionCallback);
 	glfwSetScrollCallback(*window, UMouseScrollCallback);
 	glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+	glfwSetKeyCallback(*window, UKeyCallback);
+	glfwSetWindowFocusCallback(*window, UWindowFocusCallback);
+	glfwSetWindowIconifyCallback(*window, UWindowIconifyCallback);
+	glfwSetWindowRefreshCallback(*window, UWindowRefreshCallback);
 
 	// tell GLFW to capture our mouse
 	glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-	// GLEW: initialize
-	// ----------------
-	// Note: if using GLEW version 1.13 or earlier
-	glewExperimental = GL_TRUE;
-	GLenum GlewInitResult = glewInit();
+	return true;
+}
 
-	if (GLEW_OK != GlewInitResult)
+// Sets the swap interval for the current context. Adaptive vsync (swap interval -1)
+// only waits for the vertical blank when the frame is on time and tears instead of
+// dropping to half rate when it's late. It needs the swap_control_tear extension.
+void USetSwapInterval(Vsync_Mode mode)
+{
+	switch (mode)
+	{
+	case VSYNC_OFF:
+		glfwSwapInterval(0);
+		break;
+	case VSYNC_ADAPTIVE:
+		if (glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+		{
+			glfwSwapInterval(-1);
+			break;
+		}
+		cout << "WARNING: Adaptive vsync isn't supported, using regular vsync" << endl;
+		glfwSwapInterval(1);
+		break;
+	default:
+		glfwSwapInterval(1);
+		break;
+	}
+}
+
+// Command line options:
+//   --on-demand          only render when input, camera movement or an animation needs a frame
+//   --background-fps N   cap the frame rate at N while the window is unfocused or minimized
+//   --render-thread      draw on a dedicated render thread
+//   --frame-depth N      how many frames the main thread may queue ahead of the render thread
+//   --threads N          number of job system worker threads (default: one per spare core)
+//   --job-benchmark      time frustum culling on 1..N threads and exit
+//   --vsync MODE         off, on (default) or adaptive
+//   --fps-cap N          limit the frame rate to N frames per second
+//   --no-smoothing       move the camera by the raw frame delta
+//   --frame-stats N      log frame time mean/deviation every N seconds, and how many
+//                        uniform uploads were skipped at exit
+//   --reverse-z          float depth buffer with reverse-Z and an infinite far plane
+//   --depth-prepass      lay down depth first, then shade each pixel once
+//   --count-fragments    log how many fragments get shaded (and how many the prepass saves)
+//   --no-sort            draw in scene order instead of front to back
+//   --pipeline NAME      forward (default), deferred, clustered or visibility
+//   --lights N           add N moving point lights (deferred and clustered pipelines)
+//   --no-shadows         turn off the directional light's shadows
+//   --bake-lightmaps     bake the static scene's lighting into Images/scene.lmap and exit
+//   --bake-samples N     hemisphere rays per lightmap texel when baking (default 64)
+//   --lightmap           light static draws from the baked lightmap (forward pipeline)
+//   --dynamic-res MS     scale the scene's resolution to keep GPU time per frame near MS
+//                        (forward and clustered pipelines)
+//   --dynamic-res-range MIN MAX   lowest and highest resolution scale (default 0.5 1)
+//   --dynamic-res-hysteresis F N  only scale up after N frames at least F under the target
+//                                 (default 0.1 30)
+//   --headless           render without a window (needs a build with HEADLESS_EGL or HEADLESS_OSMESA)
+//   --headless-backend NAME   egl or osmesa (default: the first one that works)
+//   --frames N           frames to render headless (default 60)
+//   --output FILE        write the last headless frame to FILE, as PNG if the name ends
+//                        in .png and as a binary PPM image otherwise
+//   --batch FILE         render one image per camera keyframe in FILE and exit. Each line
+//                        is "x y z yaw pitch [zoom]", # starts a comment
+//   --batch-output PREFIX   image names are PREFIX, the keyframe number and .png
+//                           (default frame_)
+//   --batch-workers N    split the keyframes across N rendering processes
+//   --batch-range FIRST COUNT   only render keyframes FIRST..FIRST+COUNT-1
+//   --capture PREFIX     write every frame as PREFIX, the frame number and .png
+//   --capture-depth N    frames a readback may lag behind before it stalls (default 3)
+//   --encoders N         threads compressing and writing images (default 2)
+//   --gpu-profile        time each render pass on the GPU, shown in the title bar and
+//                        logged at exit
+//   --gpu-profile-groups  also time the plane, hedges, trailer and gundam separately
+//   --gpu-profile-csv FILE   write every pass timing to FILE as CSV
+//   --draw-stats         count each pass's draws, vertices, binds, uniform and buffer uploads,
+//                        shown in the title bar and logged at exit
+//   --gpu-memory         log the GPU memory each texture and buffer takes, by category, at exit
+//   --benchmark FILE     fly the camera along the keyframes in FILE (the --batch format) at a
+//                        fixed time step, write startup and frame times, draw calls and memory
+//                        use to --benchmark-output and exit. Combine with --headless for no window
+//   --benchmark-frames N   measured frames (default 300)
+//   --benchmark-warmup N   frames rendered before measuring starts (default 30)
+//   --benchmark-output FILE   where the results go (default benchmark.json)
+//   --cpu-profile FILE   record CPU zones on every thread and write them to FILE as a
+//                        Chrome trace (chrome://tracing, ui.perfetto.dev) at exit
+void UParseCommandLine(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--on-demand") == 0)
+		{
+			gRenderOnDemand = true;
+			gThrottleBackground = true;
+		}
+		else if (strcmp(argv[i], "--background-fps") == 0 && i + 1 < argc)
+		{
+			// the wait for the next frame is 1 / rate, so only a positive rate makes sense
+			double rate = atof(argv[++i]);
+			if (rate > 0.0)
+			{
+				gBackgroundFrameRate = rate;
+				gThrottleBackground = true;
+			}
+			else
+			{
+				cout << "WARNING: --background-fps needs a positive frame rate, ignoring " << argv[i] << endl;
+			}
+		}
+		else if (strcmp(argv[i], "--render-thread") == 0)
+		{
+			gUseRenderThread = true;
+		}
+		else if (strcmp(argv[i], "--frame-depth") == 0 && i + 1 < argc)
+		{
+			gFrameDepth = atoi(argv[++i]);
+			if (gFrameDepth < 1)
+				gFrameDepth = 1;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			gWorkerThreads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--job-benchmark") == 0)
+		{
+			gRunJobBenchmark = true;
+		}
+		else if (strcmp(argv[i], "--vsync") == 0 && i + 1 < argc)
+		{
+			++i;
+			if (strcmp(argv[i], "off") == 0)
+				gVsyncMode = VSYNC_OFF;
+			else if (strcmp(argv[i], "adaptive") == 0)
+				gVsyncMode = VSYNC_ADAPTIVE;
+			else
+				gVsyncMode = VSYNC_ON;
+		}
+		else if (strcmp(argv[i], "--fps-cap") == 0 && i + 1 < argc)
+		{
+			gFrameRateCap = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-smoothing") == 0)
+		{
+			gSmoothDelta = false;
+		}
+		else if (strcmp(argv[i], "--frame-stats") == 0 && i + 1 < argc)
+		{
+			gFrameStatsInterval = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--reverse-z") == 0)
+		{
+			gReverseZ = true;
+		}
+		else if (strcmp(argv[i], "--depth-prepass") == 0)
+		{
+			gDepthPrepass = true;
+		}
+		else if (strcmp(argv[i], "--count-fragments") == 0)
+		{
+			gCountFragments = true;
+		}
+		else if (strcmp(argv[i], "--no-sort") == 0)
+		{
+			gSortDraws = false;
+		}
+		else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc)
+		{
+			++i;
+			if (strcmp(argv[i], "deferred") == 0)
+				gRenderPipeline = PIPELINE_DEFERRED;
+			else if (strcmp(argv[i], "clustered") == 0)
+				gRenderPipeline = PIPELINE_CLUSTERED;
+			else if (strcmp(argv[i], "visibility") == 0)
+				gRenderPipeline = PIPELINE_VISIBILITY;
+			else
+				gRenderPipeline = PIPELINE_FORWARD;
+		}
+		else if (strcmp(argv[i], "--no-shadows") == 0)
+		{
+			gShadows = false;
+		}
+		else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+		{
+			gNumPointLights = std::max(atoi(argv[++i]), 0);
+		}
+		else if (strcmp(argv[i], "--bake-lightmaps") == 0)
+		{
+			gBakeLightmaps = true;
+		}
+		else if (strcmp(argv[i], "--bake-samples") == 0 && i + 1 < argc)
+		{
+			gBakeSamples = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--lightmap") == 0)
+		{
+			gUseLightmap = true;
+		}
+		else if (strcmp(argv[i], "--headless") == 0)
+		{
+			gHeadless = true;
+		}
+		else if (strcmp(argv[i], "--headless-backend") == 0 && i + 1 < argc)
+		{
+			gHeadlessBackend = argv[++i];
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			gHeadlessFrames = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+		{
+			gHeadlessOutput = argv[++i];
+		}
+		else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+		{
+			gBatchFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--batch-output") == 0 && i + 1 < argc)
+		{
+			gBatchOutput = argv[++i];
+		}
+		else if (strcmp(argv[i], "--batch-workers") == 0 && i + 1 < argc)
+		{
+			gBatchWorkers = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+		{
+			gCaptureOutput = argv[++i];
+		}
+		else if (strcmp(argv[i], "--capture-depth") == 0 && i + 1 < argc)
+		{
+			gCaptureDepth = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--encoders") == 0 && i + 1 < argc)
+		{
+			gImageEncoderThreads = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--batch-range") == 0 && i + 2 < argc)
+		{
+			gBatchFirst = std::max(atoi(argv[++i]), 0);
+			gBatchCount = std::max(atoi(argv[++i]), 0);
+		}
+		else if (strcmp(argv[i], "--gpu-profile") == 0)
+		{
+			gGpuProfile = true;
+		}
+		else if (strcmp(argv[i], "--gpu-profile-groups") == 0)
+		{
+			gGpuProfile = true;
+			gProfileDrawGroups = true;
+		}
+		else if (strcmp(argv[i], "--gpu-profile-csv") == 0 && i + 1 < argc)
+		{
+			gGpuProfile = true;
+			gGpuProfileCsv = argv[++i];
+		}
+		else if (strcmp(argv[i], "--draw-stats") == 0)
+		{
+			gDrawStats = true;
+		}
+		else if (strcmp(argv[i], "--gpu-memory") == 0)
+		{
+			gGpuMemoryReport = true;
+		}
+		else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+		{
+			gBenchmarkFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--benchmark-frames") == 0 && i + 1 < argc)
+		{
+			gBenchmarkFrames = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--benchmark-warmup") == 0 && i + 1 < argc)
+		{
+			gBenchmarkWarmup = std::max(atoi(argv[++i]), 0);
+		}
+		else if (strcmp(argv[i], "--benchmark-output") == 0 && i + 1 < argc)
+		{
+			gBenchmarkOutput = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cpu-profile") == 0 && i + 1 < argc)
+		{
+			gCpuProfileOutput = argv[++i];
+		}
+		else if (strcmp(argv[i], "--dynamic-res") == 0 && i + 1 < argc)
+		{
+			gDynamicResolution.SetTarget(atof(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--dynamic-res-range") == 0 && i + 2 < argc)
+		{
+			float lowest = (float)atof(argv[++i]);
+			float highest = (float)atof(argv[++i]);
+			gDynamicResolution.SetBounds(lowest, highest);
+		}
+		else if (strcmp(argv[i], "--dynamic-res-hysteresis") == 0 && i + 2 < argc)
+		{
+			double fraction = atof(argv[++i]);
+			int frames = atoi(argv[++i]);
+			gDynamicResolution.SetHysteresis(fraction, frames);
+		}
+		else
+		{
+			cout << "WARNING: Unknown command line option: " << argv[i] << endl;
+		}
+	}
+}
+
+void UResizeWindow(GLFWwindow* window, int width, int height)
+{
+	// The viewport is set from the frame snapshot, since this thread might not own the context
+	gFramebufferWidth = width;
+	gFramebufferHeight = height;
+	gFrameState.Touch(FrameState::VIEWPORT);
+	URequestRedraw();
+}
+
+// ---------------------------------------------------------------------
+// FRAME SCHEDULING
+// ---------------------------------------------------------------------
+// Blocks until the next frame should be rendered. In the default continuous mode this
+// returns straight away. Returns false if the window was closed while waiting.
+bool UWaitForFrame(GLFWwindow* window)
+{
+	bool waited = false;
+	while (!glfwWindowShouldClose(window))
+	{
+		if (gThrottleBackground && gWindowIconified)
+		{
+			// Nothing is visible, so don't render. Just keep handling events at the background rate.
+			glfwWaitEventsTimeout(1.0 / gBackgroundFrameRate);
+			waited = true;
+			continue;
+		}
+
+		if (gThrottleBackground && !gWindowFocused)
+		{
+			double wait = gLastFrame + 1.0 / gBackgroundFrameRate - glfwGetTime();
+			if (wait > 0.0)
+			{
+				glfwWaitEventsTimeout(wait);
+				waited = true;
+				continue;
+			}
+		}
+
+		// moving point lights are an animation, they need a frame every time
+		bool lightsMoving = gNumPointLights > 0 && (gRenderPipeline == PIPELINE_DEFERRED || gRenderPipeline == PIPELINE_CLUSTERED);
+		if (!gRenderOnDemand || gRedrawRequested || lightsMoving || UCameraKeysHeld(window))
+		{
+			// Time spent asleep isn't movement time, start the frame delta over
+			if (waited)
+			{
+				gLastFrame = glfwGetTime();
+				gFramePacer.Reset();
+			}
+			return true;
+		}
+
+		// Nothing changed. Sleep until an event comes in.
+		glfwWaitEventsTimeout(IDLE_WAIT_TIMEOUT);
+		waited = true;
+	}
+	return false;
+}
+
+// Asks for a new frame in on-demand mode. Anything that changes what's on screen
+// (input, animation, scene edits) should call this.
+void URequestRedraw()
+{
+	gRedrawRequested = true;
+}
+
+// ---------------------------------------------------------------------
+// LIGHTMAPS
+// ---------------------------------------------------------------------
+// Bakes the static scene's lighting on every core and writes it to LIGHTMAP_PATH.
+// Meshes go to the baker in draw list order, which is how ULoadLightmap matches them
+// up again.
+void UBakeLightmaps()
+{
+	URecordStaticScene(gStaticDraws);
+	LightmapBaker baker(ULightmapSettings());
+	UAddStaticMeshes(baker);
+
+	auto start = std::chrono::steady_clock::now();
+	Lightmap lightmap = baker.Bake(*gJobs);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	cout << "INFO: Baked " << baker.TexelCount() << " lightmap texels (" << lightmap.width << "x" << lightmap.height << ", "
+		<< gBakeSamples << " samples) in " << seconds << " s" << endl;
+	if (!lightmap.Save(LIGHTMAP_PATH))
+		cout << "ERROR: Couldn't write " << LIGHTMAP_PATH << endl;
+}
+
+// The baker's settings: --bake-samples and the scene's directional light and sky
+LightmapBaker::Settings ULightmapSettings()
+{
+	LightmapBaker::Settings settings;
+	settings.samples = gBakeSamples;
+	settings.sunDirection = lightPosition;		// the same directional light the object shader uses
+	settings.sunColor = glm::vec3(0.7f);
+	settings.skyColor = glm::vec3(0.1f);
+	return settings;
+}
+
+// Gives the baker every recorded static draw. The geometry is read back from the draws'
+// vertex buffers, so the bake sees exactly what gets drawn, and each draw's albedo is the
+// average color of its diffuse texture (its smallest mip level).
+void UAddStaticMeshes(LightmapBaker& baker)
+{
+	const std::vector<DrawCommand>& commands = gStaticDraws.Commands();
+	const GLuint floatsPerEntry = 8;	// position, normal, uv (see UCreateMeshBuffers)
+
+	for (const DrawCommand& command : commands)
 	{
-		std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
+		std::vector<GLfloat> vertices((size_t)command.count * floatsPerEntry);
+		glBindBuffer(GL_ARRAY_BUFFER, command.vbo);
+		glGetBufferSubData(GL_ARRAY_BUFFER, command.first * floatsPerEntry * sizeof(GLfloat), vertices.size() * sizeof(GLfloat), vertices.data());
+
+		std::vector<glm::vec3> positions(command.count);
+		std::vector<glm::vec3> normals(command.count);
+		for (GLsizei v = 0; v < command.count; ++v)
+		{
+			const GLfloat* vertex = &vertices[(size_t)v * floatsPerEntry];
+			positions[v] = glm::vec3(vertex[0], vertex[1], vertex[2]);
+			normals[v] = glm::vec3(vertex[3], vertex[4], vertex[5]);
+		}
+
+		// the smallest mip level is the average of the whole texture
+		GLint width, height;
+		glBindTexture(GL_TEXTURE_2D, command.diffuseMap);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+		GLint lastLevel = 0;
+		while ((width >> lastLevel) > 1 || (height >> lastLevel) > 1)
+			++lastLevel;
+		GLfloat average[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+		glGetTexImage(GL_TEXTURE_2D, lastLevel, GL_RGBA, GL_FLOAT, average);
+
+		baker.AddMesh(positions, normals, glm::vec3(average[0], average[1], average[2]));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Loads the baked lightmap and gives every static draw's VAO its lightmap UVs.
+// Returns false if there's no lightmap or it was baked from a different scene or light.
+bool ULoadLightmap()
+{
+	URecordStaticScene(gStaticDraws);
+	const std::vector<DrawCommand>& commands = gStaticDraws.Commands();
+	std::vector<uint32_t> vertexCounts;
+	for (const DrawCommand& command : commands)
+		vertexCounts.push_back((uint32_t)command.count);
+
+	Lightmap lightmap;
+	if (!lightmap.Load(LIGHTMAP_PATH, vertexCounts))
+		return false;
+
+	// geometry edited without changing any vertex counts, or a different light
+	LightmapBaker baker(ULightmapSettings());
+	UAddStaticMeshes(baker);
+	if (baker.SourceHash() != lightmap.sourceHash)
+	{
+		cout << "WARNING: " << LIGHTMAP_PATH << " was baked from a different scene or light" << endl;
 		return false;
 	}
 
-	// Displays GPU OpenGL version
-	cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+	glGenTextures(1, &gLightmapTexture);
+	glBindTexture(GL_TEXTURE_2D, gLightmapTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, lightmap.width, lightmap.height);
+	GpuMemory::Get().TrackTexture(gLightmapTexture, GpuMemory::TEXTURE, LIGHTMAP_PATH, GL_RGBA8, lightmap.width, lightmap.height);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, lightmap.width, lightmap.height, GL_RGBA, GL_UNSIGNED_BYTE, lightmap.texels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	// no mipmaps: lower levels would blend neighbouring charts together
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// the UVs go in a separate buffer so the meshes' own vertex layout stays the same
+	gLightmapUvBuffers.resize(commands.size());
+	glGenBuffers((GLsizei)commands.size(), gLightmapUvBuffers.data());
+	for (size_t i = 0; i < commands.size(); ++i)
+	{
+		// indexed like the mesh's vertex buffer, so the draw's first vertex lines up
+		const GLsizeiptr uvSize = lightmap.uvs[i].size() * sizeof(float);
+		const GLintptr uvOffset = commands[i].first * 2 * sizeof(float);
+		glBindVertexArray(commands[i].vao);
+		glBindBuffer(GL_ARRAY_BUFFER, gLightmapUvBuffers[i]);
+		glBufferData(GL_ARRAY_BUFFER, uvOffset + uvSize, NULL, GL_STATIC_DRAW);
+		GpuMemory::Get().TrackBuffer(gLightmapUvBuffers[i], GpuMemory::VERTEX_BUFFER, "lightmap uvs", uvOffset + uvSize);
+		glBufferSubData(GL_ARRAY_BUFFER, uvOffset, uvSize, lightmap.uvs[i].data());
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
+		glEnableVertexAttribArray(3);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
+
+// ---------------------------------------------------------------------
+// HEADLESS
+// ---------------------------------------------------------------------
+// Renders gHeadlessFrames frames into the output target with the same frame code as
+// the window, stepping time by a fixed amount per frame so runs are repeatable, then
+// writes the last frame out if an output file was given.
+void URunHeadless(const RenderShaders& shaders)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < gHeadlessFrames; ++i)
+	{
+		CpuProfiler::Zone zone(gCpuProfiler, "frame");
+		gLastFrame = i * HEADLESS_TIME_STEP;
+		gDeltaTime = (float)HEADLESS_TIME_STEP;
+
+		FrameSnapshot frame = UBuildFrameSnapshot();
+		URenderFrame(frame, shaders);
+		UCaptureFrame(frame);
+	}
+	glFinish();
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	cout << "INFO: Rendered " << gHeadlessFrames << " headless frames in " << ms << " ms (" << ms / gHeadlessFrames << " ms/frame)" << endl;
+
+	if (gHeadlessOutput && !USaveFramebuffer(gOutputFramebuffer, gFramebufferWidth, gFramebufferHeight, gHeadlessOutput))
+		cout << "ERROR: Couldn't write " << gHeadlessOutput << endl;
+}
+
+// Reads the framebuffer's color back and writes it as a PNG when the path ends in .png,
+// a binary PPM otherwise (top row first either way)
+bool USaveFramebuffer(GLuint framebuffer, int width, int height, const char* path)
+{
+	std::vector<unsigned char> pixels((size_t)width * height * 3);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	// GL's rows start at the bottom
+	flipImageVertically(pixels.data(), width, height, 3);
+
+	size_t length = strlen(path);
+	if (length >= 4 && strcmp(path + length - 4, ".png") == 0)
+		return PngWriter::Write(path, pixels.data(), width, height, 3);
+
+	std::ofstream file(path, std::ios::binary);
+	file << "P6\n" << width << " " << height << "\n255\n";
+	file.write((const char*)pixels.data(), pixels.size());
+	return (bool)file;
+}
 
+// ---------------------------------------------------------------------
+// BATCH RENDERING
+// ---------------------------------------------------------------------
+// Reads camera keyframes, one per line: x y z yaw pitch and optionally zoom (the field
+// of view in degrees). Blank lines and everything after a # are skipped.
+bool ULoadKeyframes(const char* path, std::vector<CameraKeyframe>& keyframes)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		++lineNumber;
+		line = line.substr(0, line.find('#'));
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		CameraKeyframe keyframe;
+		keyframe.zoom = ZOOM;
+		std::istringstream fields(line);
+		if (!(fields >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z >> keyframe.yaw >> keyframe.pitch))
+		{
+			cout << "WARNING: " << path << ":" << lineNumber << ": expected x y z yaw pitch [zoom], skipping the line" << endl;
+			continue;
+		}
+		fields >> keyframe.zoom;
+		keyframes.push_back(keyframe);
+	}
+	if (keyframes.empty())
+	{
+		cout << "ERROR: " << path << " has no keyframes, expected lines of x y z yaw pitch [zoom]" << endl;
+		return false;
+	}
 	return true;
 }
 
-void UResizeWindow(GLFWwindow* window, int width, int height)
+// Splits the keyframes into gBatchWorkers contiguous ranges and renders each in a
+// process of its own: this program again, with the same options plus --batch-range.
+// The renderer keeps its state in globals around one GL context, so separate
+// processes are the way to get several contexts (and GPUs' worth of queues) working at
+// once. Returns false if any of them failed.
+bool URunBatchWorkers(int argc, char* argv[])
+{
+	std::vector<CameraKeyframe> keyframes;
+	if (!ULoadKeyframes(gBatchFile, keyframes))
+	{
+		cout << "ERROR: Couldn't read the keyframes in " << gBatchFile << endl;
+		return false;
+	}
+	const int first = std::min(gBatchFirst, (int)keyframes.size());
+	const int count = gBatchCount < 0 ? (int)keyframes.size() - first : std::min(gBatchCount, (int)keyframes.size() - first);
+
+	// everything but the options this process takes care of
+	std::string command = UQuoteArgument(argv[0]);
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--batch-workers") == 0 && i + 1 < argc)
+			i += 1;
+		else if (strcmp(argv[i], "--batch-range") == 0 && i + 2 < argc)
+			i += 2;
+		else
+			command += " " + UQuoteArgument(argv[i]);
+	}
+
+	const int workers = std::min(gBatchWorkers, std::max(count, 1));
+	std::vector<std::thread> threads;
+	std::vector<int> results(workers, 0);
+	auto start = std::chrono::steady_clock::now();
+	for (int w = 0; w < workers; ++w)
+	{
+		int begin = first + count * w / workers;
+		int end = first + count * (w + 1) / workers;
+		std::string workerCommand = command + " --batch-range " + std::to_string(begin) + " " + std::to_string(end - begin);
+#ifdef _WIN32
+		// cmd.exe drops the first and last quote of the line, give it a pair to drop
+		workerCommand = "\"" + workerCommand + "\"";
+#endif
+		threads.emplace_back([workerCommand, &results, w]() { results[w] = std::system(workerCommand.c_str()); });
+	}
+
+	bool succeeded = true;
+	for (int w = 0; w < workers; ++w)
+	{
+		threads[w].join();
+		if (results[w] != 0)
+		{
+			cout << "ERROR: Batch worker " << w << " failed (exit status " << results[w] << ")" << endl;
+			succeeded = false;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	cout << "INFO: " << workers << " batch workers rendered " << count << " frames in " << seconds << " s" << endl;
+	return succeeded;
+}
+
+// Renders this process' share of the keyframes into the output target. Each frame is
+// read back through gFrameCapture while the next ones are drawn and then handed to the
+// image encoders, so drawing, readback and compression all overlap.
+void URunBatch(const RenderShaders& shaders)
+{
+	std::vector<CameraKeyframe> keyframes;
+	if (!ULoadKeyframes(gBatchFile, keyframes))
+	{
+		cout << "ERROR: Couldn't read the keyframes in " << gBatchFile << endl;
+		return;
+	}
+	const int first = std::min(gBatchFirst, (int)keyframes.size());
+	const int end = gBatchCount < 0 ? (int)keyframes.size() : std::min(first + gBatchCount, (int)keyframes.size());
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = first; i < end; ++i)
+	{
+		CpuProfiler::Zone zone(gCpuProfiler, "frame");
+		const CameraKeyframe& keyframe = keyframes[i];
+		camera.Position = keyframe.position;
+		camera.SetOrientation(keyframe.yaw, keyframe.pitch);
+		camera.Zoom = keyframe.zoom;
+		gFrameState.Touch(FrameState::CAMERA);
+		gFrameState.Touch(FrameState::PROJECTION);
+
+		// keyframes can be anywhere, don't let the far cascades lag behind a jump
+		gShadowCascades.Invalidate();
+		gLastFrame = i * HEADLESS_TIME_STEP;
+		gDeltaTime = (float)HEADLESS_TIME_STEP;
+
+		FrameSnapshot frame = UBuildFrameSnapshot();
+		URenderFrame(frame, shaders);
+		gFrameCapture.Poll();
+		gFrameCapture.Capture(gOutputFramebuffer, frame.framebufferWidth, frame.framebufferHeight, (uint64_t)i);
+	}
+	UFinishCapture();
+
+	const int frames = end - first;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	cout << "INFO: Batch rendered keyframes " << first << " to " << end - 1 << " (" << frames << " frames) in " << seconds << " s" << endl;
+	UReportGpuProfile();
+	UReportDrawStats();
+	UWriteCpuProfile();
+}
+
+// ---------------------------------------------------------------------
+// BENCHMARK
+// ---------------------------------------------------------------------
+// Flies the camera along the benchmark path and writes out how long the frames took.
+// Time only moves by the fixed step and input is ignored, so two runs render the same
+// frames and their numbers can be compared. CPU time is from the start of a frame until
+// its commands are submitted (and swapped with a window), GPU time is from the first
+// to the last of its commands on the GPU. passes has each pass's DrawStats averaged
+// over the measured frames.
+void URunBenchmark(const RenderShaders& shaders)
+{
+	static const char* const PIPELINE_NAMES[] = { "forward", "deferred", "clustered", "visibility" };
+
+	// window, shaders, textures and meshes are all loaded by now
+	const double startupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - gProgramStart).count();
+
+	std::vector<CameraKeyframe> keyframes;
+	if (!ULoadKeyframes(gBenchmarkFile, keyframes))
+	{
+		cout << "ERROR: Couldn't read the benchmark path in " << gBenchmarkFile << endl;
+		return;
+	}
+
+	// a profiler of its own, with room for every measured frame
+	GpuProfiler frameTimer;
+	frameTimer.Create(false, 3, gBenchmarkFrames);
+
+	std::vector<double> cpuMs;
+	std::vector<double> drawCalls;
+	cpuMs.reserve(gBenchmarkFrames);
+	drawCalls.reserve(gBenchmarkFrames);
+
+	const int totalFrames = gBenchmarkWarmup + gBenchmarkFrames;
+	for (int i = 0; i < totalFrames && !(gWindow && glfwWindowShouldClose(gWindow)); ++i)
+	{
+		CpuProfiler::Zone zone(gCpuProfiler, "frame");
+		auto frameStart = std::chrono::steady_clock::now();
+		const int measured = i - gBenchmarkWarmup;
+		const float t = measured <= 0 || gBenchmarkFrames < 2 ? 0.0f : (float)measured / (gBenchmarkFrames - 1);
+
+		const CameraKeyframe keyframe = UInterpolateKeyframes(keyframes, t);
+		camera.Position = keyframe.position;
+		camera.SetOrientation(keyframe.yaw, keyframe.pitch);
+		camera.Zoom = keyframe.zoom;
+		gFrameState.Touch(FrameState::CAMERA);
+		gFrameState.Touch(FrameState::PROJECTION);
+		gLastFrame = i * HEADLESS_TIME_STEP;
+		gDeltaTime = (float)HEADLESS_TIME_STEP;
+
+		const unsigned long long drawsBefore = gStaticDraws.DrawCalls() + gDynamicDraws.DrawCalls();
+		FrameSnapshot frame = UBuildFrameSnapshot();
+		if (measured == 0)
+			DrawStats::Get().Reset();		// the per pass averages only cover measured frames
+		if (measured >= 0)
+		{
+			frameTimer.BeginFrame();
+			frameTimer.Begin("frame");
+		}
+		URenderFrame(frame, shaders);
+		if (measured >= 0)
+		{
+			frameTimer.End();
+			frameTimer.EndFrame();
+		}
+		UCaptureFrame(frame);
+		if (gWindow)
+			glfwSwapBuffers(gWindow);
+
+		if (measured >= 0)
+		{
+			cpuMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+			drawCalls.push_back((double)(gStaticDraws.DrawCalls() + gDynamicDraws.DrawCalls() - drawsBefore));
+		}
+
+		// events still have to be handled for the window to stay responsive
+		if (gWindow)
+			glfwPollEvents();
+	}
+	frameTimer.Flush();
+
+	std::vector<double> gpuMs;
+	frameTimer.GetSamples("frame", gpuMs);
+	frameTimer.Destroy();
+	if (cpuMs.size() < (size_t)gBenchmarkFrames)
+		cout << "WARNING: Benchmark stopped after " << cpuMs.size() << " of " << gBenchmarkFrames << " frames" << endl;
+
+	unsigned long long resident = 0, peak = 0;
+	const bool haveMemory = UProcessMemory(resident, peak);
+
+	std::ofstream out(gBenchmarkOutput);
+	out << "{\n";
+	out << "  \"path\": \"" << UJsonEscape(gBenchmarkFile) << "\",\n";
+	out << "  \"pipeline\": \"" << PIPELINE_NAMES[gRenderPipeline] << "\",\n";
+	out << "  \"headless\": " << (gHeadless ? "true" : "false") << ",\n";
+	out << "  \"width\": " << gFramebufferWidth << ",\n";
+	out << "  \"height\": " << gFramebufferHeight << ",\n";
+	out << "  \"warmup_frames\": " << gBenchmarkWarmup << ",\n";
+	out << "  \"frames\": " << cpuMs.size() << ",\n";
+	out << "  \"startup_ms\": " << startupMs << ",\n";
+	out << "  \"cpu_ms\": ";
+	UWriteSampleStats(out, cpuMs);
+	out << ",\n  \"gpu_ms\": ";
+	UWriteSampleStats(out, gpuMs);
+	out << ",\n  \"draw_calls\": ";
+	UWriteSampleStats(out, drawCalls);
+	out << ",\n  \"passes\": {";
+	const std::vector<DrawStats::PassCounts> passes = DrawStats::Get().Passes();
+	for (size_t p = 0; p < passes.size(); ++p)
+	{
+		out << (p > 0 ? "," : "") << "\n    \"" << UJsonEscape(passes[p].name) << "\": { ";
+		for (int c = 0; c < DrawStats::COUNTER_COUNT; ++c)
+			out << (c > 0 ? ", " : "") << "\"" << DrawStats::CounterName((DrawStats::Counter)c) << "\": " << passes[p].average[c];
+		out << " }";
+	}
+	out << "\n  }";
+	out << ",\n  \"memory\": { ";
+	if (haveMemory)
+		out << "\"resident_bytes\": " << resident << ", \"peak_resident_bytes\": " << peak << ", ";
+	out << "\"gpu_bytes\": " << GpuMemory::Get().TotalBytes() << ", \"gpu_peak_bytes\": " << GpuMemory::Get().PeakBytes() << " }";
+	out << "\n}\n";
+	out.close();
+	if (!out)
+	{
+		cout << "ERROR: Couldn't write " << gBenchmarkOutput << endl;
+		return;
+	}
+
+	double cpuTotal = 0.0;
+	for (double ms : cpuMs)
+		cpuTotal += ms;
+	cout << "INFO: Benchmarked " << cpuMs.size() << " frames, " << cpuTotal / std::max(cpuMs.size(), (size_t)1)
+		<< " ms/frame on the CPU, results in " << gBenchmarkOutput << endl;
+}
+
+// The camera at t (0 to 1) along the path, keyframes evenly spaced and linear in between
+CameraKeyframe UInterpolateKeyframes(const std::vector<CameraKeyframe>& keyframes, float t)
 {
-	glViewport(0, 0, width, height);
+	// with nothing to interpolate the camera stays where it is
+	if (keyframes.empty())
+	{
+		CameraKeyframe keyframe;
+		keyframe.position = camera.Position;
+		keyframe.yaw = camera.Yaw;
+		keyframe.pitch = camera.Pitch;
+		keyframe.zoom = camera.Zoom;
+		return keyframe;
+	}
+	if (keyframes.size() == 1)
+		return keyframes[0];
+
+	float position = glm::clamp(t, 0.0f, 1.0f) * (keyframes.size() - 1);
+	size_t index = std::min((size_t)position, keyframes.size() - 2);
+	float blend = position - index;
+	const CameraKeyframe& a = keyframes[index];
+	const CameraKeyframe& b = keyframes[index + 1];
+
+	CameraKeyframe keyframe;
+	keyframe.position = glm::mix(a.position, b.position, blend);
+	keyframe.yaw = glm::mix(a.yaw, b.yaw, blend);
+	keyframe.pitch = glm::mix(a.pitch, b.pitch, blend);
+	keyframe.zoom = glm::mix(a.zoom, b.zoom, blend);
+	return keyframe;
+}
+
+// Mean, percentiles and max of the samples as a JSON object, with the samples themselves
+// in frame order so runs can be compared sample by sample
+void UWriteSampleStats(std::ostream& out, const std::vector<double>& samples)
+{
+	out << "{ ";
+	if (!samples.empty())
+	{
+		std::vector<double> sorted(samples);
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0.0;
+		for (double value : sorted)
+			sum += value;
+		auto percentile = [&sorted](double p) { return sorted[std::min((size_t)(p * sorted.size()), sorted.size() - 1)]; };
+		out << "\"mean\": " << sum / sorted.size() << ", \"p50\": " << percentile(0.50) << ", \"p95\": " << percentile(0.95)
+			<< ", \"p99\": " << percentile(0.99) << ", \"max\": " << sorted.back() << ", ";
+	}
+	out << "\"samples\": [";
+	for (size_t i = 0; i < samples.size(); ++i)
+		out << (i > 0 ? ", " : "") << samples[i];
+	out << "] }";
+}
+
+// Backslashes and quotes escaped, for putting a path in a JSON string
+std::string UJsonEscape(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		escaped += c;
+	}
+	return escaped;
+}
+
+// How much memory the process has resident now and at most so far
+bool UProcessMemory(unsigned long long& resident, unsigned long long& peak)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return false;
+	resident = counters.WorkingSetSize;
+	peak = counters.PeakWorkingSetSize;
+	return true;
+#else
+	// Linux reports both in /proc, in kB
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	bool found = false;
+	while (std::getline(status, line))
+	{
+		std::istringstream fields(line);
+		std::string name;
+		unsigned long long kilobytes = 0;
+		fields >> name >> kilobytes;
+		if (name == "VmRSS:")
+			resident = kilobytes * 1024;
+		else if (name == "VmHWM:")
+			peak = kilobytes * 1024;
+		else
+			continue;
+		found = true;
+	}
+	return found;
+#endif
+}
+
+// ---------------------------------------------------------------------
+// FRAME CAPTURE
+// ---------------------------------------------------------------------
+// Queues a readback of the finished frame and passes on the ones that have arrived
+void UCaptureFrame(const FrameSnapshot& frame)
+{
+	if (!gCaptureOutput)
+		return;
+	gFrameCapture.Poll();
+	gFrameCapture.Capture(gOutputFramebuffer, frame.framebufferWidth, frame.framebufferHeight, gCapturedFrames++);
+}
+
+// gFrameCapture's consumer, names the frame and sends it to the encoders
+void UWriteCapturedFrame(const unsigned char* pixels, int width, int height, uint64_t frame)
+{
+	const std::string& prefix = gBatchFile ? gBatchOutput : std::string(gCaptureOutput);
+	char number[32];
+	snprintf(number, sizeof(number), "%05llu.png", (unsigned long long)frame);
+	if (!UWriteImageAsync(pixels, width, height, prefix + number, gBatchFile != nullptr))
+		++gImagesDropped;
+}
+
+// Copies a frame as it comes out of glReadPixels (RGBA, bottom row first) and writes it
+// as a PNG on the encoder threads. Returns false without queueing anything if the
+// encoders already have two frames each waiting, unless waitIfBusy.
+bool UWriteImageAsync(const unsigned char* rgba, int width, int height, const std::string& path, bool waitIfBusy)
+{
+	const int maxPending = (int)gImageEncoders->ThreadCount() * 2;
+	if (gImagesPending.load() >= maxPending)
+	{
+		if (!waitIfBusy)
+			return false;
+		while (gImagesPending.load() >= maxPending)
+			std::this_thread::yield();
+	}
+
+	// the copy out of the mapped buffer drops alpha, which means nothing in the frame, and
+	// turns the rows around since GL's start at the bottom
+	std::shared_ptr<std::vector<unsigned char>> pixels = std::make_shared<std::vector<unsigned char>>((size_t)width * height * 3);
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char* source = rgba + (size_t)(height - 1 - y) * width * 4;
+		unsigned char* target = pixels->data() + (size_t)y * width * 3;
+		for (int x = 0; x < width; ++x)
+		{
+			target[x * 3] = source[x * 4];
+			target[x * 3 + 1] = source[x * 4 + 1];
+			target[x * 3 + 2] = source[x * 4 + 2];
+		}
+	}
+
+	++gImagesPending;
+	gImageEncoders->Run([pixels, path, width, height]()
+	{
+		CpuProfiler::Zone zone(gCpuProfiler, "encode png");
+		if (!PngWriter::Write(path.c_str(), pixels->data(), width, height, 3))
+		{
+			cout << "ERROR: Couldn't write " << path << endl;
+			++gImageWriteFailures;
+		}
+		--gImagesPending;
+	}, gImagesWritten);
+	return true;
+}
+
+// Delivers the frames still in flight, waits for the encoders and reports
+void UFinishCapture()
+{
+	if (!gFrameCapture.IsCreated())
+		return;
+	gFrameCapture.Flush();
+	gImageEncoders->Wait(*gImagesWritten);
+	gFrameCapture.Destroy();
+
+	if (gCaptureOutput && !gBatchFile)
+		cout << "INFO: Captured " << gCapturedFrames - gImagesDropped << " of " << gCapturedFrames << " frames" << endl;
+	if (gImagesDropped > 0)
+		cout << "WARNING: " << gImagesDropped << " frames were dropped because the encoders couldn't keep up, try more --encoders" << endl;
+	if (gFrameCapture.Stalls() > 0)
+		cout << "WARNING: Frame readback stalled " << gFrameCapture.Stalls() << " times, try a larger --capture-depth" << endl;
+	if (gImageWriteFailures > 0)
+		cout << "ERROR: " << gImageWriteFailures << " images couldn't be written" << endl;
+}
+
+// ---------------------------------------------------------------------
+// JOB SYSTEM
+// ---------------------------------------------------------------------
+// Scaling benchmark for the job system. Culls a large synthetic set of boxes
+// with 1 to N threads and prints the time and speedup for each thread count.
+void UJobSystemBenchmark()
+{
+	const size_t boxCount = 1 << 20;
+	const int repetitions = 20;
+
+	std::mt19937 random(330);
+	std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> extent(0.1f, 2.0f);
+	std::vector<glm::vec3> boxMin(boxCount);
+	std::vector<glm::vec3> boxMax(boxCount);
+	for (size_t i = 0; i < boxCount; ++i)
+	{
+		glm::vec3 center(position(random), position(random), position(random));
+		glm::vec3 halfSize(extent(random), extent(random), extent(random));
+		boxMin[i] = center - halfSize;
+		boxMax[i] = center + halfSize;
+	}
+
+	const glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1F, 100.0F);
+	const Frustum frustum(projection * camera.GetViewMatrix());
+	std::vector<unsigned char> visible(boxCount);
+
+	unsigned int maxThreads = std::thread::hardware_concurrency();
+	if (maxThreads == 0)
+		maxThreads = 1;
+
+	double singleThreadMs = 0.0;
+	cout << "threads\tms/iteration\tspeedup" << endl;
+	for (unsigned int threads = 1; threads <= maxThreads; ++threads)
+	{
+		JobSystem jobs(threads - 1);
+
+		auto start = std::chrono::steady_clock::now();
+		for (int repetition = 0; repetition < repetitions; ++repetition)
+		{
+			jobs.ParallelFor(boxCount, 4096, [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; ++i)
+					visible[i] = frustum.IntersectsBox(boxMin[i], boxMax[i]) ? 1 : 0;
+			});
+		}
+		auto elapsed = std::chrono::steady_clock::now() - start;
+
+		double ms = std::chrono::duration<double, std::milli>(elapsed).count() / repetitions;
+		if (threads == 1)
+			singleThreadMs = ms;
+		cout << threads << "\t" << ms << "\t" << singleThreadMs / ms << endl;
+	}
 }
 
 // ---------------------------------------------------------------------
@@ -1423,6 +3668,7 @@ void UResizeWindow(GLFWwindow* window, int width, int height)
 void UProcessInput(GLFWwindow* window)
 {
 	static const float cameraSpeed = 2.5f;
+	CpuProfiler::Zone zone(gCpuProfiler, "input");
 
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, true);
@@ -1441,27 +3687,92 @@ void UProcessInput(GLFWwindow* window)
 		camera.ProcessKeyboard(UP, gDeltaTime);
 	if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
 		camera.ProcessKeyboard(DOWN, gDeltaTime);
+	if (UCameraKeysHeld(window))
+		gFrameState.Touch(FrameState::CAMERA);
 	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
+	{
 		orthographic = !orthographic;
+		gFrameState.Touch(FrameState::PROJECTION);
+	}
+}
+
+// True while any of the camera movement keys are down, so the camera keeps moving
+// in on-demand mode even though holding a key doesn't produce new events.
+bool UCameraKeysHeld(GLFWwindow* window)
+{
+	static const int movementKeys[] = { GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_Q, GLFW_KEY_E };
+
+	for (int key : movementKeys)
+		if (glfwGetKey(window, key) == GLFW_PRESS)
+			return true;
+	return false;
+}
+
+void UKeyCallback(GLFWwindow*, int, int, int, int)
+{
+	// any key press or release might change the view (movement, ortho toggle)
+	URequestRedraw();
 }
 
 // ---------------------------------------------------------------------
 // CLEANUP FUNCTIONS
 // ---------------------------------------------------------------------
-void UDestroyMesh(GLMesh& mesh)
+void UDestroyTexture(GLuint textureId)
 {
-    glDeleteVertexArrays(1, &mesh.vao);
-    glDeleteBuffers(1, &mesh.vbo);
+    glDeleteTextures(1, &textureId);
+    GpuMemory::Get().ReleaseTexture(textureId);
 }
-void UDestroyTexture(GLuint textureId)
+
+// Deletes the textures, buffers and targets while the context is still current, then
+// reports whatever GpuMemory still tracks as leaked
+void UDestroyResources()
 {
-    glGenTextures(1, &textureId);
+    if (gGpuMemoryReport)
+        GpuMemory::Get().Report(cout, true);
+
+    GLMesh* meshes[] = { &mPlane, &mLight, &mFrontHedge, &mLeftFoot, &mRightFoot, &mLeftLeg, &mRightLeg, &mTorso,
+        &mLeftArm, &mRightArm, &mHead, &mLeftHedge, &mTree, &mTrailer, &mLightVolume };
+    for (GLMesh* mesh : meshes)
+        UDestroyMesh(*mesh);
+
+    const GLuint textures[] = { gTexPavement, gTexSteel, gTexHedge, gTexGray };
+    for (GLuint texture : textures)
+        UDestroyTexture(texture);
+    if (gLightmapTexture != 0)
+        UDestroyTexture(gLightmapTexture);
+    gLightmapTexture = 0;
+
+    for (GLuint buffer : gLightmapUvBuffers)
+        GpuMemory::Get().ReleaseBuffer(buffer);
+    if (!gLightmapUvBuffers.empty())
+        glDeleteBuffers((GLsizei)gLightmapUvBuffers.size(), gLightmapUvBuffers.data());
+    gLightmapUvBuffers.clear();
+    glDeleteBuffers(1, &gPointLightBuffer);
+    GpuMemory::Get().ReleaseBuffer(gPointLightBuffer);
+    gPointLightBuffer = 0;
+    glDeleteVertexArrays(1, &gEmptyVao);
+    gEmptyVao = 0;
+
+    gSceneTarget.Destroy();
+    gOutputTarget.Destroy();
+    gOutputFramebuffer = 0;
+    gGBuffer.Destroy();
+    gVisibilityBuffer.Destroy();
+    gShadowCascades.Destroy();
+    gLightClusters.Destroy();
+    gFrameCapture.Destroy();
+
+    GpuMemory::Get().ReportLeaks(cout);
 }
 // ---------------------------------------------------------------------
 // MOUSE CONTROL FUNCTIONS
 // ---------------------------------------------------------------------
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 {
+    // the benchmark's camera path is the only thing allowed to move it
+    if (gBenchmarkFile)
+        return;
+
     if (gFirstMouse)
     {
         gLastX = xpos;
@@ -1476,6 +3787,8 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
     gLastY = ypos;
 
     camera.ProcessMouseMovement(xoffset, yoffset);
+    gFrameState.Touch(FrameState::CAMERA);
+    URequestRedraw();
 }
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 {
@@ -1490,4 +3803,22 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 {
     // no mouse click events required. 
 }
+// ---------------------------------------------------------------------
+// WINDOW STATE FUNCTIONS
+// ---------------------------------------------------------------------
+void UWindowFocusCallback(GLFWwindow*, int focused)
+{
+	gWindowFocused = focused == GLFW_TRUE;
+	URequestRedraw();
+}
+void UWindowIconifyCallback(GLFWwindow*, int iconified)
+{
+	gWindowIconified = iconified == GLFW_TRUE;
+	URequestRedraw();
+}
+void UWindowRefreshCallback(GLFWwindow*)
+{
+	// the window contents were damaged (uncovered, moved between monitors...)
+	URequestRedraw();
+}
 
@@ -0,0 +1,322 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// Ray tracing acceleration structure over a triangle soup, used by the lightmap baker.
+// Every node has up to four children and their bounds are stored as structure of
+// arrays, so one ray is tested against all four boxes at once with SSE (plain C++ on
+// targets without it). Built top down, splitting at the centroid median of the longest
+// axis twice per node. Read only once built, so any number of threads can trace at once.
+class Bvh
+{
+public:
+    struct Hit
+    {
+        float t;
+        uint32_t triangle;      // index into the triangles passed to Build
+        float u, v;             // barycentrics of vertices 1 and 2
+    };
+
+    // positions holds three vertices per triangle
+    void Build(const std::vector<glm::vec3>& positions)
+    {
+        size_t count = positions.size() / 3;
+        triangles.resize(count);
+        order.resize(count);
+        centroids.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const glm::vec3& v0 = positions[i * 3];
+            triangles[i].v0 = v0;
+            triangles[i].edge1 = positions[i * 3 + 1] - v0;
+            triangles[i].edge2 = positions[i * 3 + 2] - v0;
+            order[i] = (uint32_t)i;
+            centroids[i] = (v0 + positions[i * 3 + 1] + positions[i * 3 + 2]) / 3.0f;
+        }
+
+        nodes.clear();
+        if (count > 0)
+            buildNode(0, (uint32_t)count);
+
+        // triangles in leaf order so a leaf is one contiguous run
+        std::vector<Triangle> sorted(count);
+        for (size_t i = 0; i < count; ++i)
+            sorted[i] = triangles[order[i]];
+        triangles.swap(sorted);
+        centroids.clear();
+    }
+
+    // closest hit along origin + t * direction for t in (minT, maxT)
+    bool Intersect(const glm::vec3& origin, const glm::vec3& direction, float minT, float maxT, Hit& hit) const
+    {
+        return trace(origin, direction, minT, maxT, false, &hit);
+    }
+
+    // true if anything is hit in (minT, maxT). Stops at the first hit.
+    bool Occluded(const glm::vec3& origin, const glm::vec3& direction, float minT, float maxT) const
+    {
+        return trace(origin, direction, minT, maxT, true, nullptr);
+    }
+
+    size_t NodeCount() const { return nodes.size(); }
+
+private:
+    static const uint32_t LEAF_SIZE = 4;
+
+    struct Triangle
+    {
+        glm::vec3 v0;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+    };
+
+    // child >= 0 is an inner node, otherwise ~child is the first triangle of a leaf of
+    // count triangles. Unused slots are child -1 with no triangles (a real leaf always has
+    // some), and hitChildren masks them out rather than relying on their box.
+    struct alignas(16) Node
+    {
+        float minX[4], minY[4], minZ[4];
+        float maxX[4], maxY[4], maxZ[4];
+        int32_t child[4];
+        uint32_t count[4];
+    };
+
+    struct Bounds
+    {
+        glm::vec3 min, max;
+    };
+
+    Bounds triangleBounds(uint32_t begin, uint32_t end) const
+    {
+        Bounds bounds;
+        bounds.min = glm::vec3(INFINITY);
+        bounds.max = glm::vec3(-INFINITY);
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const Triangle& tri = triangles[order[i]];
+            glm::vec3 v1 = tri.v0 + tri.edge1;
+            glm::vec3 v2 = tri.v0 + tri.edge2;
+            bounds.min = glm::min(bounds.min, glm::min(tri.v0, glm::min(v1, v2)));
+            bounds.max = glm::max(bounds.max, glm::max(tri.v0, glm::max(v1, v2)));
+        }
+        return bounds;
+    }
+
+    // splits [begin, end) in two at the centroid median along the longest axis
+    uint32_t split(uint32_t begin, uint32_t end)
+    {
+        glm::vec3 low(INFINITY), high(-INFINITY);
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            low = glm::min(low, centroids[order[i]]);
+            high = glm::max(high, centroids[order[i]]);
+        }
+        glm::vec3 extent = high - low;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+        uint32_t middle = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](uint32_t a, uint32_t b)
+        {
+            return centroids[a][axis] < centroids[b][axis];
+        });
+        return middle;
+    }
+
+    uint32_t buildNode(uint32_t begin, uint32_t end)
+    {
+        uint32_t index = (uint32_t)nodes.size();
+        nodes.push_back(Node());
+
+        // up to four groups: split once, then split each half again if it's too big for a leaf
+        uint32_t ranges[4][2];
+        int groups = 0;
+        uint32_t middle = split(begin, end);
+        uint32_t halves[2][2] = { { begin, middle }, { middle, end } };
+        for (int h = 0; h < 2; ++h)
+        {
+            uint32_t b = halves[h][0], e = halves[h][1];
+            if (e - b > LEAF_SIZE)
+            {
+                uint32_t m = split(b, e);
+                ranges[groups][0] = b; ranges[groups][1] = m; ++groups;
+                ranges[groups][0] = m; ranges[groups][1] = e; ++groups;
+            }
+            else if (e > b)
+            {
+                ranges[groups][0] = b; ranges[groups][1] = e; ++groups;
+            }
+        }
+
+        for (int c = 0; c < 4; ++c)
+        {
+            Bounds bounds;
+            int32_t child = -1;
+            uint32_t count = 0;
+            if (c < groups)
+            {
+                uint32_t b = ranges[c][0], e = ranges[c][1];
+                bounds = triangleBounds(b, e);
+                if (e - b <= LEAF_SIZE)
+                {
+                    child = ~(int32_t)b;
+                    count = e - b;
+                }
+                else
+                {
+                    child = (int32_t)buildNode(b, e);
+                }
+            }
+            else
+            {
+                // inverted box to keep the node's bounds tidy; the slab test on it passes for
+                // every ray (enter = minT, exit = maxT), so traversal skips it by count instead
+                bounds.min = glm::vec3(INFINITY);
+                bounds.max = glm::vec3(-INFINITY);
+            }
+
+            // nodes may have grown, index again rather than holding a reference
+            Node& node = nodes[index];
+            node.minX[c] = bounds.min.x; node.minY[c] = bounds.min.y; node.minZ[c] = bounds.min.z;
+            node.maxX[c] = bounds.max.x; node.maxY[c] = bounds.max.y; node.maxZ[c] = bounds.max.z;
+            node.child[c] = child;
+            node.count[c] = count;
+        }
+        return index;
+    }
+
+    // bit c set if child c holds a subtree or triangles
+    static int usedChildren(const Node& node)
+    {
+        int mask = 0;
+        for (int c = 0; c < 4; ++c)
+            if (node.child[c] >= 0 || node.count[c] > 0)
+                mask |= 1 << c;
+        return mask;
+    }
+
+    // bit c set if child c is used and the ray overlaps its box somewhere in [minT, maxT]
+    static int hitChildren(const Node& node, const glm::vec3& origin, const glm::vec3& inverse, float minT, float maxT)
+    {
+#ifdef BVH_USE_SSE
+        __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+        __m128 ix = _mm_set1_ps(inverse.x), iy = _mm_set1_ps(inverse.y), iz = _mm_set1_ps(inverse.z);
+
+        // unaligned loads: before C++17 a std::vector doesn't honour the node's alignas
+        // (x86 MSVC heaps only give 8 bytes), and on an aligned address they cost the same
+        __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), ix);
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), ix);
+        __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), iy);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), iy);
+        __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), iz);
+        __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), iz);
+
+        __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_set1_ps(minT)));
+        __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(maxT)));
+        return _mm_movemask_ps(_mm_cmple_ps(enter, exit)) & usedChildren(node);
+#else
+        int mask = 0;
+        for (int c = 0; c < 4; ++c)
+        {
+            float tx0 = (node.minX[c] - origin.x) * inverse.x, tx1 = (node.maxX[c] - origin.x) * inverse.x;
+            float ty0 = (node.minY[c] - origin.y) * inverse.y, ty1 = (node.maxY[c] - origin.y) * inverse.y;
+            float tz0 = (node.minZ[c] - origin.z) * inverse.z, tz1 = (node.maxZ[c] - origin.z) * inverse.z;
+            float enter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), minT));
+            float exit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), maxT));
+            if (enter <= exit)
+                mask |= 1 << c;
+        }
+        return mask & usedChildren(node);
+#endif
+    }
+
+    // Moller-Trumbore, both sides
+    static bool hitTriangle(const Triangle& tri, const glm::vec3& origin, const glm::vec3& direction, float minT, float maxT, float& t, float& u, float& v)
+    {
+        glm::vec3 p = glm::cross(direction, tri.edge2);
+        float det = glm::dot(tri.edge1, p);
+        if (std::fabs(det) < 1e-12f)
+            return false;
+        float invDet = 1.0f / det;
+        glm::vec3 s = origin - tri.v0;
+        u = glm::dot(s, p) * invDet;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, tri.edge1);
+        v = glm::dot(direction, q) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        t = glm::dot(tri.edge2, q) * invDet;
+        return t > minT && t < maxT;
+    }
+
+    bool trace(const glm::vec3& origin, const glm::vec3& direction, float minT, float maxT, bool anyHit, Hit* hit) const
+    {
+        if (nodes.empty())
+            return false;
+
+        // a zero component would turn into 0 * inf = NaN in the slab test
+        glm::vec3 inverse;
+        for (int i = 0; i < 3; ++i)
+        {
+            float d = direction[i];
+            if (std::fabs(d) < 1e-20f)
+                d = d < 0.0f ? -1e-20f : 1e-20f;
+            inverse[i] = 1.0f / d;
+        }
+
+        bool found = false;
+        int32_t stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const Node& node = nodes[stack[--top]];
+            int mask = hitChildren(node, origin, inverse, minT, maxT);
+            for (int c = 0; c < 4; ++c)
+            {
+                if (!(mask & (1 << c)))
+                    continue;
+
+                if (node.child[c] >= 0)
+                {
+                    stack[top++] = node.child[c];
+                    continue;
+                }
+
+                uint32_t first = (uint32_t)~node.child[c];
+                for (uint32_t i = first; i < first + node.count[c]; ++i)
+                {
+                    float t, u, v;
+                    if (!hitTriangle(triangles[i], origin, direction, minT, maxT, t, u, v))
+                        continue;
+                    if (anyHit)
+                        return true;
+                    found = true;
+                    maxT = t;
+                    hit->t = t;
+                    hit->triangle = order[i];
+                    hit->u = u;
+                    hit->v = v;
+                }
+            }
+        }
+        return found;
+    }
+
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;
+    std::vector<uint32_t> order;        // leaf order position -> original triangle
+    std::vector<glm::vec3> centroids;   // only needed while building
+};
+#endif
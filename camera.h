@@ -122,6 +122,14 @@ public:
         updateCameraVectors();
     }
 
+    // points the camera along the given Euler angles, e.g. when it follows a recorded path
+    void SetOrientation(float yaw, float pitch)
+    {
+        Yaw = yaw;
+        Pitch = pitch;
+        updateCameraVectors();
+    }
+
     // processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
     void ProcessMouseScroll(float yoffset)
     {
@@ -0,0 +1,36 @@
+#ifndef COMMANDLINE_H
+#define COMMANDLINE_H
+
+#include <string>
+
+// Quotes a command line argument for the shell std::system runs commands with. Shared
+// by the program's batch workers and the performance gate, which both launch processes.
+inline std::string UQuoteArgument(const std::string& argument)
+{
+#ifdef _WIN32
+    // CommandLineToArgvW's rules: backslashes are literal except in front of a quote,
+    // where each one has to be doubled and the quote escaped with one more. The closing
+    // quote counts, so trailing backslashes are doubled as well.
+    std::string quoted = "\"";
+    size_t backslashes = 0;
+    for (char c : argument)
+    {
+        if (c == '\\')
+        {
+            ++backslashes;
+            continue;
+        }
+        quoted.append(c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+        quoted += c;
+        backslashes = 0;
+    }
+    quoted.append(backslashes * 2, '\\');
+    return quoted + "\"";
+#else
+    std::string quoted = "'";
+    for (char c : argument)
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    return quoted + "'";
+#endif
+}
+#endif
@@ -0,0 +1,239 @@
+#ifndef CPUPROFILER_H
+#define CPUPROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Records named CPU zones on every thread for a timeline viewer. A Zone on the stack
+// covers its scope; when it ends the zone goes into the calling thread's own event
+// buffer, which only that thread writes, so recording takes no locks (a thread only
+// locks once, the first time it records, to register its buffer). WriteChromeTrace
+// saves everything in the Chrome trace event format that chrome://tracing and
+// ui.perfetto.dev open.
+//
+// Disabled, a Zone is a test of one bool, nothing is timed or stored.
+class CpuProfiler
+{
+public:
+    // Times the enclosing scope. name has to outlive the profiler, string literals are the idea.
+    class Zone
+    {
+    public:
+        Zone(CpuProfiler& profiler, const char* name) : owner(profiler.enabled ? &profiler : nullptr), name(name), start(0)
+        {
+            if (owner)
+                start = owner->now();
+        }
+
+        ~Zone()
+        {
+            if (owner)
+                owner->record(name, start, owner->now());
+        }
+
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+    private:
+        CpuProfiler* owner;
+        const char* name;
+        int64_t start;
+    };
+
+    CpuProfiler() : enabled(false), id(nextId()), epoch(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~CpuProfiler()
+    {
+        for (std::unique_ptr<ThreadBuffer>& buffer : threads)
+            for (int i = 0; i < MAX_BLOCKS; ++i)
+                delete[] buffer->blocks[i].load(std::memory_order_relaxed);
+    }
+
+    CpuProfiler(const CpuProfiler&) = delete;
+    CpuProfiler& operator=(const CpuProfiler&) = delete;
+
+    // Has to be set before other threads start recording, it isn't synchronized.
+    void SetEnabled(bool enable)
+    {
+        enabled = enable;
+    }
+
+    bool Enabled() const
+    {
+        return enabled;
+    }
+
+    // names the calling thread in the trace, threads are "thread N" otherwise
+    void SetThreadName(const char* name)
+    {
+        if (!enabled)
+            return;
+        ThreadBuffer* buffer = threadBuffer();
+        std::lock_guard<std::mutex> lock(threadsLock);
+        buffer->name = name;
+    }
+
+    // zones recorded so far, and the ones that didn't fit
+    size_t Events() const
+    {
+        std::lock_guard<std::mutex> lock(threadsLock);
+        size_t total = 0;
+        for (const std::unique_ptr<ThreadBuffer>& buffer : threads)
+            total += buffer->count.load(std::memory_order_acquire);
+        return total;
+    }
+
+    size_t Dropped() const
+    {
+        std::lock_guard<std::mutex> lock(threadsLock);
+        size_t total = 0;
+        for (const std::unique_ptr<ThreadBuffer>& buffer : threads)
+            total += buffer->dropped.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // Writes every zone finished so far as complete ("X") events. Threads can keep
+    // recording meanwhile, whatever they add after the call starts is left out.
+    bool WriteChromeTrace(const char* path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+            return false;
+
+        std::lock_guard<std::mutex> lock(threadsLock);
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (size_t t = 0; t < threads.size(); ++t)
+        {
+            const ThreadBuffer& buffer = *threads[t];
+            file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+                << ",\"args\":{\"name\":\"" << escape(buffer.name) << "\"}}";
+            first = false;
+
+            size_t count = buffer.count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const Event& event = buffer.blocks[i / BLOCK_SIZE].load(std::memory_order_acquire)[i % BLOCK_SIZE];
+                // microseconds, keeping the nanoseconds as decimals
+                file << ",\n{\"name\":\"" << escape(event.name) << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t
+                    << ",\"ts\":" << event.start / 1000 << "." << digits(event.start % 1000)
+                    << ",\"dur\":" << (event.end - event.start) / 1000 << "." << digits((event.end - event.start) % 1000) << "}";
+            }
+        }
+        file << "\n]}\n";
+        file.close();
+        return (bool)file;
+    }
+
+private:
+    // Events live in blocks that are never moved, so the trace can be read while the
+    // owning thread appends. A thread that fills all of them drops further zones.
+    static const int BLOCK_SIZE = 4096;
+    static const int MAX_BLOCKS = 1024;
+
+    struct Event
+    {
+        const char* name;
+        int64_t start;      // nanoseconds since the profiler was made
+        int64_t end;
+    };
+
+    struct ThreadBuffer
+    {
+        ThreadBuffer() : count(0), dropped(0)
+        {
+            for (int i = 0; i < MAX_BLOCKS; ++i)
+                blocks[i].store(nullptr, std::memory_order_relaxed);
+        }
+        std::string name;
+        std::atomic<Event*> blocks[MAX_BLOCKS];
+        std::atomic<size_t> count;      // published with release once an event is complete
+        std::atomic<size_t> dropped;
+    };
+
+    static unsigned int nextId()
+    {
+        static std::atomic<unsigned int> ids(0);
+        return ++ids;
+    }
+
+    int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // the calling thread's buffer, registered the first time it asks
+    ThreadBuffer* threadBuffer()
+    {
+        // keyed by the profiler's id so a thread never writes into another profiler's buffer
+        static thread_local unsigned int cachedId = 0;
+        static thread_local ThreadBuffer* cachedBuffer = nullptr;
+        if (cachedId == id)
+            return cachedBuffer;
+
+        std::lock_guard<std::mutex> lock(threadsLock);
+        threads.emplace_back(new ThreadBuffer());
+        threads.back()->name = "thread " + std::to_string(threads.size() - 1);
+        cachedId = id;
+        cachedBuffer = threads.back().get();
+        return cachedBuffer;
+    }
+
+    void record(const char* name, int64_t start, int64_t end)
+    {
+        ThreadBuffer* buffer = threadBuffer();
+        size_t index = buffer->count.load(std::memory_order_relaxed);
+        size_t block = index / BLOCK_SIZE;
+        if (block >= (size_t)MAX_BLOCKS)
+        {
+            buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        Event* events = buffer->blocks[block].load(std::memory_order_relaxed);
+        if (!events)
+        {
+            events = new Event[BLOCK_SIZE];
+            buffer->blocks[block].store(events, std::memory_order_release);
+        }
+        Event& event = events[index % BLOCK_SIZE];
+        event.name = name;
+        event.start = start;
+        event.end = end;
+        buffer->count.store(index + 1, std::memory_order_release);
+    }
+
+    static std::string digits(int64_t value)
+    {
+        std::string text = std::to_string(value);
+        return std::string(3 - text.size(), '0') + text;
+    }
+
+    static std::string escape(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    bool enabled;
+    const unsigned int id;
+    const std::chrono::steady_clock::time_point epoch;
+
+    mutable std::mutex threadsLock;     // guards the list of buffers, not their contents
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+};
+#endif
@@ -0,0 +1,61 @@
+#version 440 core
+
+out vec4 FragColor;
+
+struct Light {
+    vec3 position;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+in vec2 TexCoords;
+
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormalShininess;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseViewProjection;
+uniform bool depthZeroToOne;		// glClipControl(..., GL_ZERO_TO_ONE) is active
+uniform vec3 viewPos;
+uniform Light light;
+
+vec3 decodeNormal(vec2 f)
+{
+    f = f * 2.0 - 1.0;
+    vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+vec3 worldPosition(vec2 uv, float depth)
+{
+    vec4 clip = vec4(uv * 2.0 - 1.0, depthZeroToOne ? depth : depth * 2.0 - 1.0, 1.0);
+    vec4 world = inverseViewProjection * clip;
+    return world.xyz / world.w;
+}
+
+void main()
+{
+    float depth = texture(gDepth, TexCoords).r;
+    vec4 albedoSpecular = texture(gAlbedoSpecular, TexCoords);
+    vec4 normalShininess = texture(gNormalShininess, TexCoords);
+
+    vec3 fragPos = worldPosition(TexCoords, depth);
+    vec3 normal = decodeNormal(normalShininess.xy);
+    vec3 viewDir = normalize(viewPos - fragPos);
+    float shininess = normalShininess.z * 256.0;
+
+    // same Phong model as objectFragmentShader.fs
+    vec3 lightDir = normalize(light.position);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+
+    vec3 ambient = light.ambient * albedoSpecular.rgb;
+    vec3 diffuse = light.diffuse * diff * albedoSpecular.rgb;
+    vec3 specular = light.specular * spec * albedoSpecular.a;
+    FragColor = vec4(ambient + diffuse + specular, 1.0);
+}
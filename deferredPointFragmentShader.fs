@@ -0,0 +1,61 @@
+#version 440 core
+
+out vec4 FragColor;
+
+flat in vec4 LightPositionRadius;
+flat in vec3 LightColor;
+
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormalShininess;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseViewProjection;
+uniform bool depthZeroToOne;
+uniform vec2 screenSize;
+uniform vec3 viewPos;
+
+vec3 decodeNormal(vec2 f)
+{
+    f = f * 2.0 - 1.0;
+    vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+vec3 worldPosition(vec2 uv, float depth)
+{
+    vec4 clip = vec4(uv * 2.0 - 1.0, depthZeroToOne ? depth : depth * 2.0 - 1.0, 1.0);
+    vec4 world = inverseViewProjection * clip;
+    return world.xyz / world.w;
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy / screenSize;
+    vec3 fragPos = worldPosition(uv, texture(gDepth, uv).r);
+
+    vec3 toLight = LightPositionRadius.xyz - fragPos;
+    float dist = length(toLight);
+    float radius = LightPositionRadius.w;
+    if (dist >= radius)
+        discard;
+
+    vec4 albedoSpecular = texture(gAlbedoSpecular, uv);
+    vec4 normalShininess = texture(gNormalShininess, uv);
+    vec3 normal = decodeNormal(normalShininess.xy);
+    vec3 lightDir = toLight / dist;
+    vec3 viewDir = normalize(viewPos - fragPos);
+
+    // inverse square falloff, windowed so it reaches exactly zero at the radius
+    float window = clamp(1.0 - pow(dist / radius, 4.0), 0.0, 1.0);
+    float attenuation = window * window / (dist * dist + 1.0);
+
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), normalShininess.z * 256.0);
+
+    vec3 color = LightColor * attenuation * (diff * albedoSpecular.rgb + spec * albedoSpecular.a);
+    FragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,22 @@
+#version 440 core
+
+// unit sphere (slightly oversized so its flat faces still enclose the real sphere)
+layout (location = 0) in vec3 aPosition;
+// per light (instanced)
+layout (location = 3) in vec4 aLightPositionRadius;
+layout (location = 4) in vec3 aLightColor;
+
+flat out vec4 LightPositionRadius;
+flat out vec3 LightColor;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+	LightPositionRadius = aLightPositionRadius;
+	LightColor = aLightColor;
+
+	vec3 worldPosition = aLightPositionRadius.xyz + aPosition * aLightPositionRadius.w;
+	gl_Position = projection * view * vec4(worldPosition, 1.0);
+}
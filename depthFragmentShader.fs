@@ -0,0 +1,6 @@
+#version 440 core
+
+// depth only, no color is written
+void main()
+{
+}
@@ -0,0 +1,17 @@
+#version 440 core
+
+layout (location = 0) in vec3 aPosition;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// must produce bit-identical depth to objectVertexShader.vs so the shading pass can test GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+	vec3 FragPos = vec3(model * vec4(aPosition, 1.0));
+
+	gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,213 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include "shader.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// A single recorded draw call along with the material state it needs
+struct DrawCommand
+{
+    GLuint vao;
+    GLuint vbo;                 // the vertex buffer behind the vao, for passes that fetch vertices themselves
+    GLint first;
+    GLsizei count;
+    GLuint diffuseMap;
+    GLuint specularMap;
+    float shininess;
+    unsigned int materialId;    // draws with the same textures and shininess share an id
+    unsigned int group;         // which part of the scene it belongs to, see SetGroup
+    glm::vec3 boundsMin;        // world space bounding box
+    glm::vec3 boundsMax;
+};
+
+// Records the draws for static scene content once and replays them every frame.
+// Each frame the caller builds a render queue (indices of the commands to draw, in
+// the order to draw them) and the replay walks it, skipping any bind or uniform that
+// is already current. The list remembers which version of the scene it was recorded
+// from so the caller can tell when it has to be recorded again.
+class DrawList
+{
+public:
+    DrawList() : recordedVersion(0), recorded(false), currentGroup(0), drawCalls(0)
+    {
+    }
+
+    // true if the list was never recorded or the scene changed since it was
+    bool IsStale(unsigned int sceneVersion) const
+    {
+        return !recorded || recordedVersion != sceneVersion;
+    }
+
+    // throws away the old commands and starts recording against the given scene version
+    void Begin(unsigned int sceneVersion)
+    {
+        commands.clear();
+        materials.clear();
+        recordedVersion = sceneVersion;
+        recorded = true;
+        currentGroup = 0;
+    }
+
+    // tags the draws added from here on, so parts of the scene can be told apart later
+    // (e.g. to time them separately)
+    void SetGroup(unsigned int group)
+    {
+        currentGroup = group;
+    }
+
+    // records a draw of count vertices from the vao (backed by vbo) with the given material.
+    // The bounds are the world space box around the geometry, used for culling and sorting.
+    void Add(GLuint vao, GLuint vbo, GLsizei count, const glm::vec3& boundsMin, const glm::vec3& boundsMax, GLuint diffuseMap, GLuint specularMap, float shininess)
+    {
+        DrawCommand command;
+        command.vao = vao;
+        command.vbo = vbo;
+        command.first = 0;
+        command.count = count;
+        command.diffuseMap = diffuseMap;
+        command.specularMap = specularMap;
+        command.shininess = shininess;
+        command.materialId = materialIdFor(diffuseMap, specularMap, shininess);
+        command.group = currentGroup;
+        command.boundsMin = boundsMin;
+        command.boundsMax = boundsMax;
+        commands.push_back(command);
+    }
+
+    // issues the queued draws in queue order. The shader has to be in use and have its
+    // per-frame uniforms set.
+    void Replay(const Shader& shader, const std::vector<unsigned int>& queue) const
+    {
+        // nothing is known about the state before the replay, so the first draw binds everything
+        DrawStats& stats = DrawStats::Get();
+        const GLint shininess = shader.Location("material.shininess");
+        const DrawCommand* previous = nullptr;
+        for (unsigned int index : queue)
+        {
+            const DrawCommand& command = commands[index];
+            if (!previous || previous->diffuseMap != command.diffuseMap)
+            {
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, command.diffuseMap);
+                stats.Add(DrawStats::TEXTURE_BINDS);
+            }
+            if (!previous || previous->specularMap != command.specularMap)
+            {
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, command.specularMap);
+                stats.Add(DrawStats::TEXTURE_BINDS);
+            }
+            if (!previous || previous->shininess != command.shininess)
+                shader.setFloat(shininess, command.shininess);
+            if (!previous || previous->vao != command.vao)
+            {
+                glBindVertexArray(command.vao);
+                stats.Add(DrawStats::VAO_BINDS);
+            }
+
+            glDrawArrays(GL_TRIANGLES, command.first, command.count);
+            stats.Draw(command.count);
+            previous = &command;
+        }
+        drawCalls += queue.size();
+    }
+
+    // issues the queued draws with only their VAO bound, for depth-only passes. If an id
+    // shader is given each draw's command index goes into its drawId uniform first.
+    void ReplayGeometry(const std::vector<unsigned int>& queue, const Shader* idShader = nullptr) const
+    {
+        DrawStats& stats = DrawStats::Get();
+        const GLint drawId = idShader ? idShader->Location("drawId") : -1;
+        GLuint boundVao = 0;
+        for (unsigned int index : queue)
+        {
+            const DrawCommand& command = commands[index];
+            if (command.vao != boundVao)
+            {
+                glBindVertexArray(command.vao);
+                boundVao = command.vao;
+                stats.Add(DrawStats::VAO_BINDS);
+            }
+            if (idShader)
+                idShader->setInt(drawId, (int)index);
+            glDrawArrays(GL_TRIANGLES, command.first, command.count);
+            stats.Draw(command.count);
+        }
+        drawCalls += queue.size();
+    }
+
+    const std::vector<DrawCommand>& Commands() const
+    {
+        return commands;
+    }
+
+    size_t Size() const
+    {
+        return commands.size();
+    }
+
+    // draw calls issued by every replay so far
+    unsigned long long DrawCalls() const
+    {
+        return drawCalls;
+    }
+
+    // A distinct combination of textures and shininess, indexed by DrawCommand::materialId
+    struct Material
+    {
+        GLuint diffuseMap;
+        GLuint specularMap;
+        float shininess;
+    };
+
+    const std::vector<Material>& Materials() const
+    {
+        return materials;
+    }
+
+    // Sort key for drawing opaque geometry roughly front to back while still grouping
+    // draws that share a material. The top bits hold a coarse, log2 spaced distance
+    // bucket, then the material id, then the exact distance. Near draws go first so the
+    // depth test throws away what's behind them before it's shaded, and within a bucket
+    // draws with the same material end up next to each other.
+    static uint64_t SortKey(float viewDistance, unsigned int materialId)
+    {
+        const int depthBuckets = 8;     // [0, 2), [2, 4), [4, 8) ... [128, inf) units
+
+        int bucket = 0;
+        for (float limit = 2.0f; bucket < depthBuckets - 1 && viewDistance >= limit; limit *= 2.0f)
+            ++bucket;
+
+        // a non-negative float's bit pattern sorts the same as its value
+        float distance = viewDistance > 0.0f ? viewDistance : 0.0f;
+        uint32_t distanceBits;
+        memcpy(&distanceBits, &distance, sizeof(distanceBits));
+
+        return ((uint64_t)bucket << 56) | ((uint64_t)(materialId & 0xFFFFFF) << 32) | distanceBits;
+    }
+
+private:
+    unsigned int materialIdFor(GLuint diffuseMap, GLuint specularMap, float shininess)
+    {
+        for (size_t i = 0; i < materials.size(); ++i)
+        {
+            if (materials[i].diffuseMap == diffuseMap && materials[i].specularMap == specularMap && materials[i].shininess == shininess)
+                return (unsigned int)i;
+        }
+        materials.push_back(Material{ diffuseMap, specularMap, shininess });
+        return (unsigned int)materials.size() - 1;
+    }
+
+    std::vector<DrawCommand> commands;
+    std::vector<Material> materials;
+    unsigned int recordedVersion;
+    bool recorded;
+    unsigned int currentGroup;
+    mutable unsigned long long drawCalls;
+};
+#endif
@@ -0,0 +1,202 @@
+#ifndef DRAWSTATS_H
+#define DRAWSTATS_H
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Counts the work each frame hands the driver: draw calls, the vertices and indices
+// they submit, program, VAO and texture binds, uniform uploads and bytes written to
+// buffers. The code issuing the GL calls counts them with Add or Draw, and the counts
+// go to whichever pass is innermost between BeginPass and EndPass ("other" outside of
+// any), so a pass's counts don't include the passes nested in it.
+//
+// Get() is the instance the renderer counts into, so shaders, draw lists and the
+// render targets can count without being handed one. Counting and the frame calls
+// belong on the thread that owns the context; the last frame and the averages are
+// copied under a lock at EndFrame and can be read from any thread.
+class DrawStats
+{
+public:
+    enum Counter
+    {
+        DRAW_CALLS,
+        VERTICES,
+        INDICES,
+        PROGRAM_BINDS,
+        VAO_BINDS,
+        TEXTURE_BINDS,
+        UNIFORM_UPLOADS,
+        BUFFER_BYTES,
+        COUNTER_COUNT
+    };
+
+    struct Counts
+    {
+        uint64_t values[COUNTER_COUNT];
+
+        uint64_t operator[](Counter counter) const { return values[counter]; }
+    };
+
+    // a pass's counts in the last frame and on average per frame since Reset
+    struct PassCounts
+    {
+        std::string name;
+        Counts lastFrame;
+        double average[COUNTER_COUNT];
+    };
+
+    static DrawStats& Get()
+    {
+        static DrawStats stats;
+        return stats;
+    }
+
+    static const char* CounterName(Counter counter)
+    {
+        static const char* const NAMES[COUNTER_COUNT] = {
+            "draw_calls", "vertices", "indices", "program_binds", "vao_binds", "texture_binds", "uniform_uploads", "buffer_bytes"
+        };
+        return NAMES[counter];
+    }
+
+    DrawStats() : frames(0), publishedFrames(0)
+    {
+        passes.push_back(Pass("other"));
+        open.push_back(0);
+    }
+
+    void Add(Counter counter, uint64_t amount = 1)
+    {
+        passes[open.back()].frame.values[counter] += amount;
+    }
+
+    // one draw call of vertexCount vertices, instances times over
+    void Draw(int64_t vertexCount, int64_t instances = 1)
+    {
+        Counts& counts = passes[open.back()].frame;
+        ++counts.values[DRAW_CALLS];
+        counts.values[VERTICES] += (uint64_t)(vertexCount * instances);
+    }
+
+    void DrawIndexed(int64_t indexCount, int64_t instances = 1)
+    {
+        Counts& counts = passes[open.back()].frame;
+        ++counts.values[DRAW_CALLS];
+        counts.values[INDICES] += (uint64_t)(indexCount * instances);
+    }
+
+    // name has to outlive the stats, string literals are the idea
+    void BeginPass(const char* name)
+    {
+        open.push_back(passIndex(name));
+    }
+
+    void EndPass()
+    {
+        if (open.size() > 1)
+            open.pop_back();
+    }
+
+    void BeginFrame()
+    {
+        open.resize(1);
+        for (Pass& pass : passes)
+            pass.frame = Counts();
+    }
+
+    // publishes the frame's counts to the readers
+    void EndFrame()
+    {
+        ++frames;
+        for (Pass& pass : passes)
+            for (int i = 0; i < COUNTER_COUNT; ++i)
+                pass.total.values[i] += pass.frame.values[i];
+
+        std::lock_guard<std::mutex> lock(publishLock);
+        published.resize(passes.size());
+        for (size_t p = 0; p < passes.size(); ++p)
+        {
+            PassCounts& counts = published[p];
+            counts.name = passes[p].name;
+            counts.lastFrame = passes[p].frame;
+            for (int i = 0; i < COUNTER_COUNT; ++i)
+                counts.average[i] = (double)passes[p].total.values[i] / frames;
+        }
+        publishedFrames = frames;
+    }
+
+    // starts the averages over, e.g. once a benchmark's warmup is done
+    void Reset()
+    {
+        frames = 0;
+        for (Pass& pass : passes)
+            pass.total = Counts();
+    }
+
+    // every pass that has counted anything yet, in the order they were first seen
+    std::vector<PassCounts> Passes() const
+    {
+        std::lock_guard<std::mutex> lock(publishLock);
+        return published;
+    }
+
+    // the last frame summed over the passes
+    Counts LastFrame() const
+    {
+        std::lock_guard<std::mutex> lock(publishLock);
+        Counts total = Counts();
+        for (const PassCounts& pass : published)
+            for (int i = 0; i < COUNTER_COUNT; ++i)
+                total.values[i] += pass.lastFrame.values[i];
+        return total;
+    }
+
+    uint64_t Frames() const
+    {
+        std::lock_guard<std::mutex> lock(publishLock);
+        return publishedFrames;
+    }
+
+    // the last frame in one line, for a title bar or a log
+    std::string Summary() const
+    {
+        Counts last = LastFrame();
+        std::ostringstream line;
+        line << last[DRAW_CALLS] << " draws, " << last[VERTICES] + last[INDICES] << " verts, binds " << last[PROGRAM_BINDS]
+            << " prog/" << last[VAO_BINDS] << " vao/" << last[TEXTURE_BINDS] << " tex, " << last[UNIFORM_UPLOADS]
+            << " uniforms, " << std::fixed << std::setprecision(1) << last[BUFFER_BYTES] / 1024.0 << " KiB uploaded";
+        return line.str();
+    }
+
+private:
+    struct Pass
+    {
+        explicit Pass(const char* passName) : name(passName), frame(), total() {}
+        const char* name;
+        Counts frame;
+        Counts total;       // since Reset
+    };
+
+    int passIndex(const char* name)
+    {
+        for (size_t i = 0; i < passes.size(); ++i)
+            if (passes[i].name == name || strcmp(passes[i].name, name) == 0)
+                return (int)i;
+        passes.push_back(Pass(name));
+        return (int)passes.size() - 1;
+    }
+
+    std::vector<Pass> passes;       // "other" first
+    std::vector<int> open;          // passes begun but not ended, "other" at the bottom
+    uint64_t frames;
+
+    mutable std::mutex publishLock; // guards what EndFrame publishes against readers on other threads
+    std::vector<PassCounts> published;
+    uint64_t publishedFrames;
+};
+#endif
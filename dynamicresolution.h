@@ -0,0 +1,134 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+#include <algorithm>
+#include <cmath>
+
+// Picks the resolution scale to render the scene at from measured GPU frame times, so
+// the frame rate holds steady when the GPU can't keep up at full resolution.
+//
+// GPU time is taken to grow with the number of pixels, i.e. with the square of the
+// scale, so an over budget frame asks for scale * sqrt(target / time). Going down
+// happens as soon as the smoothed time is over the target. Going back up only happens
+// once it has stayed under target * (1 - hysteresis) for cooldownFrames measurements in
+// a row, so the scale doesn't flip back and forth around the budget. Each change is at
+// most MAX_STEP and the scale is rounded to multiples of QUANTUM to keep sizes stable.
+class DynamicResolution
+{
+public:
+    DynamicResolution() : targetMs(0.0), minScale(0.5f), maxScale(1.0f), hysteresis(0.1), cooldownFrames(30),
+        scale(1.0f), smoothedMs(0.0), framesUnder(0), measured(false), settleFrames(0)
+    {
+    }
+
+    // targetMs is the GPU time per frame to aim for, 0 turns scaling off (scale stays at 1)
+    void SetTarget(double milliseconds)
+    {
+        targetMs = milliseconds;
+        scale = Enabled() ? clampScale(maxScale) : 1.0f;
+        measured = false;
+        framesUnder = 0;
+    }
+
+    void SetBounds(float lowest, float highest)
+    {
+        minScale = std::max(std::min(lowest, highest), 0.1f);
+        maxScale = std::max(lowest, highest);
+        scale = Enabled() ? clampScale(scale) : 1.0f;
+    }
+
+    // hysteresis is the fraction under the target the GPU time has to drop to before the
+    // scale goes up again, cooldownFrames how many measurements it has to stay there
+    void SetHysteresis(double fraction, int frames)
+    {
+        hysteresis = std::min(std::max(fraction, 0.0), 0.9);
+        cooldownFrames = std::max(frames, 1);
+    }
+
+    // feeds in the GPU time of a finished frame and updates the scale
+    void AddMeasurement(double gpuMs)
+    {
+        if (!Enabled())
+            return;
+
+        // timer results arrive a few frames late, the first ones after a change are still
+        // from frames drawn at the old scale
+        if (settleFrames > 0)
+        {
+            --settleFrames;
+            return;
+        }
+
+        // a little smoothing so one odd frame doesn't move the scale
+        smoothedMs = measured ? smoothedMs * 0.75 + gpuMs * 0.25 : gpuMs;
+        measured = true;
+
+        if (smoothedMs > targetMs)
+        {
+            framesUnder = 0;
+            float wanted = scale * (float)std::sqrt(targetMs / smoothedMs);
+            setScale(std::max(wanted, scale - MAX_STEP), false);
+        }
+        else if (smoothedMs < targetMs * (1.0 - hysteresis))
+        {
+            if (++framesUnder < cooldownFrames)
+                return;
+            framesUnder = 0;
+            // aim for the bottom of the dead band so the new scale doesn't overshoot the target
+            float wanted = scale * (float)std::sqrt(targetMs * (1.0 - hysteresis * 0.5) / smoothedMs);
+            setScale(std::min(wanted, scale + MAX_STEP), true);
+        }
+        else
+        {
+            framesUnder = 0;
+        }
+    }
+
+    bool Enabled() const { return targetMs > 0.0; }
+    float Scale() const { return scale; }
+    float MaxScale() const { return Enabled() ? maxScale : 1.0f; }
+    double SmoothedMs() const { return smoothedMs; }
+
+    // width or height of the region the scene is drawn into, for a full size one
+    int ScaledSize(int size) const
+    {
+        return std::max((int)std::lround(size * scale), 1);
+    }
+
+private:
+    static constexpr float QUANTUM = 1.0f / 32.0f;
+    static constexpr float MAX_STEP = 0.1f;
+    static const int SETTLE_FRAMES = 4;     // at least the depth of the timer query ring
+
+    float clampScale(float value) const
+    {
+        return std::min(std::max(value, minScale), maxScale);
+    }
+
+    // rounds away from the current scale so every change is at least one step
+    void setScale(float value, bool up)
+    {
+        float steps = value / QUANTUM;
+        float rounded = (up ? std::ceil(steps) : std::floor(steps)) * QUANTUM;
+        float previous = scale;
+        scale = clampScale(rounded);
+        if (scale == previous)
+            return;
+        // the smoothed time was measured at the old scale, start over at the new one
+        measured = false;
+        settleFrames = SETTLE_FRAMES;
+    }
+
+    double targetMs;
+    float minScale;
+    float maxScale;
+    double hysteresis;
+    int cooldownFrames;
+
+    float scale;
+    double smoothedMs;
+    int framesUnder;
+    bool measured;
+    int settleFrames;
+};
+#endif
@@ -0,0 +1,174 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include "gpumemory.h"
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+// Reads frames back from the GPU without stalling on them. Capture only queues a copy
+// of the framebuffer into the next pixel buffer object of a ring, with a fence behind
+// it; Poll maps the buffers whose fences have signalled, a few frames later, and hands
+// the pixels to the consumer. As long as the GPU keeps up with a ring's worth of
+// frames nothing ever waits. If the ring is full the oldest copy is waited for instead
+// of overwritten, which Stalls counts (a deeper ring is the fix).
+class FrameCapture
+{
+public:
+    // pixels are RGBA, rows bottom to top the way GL returns them. They're only valid
+    // during the call, frame is the number passed to Capture.
+    typedef std::function<void(const unsigned char* pixels, int width, int height, uint64_t frame)> Consumer;
+
+    FrameCapture() : width(0), height(0), next(0), pending(0), stalls(0)
+    {
+    }
+
+    void Create(int ringSize = 3)
+    {
+        Destroy();
+        slots.resize(ringSize);
+        for (Slot& slot : slots)
+        {
+            glGenBuffers(1, &slot.buffer);
+            slot.fence = 0;
+            slot.frame = 0;
+        }
+        width = 0;
+        height = 0;
+        next = 0;
+        pending = 0;
+    }
+
+    void Destroy()
+    {
+        for (Slot& slot : slots)
+        {
+            if (slot.fence)
+                glDeleteSync(slot.fence);
+            glDeleteBuffers(1, &slot.buffer);
+            GpuMemory::Get().ReleaseBuffer(slot.buffer);
+        }
+        slots.clear();
+        pending = 0;
+    }
+
+    bool IsCreated() const
+    {
+        return !slots.empty();
+    }
+
+    void SetConsumer(Consumer callback)
+    {
+        consumer = callback;
+    }
+
+    // queues a copy of the framebuffer's color (0 is the window's back buffer)
+    void Capture(GLuint framebuffer, int frameWidth, int frameHeight, uint64_t frame)
+    {
+        if (frameWidth != width || frameHeight != height)
+            resize(frameWidth, frameHeight);
+
+        // the oldest copy is still in flight, it has to land before its buffer is reused
+        if (pending == (int)slots.size())
+        {
+            finishOldest(true);
+            ++stalls;
+        }
+
+        Slot& slot = slots[next];
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.frame = frame;
+
+        next = (next + 1) % (int)slots.size();
+        ++pending;
+    }
+
+    // hands every copy the GPU has finished to the consumer, oldest first, without waiting
+    int Poll()
+    {
+        int delivered = 0;
+        while (pending > 0 && finishOldest(false))
+            ++delivered;
+        return delivered;
+    }
+
+    // waits for and delivers everything still in flight
+    void Flush()
+    {
+        while (pending > 0)
+            finishOldest(true);
+    }
+
+    int Stalls() const { return stalls; }
+
+private:
+    struct Slot
+    {
+        GLuint buffer;
+        GLsync fence;
+        uint64_t frame;
+    };
+
+    void resize(int frameWidth, int frameHeight)
+    {
+        // what's in flight was taken at the old size, deliver it first
+        Flush();
+        width = frameWidth;
+        height = frameHeight;
+        for (Slot& slot : slots)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+            GpuMemory::Get().TrackBuffer(slot.buffer, GpuMemory::READBACK_BUFFER, "frame capture", (uint64_t)width * height * 4);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // Maps the oldest copy and passes it on. Without wait it gives up if the GPU isn't done.
+    // If the fence can't be waited on at all the copy's state is unknown, so it's dropped
+    // rather than read; that also returns false, with one less frame pending.
+    bool finishOldest(bool wait)
+    {
+        Slot& slot = slots[(next - pending + (int)slots.size()) % (int)slots.size()];
+        GLuint64 timeout = wait ? GL_TIMEOUT_IGNORED : 0;
+        GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if (status == GL_TIMEOUT_EXPIRED)
+            return false;
+
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        --pending;
+        if (status == GL_WAIT_FAILED)
+        {
+            std::cout << "WARNING: Waiting on the readback of frame " << slot.frame << " failed, dropping it" << std::endl;
+            return false;
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)width * height * 4, GL_MAP_READ_BIT);
+        if (pixels)
+        {
+            if (consumer)
+                consumer((const unsigned char*)pixels, width, height, slot.frame);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return true;
+    }
+
+    std::vector<Slot> slots;
+    Consumer consumer;
+    int width;
+    int height;
+    int next;
+    int pending;
+    int stalls;
+};
+#endif
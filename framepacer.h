@@ -0,0 +1,141 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+// Keeps frames evenly spaced. It can cap the frame rate with a sleep-then-spin wait
+// (the OS sleep alone is too coarse to hit a deadline), smooths the frame delta that
+// drives camera movement so single slow frames don't make it jerk, and periodically
+// logs how much the frame times vary so pacing can be checked.
+class FramePacer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    FramePacer() : targetFrameTime(0.0), logInterval(0.0), historyCount(0), historyNext(0),
+        statsFrames(0), statsSum(0.0), statsSumSquares(0.0), statsMin(0.0), statsMax(0.0)
+    {
+        nextDeadline = Clock::now();
+        statsStart = nextDeadline;
+    }
+
+    // caps the frame rate. 0 turns the limiter off.
+    void SetTargetFrameRate(double framesPerSecond)
+    {
+        targetFrameTime = framesPerSecond > 0.0 ? 1.0 / framesPerSecond : 0.0;
+        nextDeadline = Clock::now();
+    }
+
+    // log frame time statistics every seconds seconds. 0 turns logging off.
+    void SetLogInterval(double seconds)
+    {
+        logInterval = seconds;
+    }
+
+    // Waits until the next frame is due. Sleeps while there's comfortably more than the
+    // sleep granularity left, then spins for the rest.
+    void WaitForNextFrame()
+    {
+        if (targetFrameTime <= 0.0)
+            return;
+
+        const Clock::duration spinThreshold = std::chrono::milliseconds(2);
+        Clock::time_point now = Clock::now();
+        while (nextDeadline - now > spinThreshold)
+        {
+            std::this_thread::sleep_for(nextDeadline - now - spinThreshold);
+            now = Clock::now();
+        }
+        while (now < nextDeadline)
+        {
+            std::this_thread::yield();
+            now = Clock::now();
+        }
+
+        // Schedule against the deadline rather than now so the error doesn't pile up.
+        // If we fell more than a frame behind, don't try to catch up with a burst of frames.
+        nextDeadline += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(targetFrameTime));
+        if (nextDeadline < now)
+            nextDeadline = now;
+    }
+
+    // Takes the measured frame delta and returns the one to move things by: the average
+    // of the last few deltas, with each one clamped so a hitch can't teleport the camera.
+    float SmoothDelta(double rawDelta)
+    {
+        const double maxDelta = 0.1;
+        history[historyNext] = std::min(std::max(rawDelta, 0.0), maxDelta);
+        historyNext = (historyNext + 1) % HISTORY_SIZE;
+        if (historyCount < HISTORY_SIZE)
+            ++historyCount;
+
+        double sum = 0.0;
+        for (int i = 0; i < historyCount; ++i)
+            sum += history[i];
+        return (float)(sum / historyCount);
+    }
+
+    // forget the delta history, e.g. after the loop slept waiting for input
+    void Reset()
+    {
+        historyCount = 0;
+        historyNext = 0;
+        nextDeadline = Clock::now();
+    }
+
+    // adds a measured frame time to the statistics and logs them once the interval is up
+    void RecordFrameTime(double seconds)
+    {
+        if (logInterval <= 0.0)
+            return;
+
+        if (statsFrames == 0)
+        {
+            statsMin = seconds;
+            statsMax = seconds;
+        }
+        ++statsFrames;
+        statsSum += seconds;
+        statsSumSquares += seconds * seconds;
+        statsMin = std::min(statsMin, seconds);
+        statsMax = std::max(statsMax, seconds);
+
+        Clock::time_point now = Clock::now();
+        if (std::chrono::duration<double>(now - statsStart).count() < logInterval)
+            return;
+
+        double mean = statsSum / statsFrames;
+        double variance = std::max(statsSumSquares / statsFrames - mean * mean, 0.0);
+        std::cout << "INFO: Frame time over " << statsFrames << " frames: mean " << mean * 1000.0
+            << " ms, std dev " << std::sqrt(variance) * 1000.0 << " ms, min " << statsMin * 1000.0
+            << " ms, max " << statsMax * 1000.0 << " ms" << std::endl;
+
+        statsFrames = 0;
+        statsSum = 0.0;
+        statsSumSquares = 0.0;
+        statsStart = now;
+    }
+
+private:
+    static const int HISTORY_SIZE = 8;
+
+    double targetFrameTime;
+    double logInterval;
+    Clock::time_point nextDeadline;
+
+    double history[HISTORY_SIZE];
+    int historyCount;
+    int historyNext;
+
+    Clock::time_point statsStart;
+    long statsFrames;
+    double statsSum;
+    double statsSumSquares;
+    double statsMin;
+    double statsMax;
+};
+#endif
@@ -0,0 +1,127 @@
+#ifndef FRAMESTATE_H
+#define FRAMESTATE_H
+
+#include <vector>
+
+// Version counters for everything the per frame matrices and uniforms are computed
+// from. Whatever changes one of the inputs calls Touch on it; anything derived from an
+// input only has to be redone when its version is different from last time.
+class FrameState
+{
+public:
+    enum Input
+    {
+        CAMERA,         // position and orientation: view matrix, viewPos
+        PROJECTION,     // field of view, orthographic or perspective
+        VIEWPORT,       // framebuffer size
+        LIGHTS,         // the directional light
+        INPUT_COUNT
+    };
+
+    FrameState()
+    {
+        // starting at 1 leaves 0 for "never computed"
+        for (int i = 0; i < INPUT_COUNT; ++i)
+            versions[i] = 1;
+    }
+
+    void Touch(Input input)
+    {
+        ++versions[input];
+    }
+
+    unsigned int Version(Input input) const
+    {
+        return versions[input];
+    }
+
+    static unsigned int Bit(Input input)
+    {
+        return 1u << input;
+    }
+
+private:
+    unsigned int versions[INPUT_COUNT];
+};
+
+// Remembers which input versions each group of uniforms on each program was last
+// uploaded for. A program keeps its uniform values from frame to frame, so a group only
+// has to be uploaded again once one of the inputs it's computed from has moved on.
+// Anything that sets the same uniforms behind the cache's back has to Invalidate the
+// program.
+class UniformCache
+{
+public:
+    enum Group
+    {
+        PROJECTION_MATRIX,
+        VIEW_MATRIX,            // with viewPos
+        VIEW_PROJECTION,        // anything computed from both
+        MODEL_MATRIX,
+        LIGHT,
+        SCREEN,
+        CONSTANTS,              // settings fixed at startup
+        GROUP_COUNT
+    };
+
+    UniformCache() : uploads(0), skipped(0)
+    {
+    }
+
+    // True if the group has to be uploaded to the program for this state, in which case
+    // it's taken to be uploaded. inputs is the FrameState::Bit of each input the group
+    // depends on, 0 for a group that never changes.
+    bool NeedsUpload(unsigned int program, Group group, const FrameState& state, unsigned int inputs)
+    {
+        size_t index = (size_t)program * GROUP_COUNT + group;
+        if (index >= entries.size())
+            entries.resize(index + 1);
+        Entry& entry = entries[index];
+
+        bool current = entry.valid;
+        for (int i = 0; i < FrameState::INPUT_COUNT && current; ++i)
+        {
+            FrameState::Input input = (FrameState::Input)i;
+            if ((inputs & FrameState::Bit(input)) && entry.versions[i] != state.Version(input))
+                current = false;
+        }
+        if (current)
+        {
+            ++skipped;
+            return false;
+        }
+
+        entry.valid = true;
+        for (int i = 0; i < FrameState::INPUT_COUNT; ++i)
+            entry.versions[i] = state.Version((FrameState::Input)i);
+        ++uploads;
+        return true;
+    }
+
+    // forget what the program has, for when something else changed its uniforms
+    void Invalidate(unsigned int program)
+    {
+        for (int group = 0; group < GROUP_COUNT; ++group)
+        {
+            size_t index = (size_t)program * GROUP_COUNT + group;
+            if (index < entries.size())
+                entries[index].valid = false;
+        }
+    }
+
+    unsigned long long Uploads() const { return uploads; }
+    unsigned long long Skipped() const { return skipped; }
+
+private:
+    struct Entry
+    {
+        Entry() : valid(false) {}
+        bool valid;
+        unsigned int versions[FrameState::INPUT_COUNT];
+    };
+
+    std::vector<Entry> entries;
+    unsigned long long uploads;
+    unsigned long long skipped;
+};
+#endif
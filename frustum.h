@@ -0,0 +1,49 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// The six clip planes of a view-projection matrix, used to throw away
+// objects that can't be on screen before they're ever drawn.
+class Frustum
+{
+public:
+    // Pulls the planes straight out of the combined matrix (Gribb & Hartmann).
+    // Works for both perspective and orthographic projections. Set zeroToOneDepth when
+    // the projection maps depth to [0, 1] (glClipControl), reversed or not.
+    explicit Frustum(const glm::mat4& viewProjection, bool zeroToOneDepth = false)
+    {
+        // glm is column major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+        glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+        glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+        glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+        planes[0] = row3 + row0;    // left
+        planes[1] = row3 - row0;    // right
+        planes[2] = row3 + row1;    // bottom
+        planes[3] = row3 - row1;    // top
+        planes[4] = zeroToOneDepth ? row2 : row3 + row2;    // near (far with reverse-Z)
+        planes[5] = row3 - row2;                            // far (near with reverse-Z)
+    }
+
+    // true if any part of the axis aligned box might be inside the frustum
+    bool IntersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+    {
+        for (int i = 0; i < 6; ++i)
+        {
+            const glm::vec4& plane = planes[i];
+            // the corner of the box furthest along the plane normal
+            glm::vec3 positive(plane.x >= 0.0f ? boxMax.x : boxMin.x,
+                               plane.y >= 0.0f ? boxMax.y : boxMin.y,
+                               plane.z >= 0.0f ? boxMax.z : boxMin.z);
+            if (plane.x * positive.x + plane.y * positive.y + plane.z * positive.z + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    glm::vec4 planes[6];
+};
+#endif
@@ -0,0 +1,15 @@
+#version 440 core
+
+out vec2 TexCoords;
+
+// clip space depth to put the triangle at, so the depth test can pick the pixels a pass
+// runs on (only where geometry is, only one material's pixels, ...)
+uniform float clipDepth;
+
+// one triangle that covers the whole screen, no vertex buffer needed
+void main()
+{
+	vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	TexCoords = position;
+	gl_Position = vec4(position * 2.0 - 1.0, clipDepth, 1.0);
+}
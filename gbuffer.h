@@ -0,0 +1,151 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include "drawstats.h"
+#include "gpumemory.h"
+
+#include <iostream>
+
+// Render targets for deferred shading. The geometry pass writes surface attributes
+// into a compact G-buffer, 8 bytes of color per pixel plus depth:
+//   albedo     RGBA8     albedo.rgb, specular intensity in alpha
+//   normal     RGB10_A2  octahedral encoded normal in rg, shininess / 256 in b
+//   depth      DEPTH32F  world position is rebuilt from it, so it isn't stored
+// The lighting passes then add each light's contribution into a half float
+// accumulation target that shares the G-buffer's depth, so light volumes can be
+// depth tested against the scene and forward drawn objects still sort correctly.
+// Sampling a texture that's attached to the framebuffer being drawn to is undefined
+// even with depth writes off, so the lighting shaders read a copy of the depth made
+// when the lighting target is bound.
+class GBuffer
+{
+public:
+    GBuffer() : geometryFbo(0), lightingFbo(0), albedoTexture(0), normalTexture(0),
+        depthTexture(0), depthCopyTexture(0), lightingTexture(0), width(0), height(0)
+    {
+    }
+
+    // makes sure the attachments are the given size, recreating them if they aren't
+    void Resize(int newWidth, int newHeight)
+    {
+        if (geometryFbo != 0 && newWidth == width && newHeight == height)
+            return;
+
+        Destroy();
+        width = newWidth;
+        height = newHeight;
+
+        albedoTexture = createTexture(GL_RGBA8);
+        normalTexture = createTexture(GL_RGB10_A2);
+        depthTexture = createTexture(GL_DEPTH_COMPONENT32F);
+        depthCopyTexture = createTexture(GL_DEPTH_COMPONENT32F);
+        lightingTexture = createTexture(GL_RGBA16F);
+
+        glGenFramebuffers(1, &geometryFbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, geometryFbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: G-buffer is not complete" << std::endl;
+
+        glGenFramebuffers(1, &lightingFbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, lightingFbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lightingTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: Lighting target is not complete" << std::endl;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // target for the geometry pass
+    void BindGeometry() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, geometryFbo);
+    }
+
+    // target for the lighting passes, once the geometry pass is done. Copies the depth for
+    // BindTextures first: the depth attached here is tested against and written by the
+    // forward drawn objects, so it can't be sampled at the same time.
+    void BindLighting() const
+    {
+        glCopyImageSubData(depthTexture, GL_TEXTURE_2D, 0, 0, 0, 0, depthCopyTexture, GL_TEXTURE_2D, 0, 0, 0, 0, width, height, 1);
+        glBindFramebuffer(GL_FRAMEBUFFER, lightingFbo);
+    }
+
+    // binds albedo, normal and the copy of the depth to three texture units starting at firstUnit
+    void BindTextures(GLuint firstUnit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit);
+        glBindTexture(GL_TEXTURE_2D, albedoTexture);
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+        glBindTexture(GL_TEXTURE_2D, normalTexture);
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
+        glBindTexture(GL_TEXTURE_2D, depthCopyTexture);
+        glActiveTexture(GL_TEXTURE0);
+        DrawStats::Get().Add(DrawStats::TEXTURE_BINDS, 3);
+    }
+
+    // copies the lit image into the window, or into destination if it isn't 0, and leaves that bound
+    void BlitToDefault(int windowWidth, int windowHeight, GLuint destination = 0) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, lightingFbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, destination);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, destination);
+    }
+
+    void Destroy()
+    {
+        if (geometryFbo == 0)
+            return;
+        glDeleteFramebuffers(1, &geometryFbo);
+        glDeleteFramebuffers(1, &lightingFbo);
+        GLuint textures[] = { albedoTexture, normalTexture, depthTexture, depthCopyTexture, lightingTexture };
+        glDeleteTextures(5, textures);
+        for (GLuint texture : textures)
+            GpuMemory::Get().ReleaseTexture(texture);
+        geometryFbo = 0;
+        lightingFbo = 0;
+        albedoTexture = 0;
+        normalTexture = 0;
+        depthTexture = 0;
+        depthCopyTexture = 0;
+        lightingTexture = 0;
+    }
+
+    GLuint DepthTexture() const { return depthTexture; }
+    GLuint LightingTexture() const { return lightingTexture; }
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+private:
+    GLuint createTexture(GLenum format) const
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+        GpuMemory::Get().TrackTexture(texture, GpuMemory::RENDER_TARGET, "g-buffer", format, width, height);
+        // the lighting passes read one texel per pixel, no filtering wanted
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    GLuint geometryFbo;
+    GLuint lightingFbo;
+    GLuint albedoTexture;
+    GLuint normalTexture;
+    GLuint depthTexture;
+    GLuint depthCopyTexture;    // what the lighting passes sample
+    GLuint lightingTexture;
+    int width;
+    int height;
+};
+#endif
@@ -0,0 +1,40 @@
+#version 440 core
+
+// G-buffer layout
+//   0: RGBA8     albedo.rgb, specular intensity
+//   1: RGB10_A2  octahedral normal.xy, shininess / 256
+// position isn't stored, the lighting passes rebuild it from the depth buffer
+layout (location = 0) out vec4 gAlbedoSpecular;
+layout (location = 1) out vec4 gNormalShininess;
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+
+in vec3 Normal;
+in vec2 TexCoords;
+
+uniform Material material;
+
+// octahedral encoding: folds the unit sphere onto a square so two channels hold a normal
+vec2 octWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 encodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    n.xy = n.z >= 0.0 ? n.xy : octWrap(n.xy);
+    return n.xy * 0.5 + 0.5;
+}
+
+void main()
+{
+    vec3 specular = texture(material.specular, TexCoords).rgb;
+
+    gAlbedoSpecular = vec4(texture(material.diffuse, TexCoords).rgb, dot(specular, vec3(0.2126, 0.7152, 0.0722)));
+    gNormalShininess = vec4(encodeNormal(normalize(Normal)), material.shininess / 256.0, 0.0);
+}
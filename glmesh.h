@@ -0,0 +1,70 @@
+#ifndef GLMESH_H
+#define GLMESH_H
+
+#include "gpumemory.h"
+
+#include <glm/glm.hpp>
+
+// A mesh's vertex array and buffer. Vertices are position, normal and texture
+// coordinates, interleaved, as attributes 0, 1 and 2.
+struct GLMesh {
+    GLuint vao;
+    GLuint vbo;
+    GLuint nVertices;
+    glm::vec3 boundsMin;    // object space bounding box, used for culling
+    glm::vec3 boundsMax;
+};
+
+// Uploads interleaved position/normal/uv vertex data into a new VAO/VBO and
+// works out the mesh's bounding box while the data is still on the CPU.
+inline void UCreateMeshBuffers(GLMesh& mesh, const GLfloat* verts, GLsizeiptr size)
+{
+    const GLuint floatsPerVertex = 3;
+    const GLuint floatsPerNormal = 3;
+    const GLuint floatsPerUV = 2;
+    const GLuint floatsPerEntry = floatsPerVertex + floatsPerNormal + floatsPerUV;
+
+    mesh.nVertices = size / (sizeof(verts[0]) * floatsPerEntry);
+
+    // Bounding box of the positions
+    mesh.boundsMin = glm::vec3(verts[0], verts[1], verts[2]);
+    mesh.boundsMax = mesh.boundsMin;
+    for (GLuint i = 1; i < mesh.nVertices; ++i)
+    {
+        glm::vec3 position(verts[i * floatsPerEntry], verts[i * floatsPerEntry + 1], verts[i * floatsPerEntry + 2]);
+        mesh.boundsMin = glm::min(mesh.boundsMin, position);
+        mesh.boundsMax = glm::max(mesh.boundsMax, position);
+    }
+
+    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
+    glBindVertexArray(mesh.vao);
+
+    // Create VBO
+    glGenBuffers(1, &mesh.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
+    glBufferData(GL_ARRAY_BUFFER, size, verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    GpuMemory::Get().TrackBuffer(mesh.vbo, GpuMemory::VERTEX_BUFFER, "mesh", size);
+
+    // Strides between vertex coordinates
+    GLint stride = sizeof(float) * floatsPerEntry;
+
+    // Create Vertex Attribute Pointers
+    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
+    glEnableVertexAttribArray(1);
+
+    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
+    glEnableVertexAttribArray(2);
+}
+
+inline void UDestroyMesh(GLMesh& mesh)
+{
+    glDeleteVertexArrays(1, &mesh.vao);
+    glDeleteBuffers(1, &mesh.vbo);
+    GpuMemory::Get().ReleaseBuffer(mesh.vbo);
+    mesh.vao = 0;
+    mesh.vbo = 0;
+}
+#endif
@@ -0,0 +1,257 @@
+#ifndef GPUMEMORY_H
+#define GPUMEMORY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Accounts for the GPU memory behind every texture and buffer: whoever allocates one
+// tracks it with its size, format, mip count and owner, and releases it again when it
+// deletes it, so the totals by category say what the scene costs in VRAM and whatever
+// is still tracked at shutdown has leaked.
+//
+// Sizes are what the allocation asks for. Drivers round up, pad RGB to RGBA and add
+// compression metadata, so the real footprint is somewhat larger.
+//
+// Get() is the instance everything tracks into. Tracking happens on the thread that
+// owns the context, but it's locked so the totals can be read from anywhere.
+class GpuMemory
+{
+public:
+    enum Category
+    {
+        TEXTURE,            // loaded from files or baked
+        RENDER_TARGET,      // attachments, resized with the window
+        SHADOW_MAP,
+        VERTEX_BUFFER,
+        STORAGE_BUFFER,
+        READBACK_BUFFER,
+        CATEGORY_COUNT
+    };
+
+    struct Allocation
+    {
+        bool texture;           // texture and buffer names are separate, this says which
+        GLuint name;
+        Category category;
+        const char* owner;
+        GLenum format;          // internal format, 0 for buffers
+        int width;              // of the top mip, 0 for buffers
+        int height;
+        int layers;
+        int mips;
+        uint64_t bytes;
+    };
+
+    static GpuMemory& Get()
+    {
+        static GpuMemory memory;
+        return memory;
+    }
+
+    static const char* CategoryName(Category category)
+    {
+        static const char* const NAMES[CATEGORY_COUNT] = {
+            "textures", "render targets", "shadow maps", "vertex buffers", "storage buffers", "readback buffers"
+        };
+        return NAMES[category];
+    }
+
+    GpuMemory() : peak(0)
+    {
+        for (int i = 0; i < CATEGORY_COUNT; ++i)
+            totals[i] = 0;
+    }
+
+    // A texture's storage, every layer and mip included (mips 0 is the full chain).
+    // owner has to outlive the tracking, string literals are the idea.
+    void TrackTexture(GLuint name, Category category, const char* owner, GLenum format, int width, int height, int layers = 1, int mips = 1)
+    {
+        if (mips <= 0)
+            mips = MipCount(width, height);
+
+        uint64_t bytes = 0;
+        for (int level = 0; level < mips; ++level)
+            bytes += (uint64_t)std::max(width >> level, 1) * std::max(height >> level, 1);
+        bytes *= (uint64_t)layers * BytesPerTexel(format);
+
+        Allocation allocation = { true, name, category, owner, format, width, height, layers, mips, bytes };
+        track(allocation);
+    }
+
+    // A buffer's data store. Tracking the same buffer again (glBufferData on it again)
+    // replaces its size.
+    void TrackBuffer(GLuint name, Category category, const char* owner, uint64_t bytes)
+    {
+        Allocation allocation = { false, name, category, owner, 0, 0, 0, 1, 1, bytes };
+        track(allocation);
+    }
+
+    void ReleaseTexture(GLuint name)
+    {
+        release(true, name);
+    }
+
+    void ReleaseBuffer(GLuint name)
+    {
+        release(false, name);
+    }
+
+    uint64_t Bytes(Category category) const
+    {
+        std::lock_guard<std::mutex> lock(allocationsLock);
+        return totals[category];
+    }
+
+    uint64_t TotalBytes() const
+    {
+        std::lock_guard<std::mutex> lock(allocationsLock);
+        uint64_t total = 0;
+        for (int i = 0; i < CATEGORY_COUNT; ++i)
+            total += totals[i];
+        return total;
+    }
+
+    // the most that was ever tracked at once
+    uint64_t PeakBytes() const
+    {
+        std::lock_guard<std::mutex> lock(allocationsLock);
+        return peak;
+    }
+
+    // every live allocation, largest first
+    std::vector<Allocation> Allocations() const
+    {
+        std::lock_guard<std::mutex> lock(allocationsLock);
+        std::vector<Allocation> list;
+        for (const std::pair<const Key, Allocation>& entry : allocations)
+            list.push_back(entry.second);
+        std::sort(list.begin(), list.end(), [](const Allocation& a, const Allocation& b) { return a.bytes > b.bytes; });
+        return list;
+    }
+
+    // the totals by category, then every allocation when detailed is set
+    void Report(std::ostream& out, bool detailed) const
+    {
+        const std::vector<Allocation> list = Allocations();
+        out << "INFO: GPU memory " << megabytes(TotalBytes()) << " MiB in " << list.size() << " allocations (peak "
+            << megabytes(PeakBytes()) << " MiB)" << std::endl;
+        for (int i = 0; i < CATEGORY_COUNT; ++i)
+        {
+            int count = 0;
+            for (const Allocation& allocation : list)
+                count += allocation.category == i ? 1 : 0;
+            if (count > 0)
+                out << "INFO:   " << std::left << std::setw(18) << CategoryName((Category)i) << std::right << std::setw(10)
+                    << megabytes(Bytes((Category)i)) << " MiB in " << count << std::endl;
+        }
+        if (detailed)
+            for (const Allocation& allocation : list)
+                out << "INFO:     " << describe(allocation) << std::endl;
+    }
+
+    // Logs whatever is still tracked, for after everything should have been released.
+    // Returns how many allocations leaked.
+    size_t ReportLeaks(std::ostream& out) const
+    {
+        const std::vector<Allocation> list = Allocations();
+        for (const Allocation& allocation : list)
+            out << "WARNING: GPU memory leak: " << describe(allocation) << std::endl;
+        if (!list.empty())
+            out << "WARNING: " << list.size() << " GPU allocations (" << megabytes(TotalBytes()) << " MiB) were never released" << std::endl;
+        return list.size();
+    }
+
+    static int MipCount(int width, int height)
+    {
+        int mips = 1;
+        for (int size = std::max(width, height); size > 1; size >>= 1)
+            ++mips;
+        return mips;
+    }
+
+    // the formats the program uses; anything else is counted as 4 bytes
+    static int BytesPerTexel(GLenum format)
+    {
+        switch (format)
+        {
+        case GL_RED: case GL_R8:
+            return 1;
+        case GL_RG: case GL_RG8: case GL_R16F:
+            return 2;
+        case GL_RGB: case GL_RGB8: case GL_SRGB8:
+            return 3;
+        case GL_RGBA16F: case GL_RG32UI: case GL_RG32F: case GL_DEPTH32F_STENCIL8:
+            return 8;
+        case GL_RGBA32F: case GL_RGBA32UI:
+            return 16;
+        default:        // RGBA8, RGB10_A2, R11F_G11F_B10F, R32F, the 24 and 32 bit depth formats
+            return 4;
+        }
+    }
+
+private:
+    typedef std::pair<bool, GLuint> Key;
+
+    void track(const Allocation& allocation)
+    {
+        std::lock_guard<std::mutex> lock(allocationsLock);
+        Key key(allocation.texture, allocation.name);
+        std::map<Key, Allocation>::iterator existing = allocations.find(key);
+        if (existing != allocations.end())
+            totals[existing->second.category] -= existing->second.bytes;
+        allocations[key] = allocation;
+        totals[allocation.category] += allocation.bytes;
+
+        uint64_t total = 0;
+        for (int i = 0; i < CATEGORY_COUNT; ++i)
+            total += totals[i];
+        peak = std::max(peak, total);
+    }
+
+    void release(bool texture, GLuint name)
+    {
+        std::lock_guard<std::mutex> lock(allocationsLock);
+        std::map<Key, Allocation>::iterator existing = allocations.find(Key(texture, name));
+        if (existing == allocations.end())
+            return;
+        totals[existing->second.category] -= existing->second.bytes;
+        allocations.erase(existing);
+    }
+
+    static std::string megabytes(uint64_t bytes)
+    {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(2) << bytes / (1024.0 * 1024.0);
+        return text.str();
+    }
+
+    static std::string describe(const Allocation& allocation)
+    {
+        std::ostringstream text;
+        text << allocation.owner << " (" << CategoryName(allocation.category) << ", " << (allocation.texture ? "texture " : "buffer ")
+            << allocation.name << "): ";
+        if (allocation.texture)
+        {
+            text << allocation.width << "x" << allocation.height;
+            if (allocation.layers > 1)
+                text << "x" << allocation.layers;
+            text << " format 0x" << std::hex << allocation.format << std::dec << ", " << allocation.mips << (allocation.mips == 1 ? " mip, " : " mips, ");
+        }
+        text << allocation.bytes << " bytes";
+        return text.str();
+    }
+
+    mutable std::mutex allocationsLock;
+    std::map<Key, Allocation> allocations;
+    uint64_t totals[CATEGORY_COUNT];
+    uint64_t peak;
+};
+#endif
@@ -0,0 +1,392 @@
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Measures how long named passes take on the GPU. Begin/End put a timestamp query on
+// either side of a pass (timestamps rather than GL_TIME_ELAPSED so passes can nest and
+// don't clash with other timers), and top level passes also get pipeline statistics
+// queries: primitives submitted, vertex and fragment shader invocations.
+//
+// Queries are read back `latency` frames later, from a ring of per frame query sets, so
+// reading them never waits on the GPU unless it's more than that many frames behind
+// (counted in Stalls). Each pass keeps its last `window` results for the rolling
+// average and percentiles, and every result can be appended to a CSV file as well.
+//
+// Begin, End and the frame calls belong on the thread that owns the context, the
+// statistics can be read from any thread.
+class GpuProfiler
+{
+public:
+    struct Stats
+    {
+        int samples;
+        double averageMs;
+        double p50Ms;
+        double p95Ms;
+        double p99Ms;
+        double maxMs;
+        // averages per frame, 0 without pipeline statistics
+        double primitives;
+        double vertexInvocations;
+        double fragmentInvocations;
+    };
+
+    GpuProfiler() : created(false), statistics(false), window(120), frameNumber(0), current(0), stalls(0)
+    {
+    }
+
+    // statistics turns the pipeline statistics queries on (needs ARB_pipeline_statistics_query)
+    void Create(bool pipelineStatistics, int latency = 3, int windowSize = 120)
+    {
+        Destroy();
+        statistics = pipelineStatistics;
+        window = std::max(windowSize, 1);
+        frames.resize(std::max(latency, 1) + 1);
+        current = 0;
+        created = true;
+    }
+
+    void Destroy()
+    {
+        for (FrameSlot& slot : frames)
+        {
+            if (!slot.timestamps.empty())
+                glDeleteQueries((GLsizei)slot.timestamps.size(), slot.timestamps.data());
+            if (!slot.statistics.empty())
+                glDeleteQueries((GLsizei)slot.statistics.size(), slot.statistics.data());
+        }
+        frames.clear();
+        created = false;
+    }
+
+    bool IsCreated() const
+    {
+        return created;
+    }
+
+    // appends every result to path: frame, pass, GPU ms and the statistics
+    bool OpenCsv(const char* path)
+    {
+        csv.open(path);
+        if (!csv)
+            return false;
+        csv << "frame,pass,gpu_ms,primitives,vertex_invocations,fragment_invocations\n";
+        return true;
+    }
+
+    void BeginFrame()
+    {
+        if (!created)
+            return;
+
+        // the slot about to be reused still holds the oldest frame, which has to be read first
+        FrameSlot& slot = frames[current];
+        if (slot.pending)
+        {
+            collect(slot, true);
+            ++stalls;
+        }
+        slot.records.clear();
+        slot.timestampsUsed = 0;
+        slot.statisticsUsed = 0;
+        slot.frame = frameNumber;
+        open.clear();
+    }
+
+    void EndFrame()
+    {
+        if (!created)
+            return;
+
+        frames[current].pending = !frames[current].records.empty();
+        current = (current + 1) % frames.size();
+        ++frameNumber;
+
+        // read whatever older frames the GPU has finished, oldest first
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            FrameSlot& slot = frames[(current + i) % frames.size()];
+            if (slot.pending && !collect(slot, false))
+                break;
+        }
+    }
+
+    // name has to outlive the profiler, string literals are the idea
+    void Begin(const char* name)
+    {
+        if (!created)
+            return;
+
+        FrameSlot& slot = frames[current];
+        Record record;
+        record.scope = scopeIndex(name);
+        record.begin = acquire(slot.timestamps, slot.timestampsUsed);
+        record.end = 0;
+        record.hasStatistics = statistics && open.empty();
+        glQueryCounter(record.begin, GL_TIMESTAMP);
+        if (record.hasStatistics)
+        {
+            for (int i = 0; i < STATISTIC_COUNT; ++i)
+            {
+                record.statistics[i] = acquire(slot.statistics, slot.statisticsUsed);
+                glBeginQuery(statisticTarget(i), record.statistics[i]);
+            }
+        }
+        open.push_back(slot.records.size());
+        slot.records.push_back(record);
+    }
+
+    void End()
+    {
+        if (!created || open.empty())
+            return;
+
+        FrameSlot& slot = frames[current];
+        Record& record = slot.records[open.back()];
+        open.pop_back();
+        if (record.hasStatistics)
+        {
+            for (int i = 0; i < STATISTIC_COUNT; ++i)
+                glEndQuery(statisticTarget(i));
+        }
+        record.end = acquire(slot.timestamps, slot.timestampsUsed);
+        glQueryCounter(record.end, GL_TIMESTAMP);
+    }
+
+    std::vector<std::string> Names() const
+    {
+        std::lock_guard<std::mutex> lock(statsLock);
+        std::vector<std::string> names;
+        for (const Scope& scope : scopes)
+            names.push_back(scope.name);
+        return names;
+    }
+
+    bool GetStats(const std::string& name, Stats& stats) const
+    {
+        std::lock_guard<std::mutex> lock(statsLock);
+        for (const Scope& scope : scopes)
+        {
+            if (name == scope.name)
+            {
+                stats = computeStats(scope);
+                return scope.count > 0;
+            }
+        }
+        return false;
+    }
+
+    // the pass's results still in the window, oldest first
+    bool GetSamples(const std::string& name, std::vector<double>& milliseconds) const
+    {
+        std::lock_guard<std::mutex> lock(statsLock);
+        milliseconds.clear();
+        for (const Scope& scope : scopes)
+        {
+            if (name != scope.name)
+                continue;
+            size_t oldest = scope.count < (size_t)window ? 0 : scope.next;
+            for (size_t i = 0; i < scope.count; ++i)
+                milliseconds.push_back(scope.milliseconds[(oldest + i) % window]);
+            return scope.count > 0;
+        }
+        return false;
+    }
+
+    // reads every frame still in flight, waiting for the GPU if it has to
+    void Flush()
+    {
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            FrameSlot& slot = frames[(current + i) % frames.size()];
+            if (slot.pending)
+                collect(slot, true);
+        }
+    }
+
+    // one line with every pass's average and 95th percentile, for a title bar or a log
+    std::string Summary() const
+    {
+        std::lock_guard<std::mutex> lock(statsLock);
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(2);
+        for (const Scope& scope : scopes)
+        {
+            if (scope.count == 0)
+                continue;
+            Stats stats = computeStats(scope);
+            if (line.tellp() > 0)
+                line << " | ";
+            line << scope.name << " " << stats.averageMs << " ms (p95 " << stats.p95Ms << ")";
+        }
+        return line.str();
+    }
+
+    int Stalls() const { return stalls; }
+
+private:
+    static const int STATISTIC_COUNT = 3;
+
+    static GLenum statisticTarget(int index)
+    {
+        static const GLenum TARGETS[STATISTIC_COUNT] = {
+            GL_PRIMITIVES_SUBMITTED_ARB, GL_VERTEX_SHADER_INVOCATIONS_ARB, GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+        };
+        return TARGETS[index];
+    }
+
+    struct Record
+    {
+        int scope;
+        GLuint begin;
+        GLuint end;
+        bool hasStatistics;
+        GLuint statistics[STATISTIC_COUNT];
+    };
+
+    struct FrameSlot
+    {
+        FrameSlot() : timestampsUsed(0), statisticsUsed(0), frame(0), pending(false) {}
+        std::vector<Record> records;
+        std::vector<GLuint> timestamps;     // query objects, reused from frame to frame
+        std::vector<GLuint> statistics;
+        size_t timestampsUsed;
+        size_t statisticsUsed;
+        uint64_t frame;
+        bool pending;
+    };
+
+    // a pass's last `window` results, as a ring
+    struct Scope
+    {
+        const char* name;
+        std::vector<double> milliseconds;
+        std::vector<double> counts[STATISTIC_COUNT];
+        size_t next;
+        size_t count;
+    };
+
+    static GLuint acquire(std::vector<GLuint>& pool, size_t& used)
+    {
+        if (used == pool.size())
+        {
+            GLuint query;
+            glGenQueries(1, &query);
+            pool.push_back(query);
+        }
+        return pool[used++];
+    }
+
+    int scopeIndex(const char* name)
+    {
+        for (size_t i = 0; i < scopes.size(); ++i)
+            if (scopes[i].name == name || strcmp(scopes[i].name, name) == 0)
+                return (int)i;
+
+        std::lock_guard<std::mutex> lock(statsLock);
+        Scope scope;
+        scope.name = name;
+        scope.milliseconds.assign(window, 0.0);
+        for (int i = 0; i < STATISTIC_COUNT; ++i)
+            scope.counts[i].assign(window, 0.0);
+        scope.next = 0;
+        scope.count = 0;
+        scopes.push_back(scope);
+        return (int)scopes.size() - 1;
+    }
+
+    // reads a frame's results into the scopes. Without wait it gives up if the GPU
+    // hasn't got to the end of the frame yet.
+    bool collect(FrameSlot& slot, bool wait)
+    {
+        // the last timestamp of the frame lands after all the others
+        GLuint last = slot.timestamps[slot.timestampsUsed - 1];
+        if (!wait)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return false;
+        }
+
+        std::lock_guard<std::mutex> lock(statsLock);
+        for (const Record& record : slot.records)
+        {
+            if (record.end == 0)
+                continue;       // never ended
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(record.begin, GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(record.end, GL_QUERY_RESULT, &end);
+            double milliseconds = (end - begin) / 1.0e6;
+
+            GLuint64 counts[STATISTIC_COUNT] = {};
+            if (record.hasStatistics)
+                for (int i = 0; i < STATISTIC_COUNT; ++i)
+                    glGetQueryObjectui64v(record.statistics[i], GL_QUERY_RESULT, &counts[i]);
+
+            Scope& scope = scopes[record.scope];
+            scope.milliseconds[scope.next] = milliseconds;
+            for (int i = 0; i < STATISTIC_COUNT; ++i)
+                scope.counts[i][scope.next] = (double)counts[i];
+            scope.next = (scope.next + 1) % window;
+            scope.count = std::min(scope.count + 1, (size_t)window);
+
+            if (csv.is_open())
+                csv << slot.frame << "," << scope.name << "," << milliseconds << "," << counts[0] << "," << counts[1] << "," << counts[2] << "\n";
+        }
+        slot.pending = false;
+        return true;
+    }
+
+    Stats computeStats(const Scope& scope) const
+    {
+        Stats stats = Stats();
+        stats.samples = (int)scope.count;
+        if (scope.count == 0)
+            return stats;
+
+        std::vector<double> sorted(scope.milliseconds.begin(), scope.milliseconds.begin() + scope.count);
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0.0;
+        for (double value : sorted)
+            sum += value;
+        auto percentile = [&sorted](double p) { return sorted[std::min((size_t)(p * sorted.size()), sorted.size() - 1)]; };
+        stats.averageMs = sum / sorted.size();
+        stats.p50Ms = percentile(0.50);
+        stats.p95Ms = percentile(0.95);
+        stats.p99Ms = percentile(0.99);
+        stats.maxMs = sorted.back();
+
+        double totals[STATISTIC_COUNT] = {};
+        for (size_t i = 0; i < scope.count; ++i)
+            for (int s = 0; s < STATISTIC_COUNT; ++s)
+                totals[s] += scope.counts[s][i];
+        stats.primitives = totals[0] / scope.count;
+        stats.vertexInvocations = totals[1] / scope.count;
+        stats.fragmentInvocations = totals[2] / scope.count;
+        return stats;
+    }
+
+    bool created;
+    bool statistics;
+    int window;
+    std::vector<FrameSlot> frames;
+    uint64_t frameNumber;
+    size_t current;
+    std::vector<size_t> open;       // records of the passes begun but not ended yet
+    int stalls;
+
+    mutable std::mutex statsLock;   // guards scopes against readers on other threads
+    std::vector<Scope> scopes;
+    std::ofstream csv;
+};
+#endif
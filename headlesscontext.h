@@ -0,0 +1,241 @@
+#ifndef HEADLESSCONTEXT_H
+#define HEADLESSCONTEXT_H
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Backends are compiled in with build flags, since each needs its own library:
+//   HEADLESS_EGL     link libEGL. Works with GPU drivers and with Mesa's software
+//                    renderers, no X server or display needed.
+//   HEADLESS_OSMESA  link libOSMesa. Pure software rendering.
+// GLEW has to be able to load functions in the chosen context, i.e. be built with
+// GLEW_EGL / GLEW_OSMESA (a GLX build works with EGL on Mesa's libGL as well).
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef HEADLESS_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+// An OpenGL 4.4 core context with no window, for rendering on machines without a
+// display. The context has no (usable) default framebuffer: EGL makes it current without
+// a surface where it can and with a 1x1 pbuffer otherwise, OSMesa with a 1x1 buffer.
+// Everything has to be drawn into a framebuffer object instead.
+class HeadlessContext
+{
+public:
+    HeadlessContext() : backendName("none")
+    {
+#ifdef HEADLESS_EGL
+        display = EGL_NO_DISPLAY;
+        context = EGL_NO_CONTEXT;
+        surface = EGL_NO_SURFACE;
+#endif
+#ifdef HEADLESS_OSMESA
+        osmesa = NULL;
+#endif
+    }
+
+    ~HeadlessContext()
+    {
+        Destroy();
+    }
+
+    // backend is "egl", "osmesa" or empty for the first one that's compiled in and works.
+    // Leaves the context current on the calling thread.
+    bool Create(const std::string& backend)
+    {
+#ifdef HEADLESS_EGL
+        if ((backend.empty() || backend == "egl") && createEgl())
+            return true;
+#endif
+#ifdef HEADLESS_OSMESA
+        if ((backend.empty() || backend == "osmesa") && createOsMesa())
+            return true;
+#endif
+        std::cout << "ERROR: No headless OpenGL context could be created"
+            << (backend.empty() ? std::string() : " with backend " + backend)
+            << ". Compiled in:" << CompiledBackends() << std::endl;
+        return false;
+    }
+
+    void MakeCurrent() const
+    {
+#ifdef HEADLESS_EGL
+        if (context != EGL_NO_CONTEXT)
+            eglMakeCurrent(display, surface, surface, context);
+#endif
+#ifdef HEADLESS_OSMESA
+        if (osmesa)
+            OSMesaMakeCurrent(osmesa, (void*)osmesaBuffer.data(), GL_UNSIGNED_BYTE, 1, 1);
+#endif
+    }
+
+    void Destroy()
+    {
+#ifdef HEADLESS_EGL
+        if (display != EGL_NO_DISPLAY)
+        {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (surface != EGL_NO_SURFACE)
+                eglDestroySurface(display, surface);
+            if (context != EGL_NO_CONTEXT)
+                eglDestroyContext(display, context);
+            eglTerminate(display);
+        }
+        display = EGL_NO_DISPLAY;
+        context = EGL_NO_CONTEXT;
+        surface = EGL_NO_SURFACE;
+#endif
+#ifdef HEADLESS_OSMESA
+        if (osmesa)
+            OSMesaDestroyContext(osmesa);
+        osmesa = NULL;
+#endif
+        backendName = "none";
+    }
+
+    const std::string& Backend() const { return backendName; }
+
+    static std::string CompiledBackends()
+    {
+        std::string names;
+#ifdef HEADLESS_EGL
+        names += " egl";
+#endif
+#ifdef HEADLESS_OSMESA
+        names += " osmesa";
+#endif
+        return names.empty() ? " none (build with HEADLESS_EGL or HEADLESS_OSMESA)" : names;
+    }
+
+private:
+#ifdef HEADLESS_EGL
+    static bool hasExtension(const char* extensions, const char* name)
+    {
+        if (!extensions)
+            return false;
+        size_t length = strlen(name);
+        for (const char* found = strstr(extensions, name); found; found = strstr(found + length, name))
+            if ((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0'))
+                return true;
+        return false;
+    }
+
+    bool createEgl()
+    {
+        // Mesa's surfaceless platform needs neither a display server nor a GPU, otherwise
+        // fall back on the default display
+        const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+        {
+            std::cout << "WARNING: EGL: no display" << std::endl;
+            display = EGL_NO_DISPLAY;
+            return false;
+        }
+        if (!eglBindAPI(EGL_OPENGL_API))
+        {
+            std::cout << "WARNING: EGL: desktop OpenGL isn't supported" << std::endl;
+            Destroy();
+            return false;
+        }
+
+        bool surfaceless = hasExtension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+        {
+            std::cout << "WARNING: EGL: no suitable config" << std::endl;
+            Destroy();
+            return false;
+        }
+
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION_KHR, 4,
+            EGL_CONTEXT_MINOR_VERSION_KHR, 4,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT)
+        {
+            std::cout << "WARNING: EGL: couldn't create an OpenGL 4.4 core context" << std::endl;
+            Destroy();
+            return false;
+        }
+
+        if (!surfaceless)
+        {
+            const EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+            surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+        }
+        if (!eglMakeCurrent(display, surface, surface, context))
+        {
+            std::cout << "WARNING: EGL: couldn't make the context current" << std::endl;
+            Destroy();
+            return false;
+        }
+
+        backendName = surfaceless ? "egl (surfaceless)" : "egl (pbuffer)";
+        return true;
+    }
+
+    EGLDisplay display;
+    EGLContext context;
+    EGLSurface surface;
+#endif
+
+#ifdef HEADLESS_OSMESA
+    bool createOsMesa()
+    {
+        const int attributes[] = {
+            OSMESA_FORMAT, OSMESA_RGBA,
+            OSMESA_DEPTH_BITS, 0,
+            OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+            OSMESA_CONTEXT_MAJOR_VERSION, 4,
+            OSMESA_CONTEXT_MINOR_VERSION, 4,
+            0
+        };
+        osmesa = OSMesaCreateContextAttribs(attributes, NULL);
+        if (!osmesa)
+        {
+            std::cout << "WARNING: OSMesa: couldn't create an OpenGL 4.4 core context" << std::endl;
+            return false;
+        }
+
+        // OSMesa always wants a color buffer to make the context current with
+        osmesaBuffer.assign(4, 0);
+        if (!OSMesaMakeCurrent(osmesa, osmesaBuffer.data(), GL_UNSIGNED_BYTE, 1, 1))
+        {
+            std::cout << "WARNING: OSMesa: couldn't make the context current" << std::endl;
+            Destroy();
+            return false;
+        }
+
+        backendName = "osmesa";
+        return true;
+    }
+
+    OSMesaContext osmesa;
+    std::vector<unsigned char> osmesaBuffer;
+#endif
+
+    std::string backendName;
+};
+#endif
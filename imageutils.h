@@ -0,0 +1,21 @@
+#ifndef IMAGEUTILS_H
+#define IMAGEUTILS_H
+
+// Images load Y axis going down, OpenGL goes up. This flips the image.
+inline void flipImageVertically(unsigned char* image, int width, int height, int channels)
+{
+    for (int j = 0; j < height / 2; j++)
+    {
+        int index1 = j * width * channels;
+        int index2 = (height - 1 - j) * width * channels;
+        for (int i = width * channels; i > 0; --i)
+        {
+            unsigned char tmp = image[index1];
+            image[index1] = image[index2];
+            image[index2] = tmp;
+            ++index1;
+            ++index2;
+        }
+    }
+}
+#endif
@@ -0,0 +1,309 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tracks a group of jobs. Wait() on it returns once every job that was started
+// against it has finished. Jobs can also be made to depend on a counter, in which
+// case they're only queued once the counter drops to zero.
+class JobCounter
+{
+public:
+    JobCounter() : pending(0)
+    {
+    }
+
+    bool IsDone() const
+    {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<int> pending;
+    std::mutex continuationLock;
+    std::vector<std::function<void()>> continuations;
+};
+
+// Work-stealing job scheduler. Every worker, plus the thread that created the
+// system, owns a deque of jobs. A thread pushes and pops at the back of its own
+// deque, which keeps recently spawned (cache-warm) work local, and steals from the
+// front of somebody else's deque when it runs dry. Threads that are waiting on a
+// counter run jobs instead of blocking, so waiting inside a job can't deadlock.
+class JobSystem
+{
+public:
+    // workerCount is the number of threads on top of the calling thread.
+    // Pass -1 to use one worker per remaining hardware thread.
+    explicit JobSystem(int workerCount = -1) : queuedJobs(0), running(true)
+    {
+        if (workerCount < 0)
+        {
+            unsigned int hardwareThreads = std::thread::hardware_concurrency();
+            workerCount = hardwareThreads > 1 ? (int)hardwareThreads - 1 : 0;
+        }
+
+        // slot 0 belongs to the thread that owns the job system
+        for (int i = 0; i < workerCount + 1; ++i)
+            queues.emplace_back(new WorkQueue());
+
+        for (int i = 1; i <= workerCount; ++i)
+            workers.emplace_back(&JobSystem::workerMain, this, i);
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepLock);
+            running = false;
+        }
+        wakeWorkers.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // total number of threads that run jobs, including the owning thread
+    unsigned int ThreadCount() const
+    {
+        return (unsigned int)queues.size();
+    }
+
+    // queues a job. If counter is given it's incremented now and decremented when the job is done.
+    void Run(std::function<void()> job, JobCounter* counter = nullptr)
+    {
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        push(Job{ std::move(job), counter });
+    }
+
+    // queues a job that only becomes runnable once dependency has finished
+    void RunAfter(JobCounter& dependency, std::function<void()> job, JobCounter* counter = nullptr)
+    {
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+        Job deferred{ std::move(job), counter };
+        {
+            std::lock_guard<std::mutex> lock(dependency.continuationLock);
+            if (!dependency.IsDone())
+            {
+                // the last job to finish on the dependency moves this onto a queue
+                auto shared = std::make_shared<Job>(std::move(deferred));
+                dependency.continuations.push_back([this, shared]() { push(std::move(*shared)); });
+                return;
+            }
+        }
+        push(std::move(deferred));
+    }
+
+    // runs jobs until every job started against the counter has finished
+    void Wait(JobCounter& counter)
+    {
+        const unsigned int self = currentQueue();
+        unsigned int attempt = 0;
+        while (!counter.IsDone())
+        {
+            Job job;
+            if (tryGetJob(self, job))
+            {
+                execute(job);
+                attempt = 0;
+            }
+            else if (++attempt > 64)
+            {
+                std::this_thread::yield();
+            }
+        }
+        // the job that finished the group drops the count under this lock, once it's
+        // been let go the caller is free to destroy the counter
+        std::lock_guard<std::mutex> lock(counter.continuationLock);
+    }
+
+    // splits [0, count) into chunks of at most grainSize and runs body(begin, end) on each
+    // chunk across all threads, returning when all of them are done. Ranges that fit in a
+    // single chunk run inline, so small workloads don't pay for the scheduling.
+    void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body)
+    {
+        if (count == 0)
+            return;
+        if (grainSize == 0)
+            grainSize = 1;
+        if (count <= grainSize || ThreadCount() == 1)
+        {
+            body(0, count);
+            return;
+        }
+
+        JobCounter counter;
+        for (size_t begin = grainSize; begin < count; begin += grainSize)
+        {
+            size_t end = std::min(begin + grainSize, count);
+            Run([&body, begin, end]() { body(begin, end); }, &counter);
+        }
+        // do the first chunk here instead of sitting idle
+        body(0, std::min(grainSize, count));
+        Wait(counter);
+    }
+
+private:
+    struct Job
+    {
+        std::function<void()> work;
+        JobCounter* counter;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<Job> jobs;
+    };
+
+    // index of the calling thread's queue. Any thread that isn't one of our
+    // workers shares queue 0 with the thread that created the system.
+    unsigned int currentQueue() const
+    {
+        return workerOwner() == this ? workerIndex() : 0;
+    }
+
+    // which job system (if any) the calling thread is a worker of, and its queue
+    static const JobSystem*& workerOwner()
+    {
+        static thread_local const JobSystem* owner = nullptr;
+        return owner;
+    }
+
+    static unsigned int& workerIndex()
+    {
+        static thread_local unsigned int index = 0;
+        return index;
+    }
+
+    void push(Job job)
+    {
+        WorkQueue& queue = *queues[currentQueue()];
+        {
+            std::lock_guard<std::mutex> lock(queue.lock);
+            queue.jobs.push_back(std::move(job));
+        }
+        queuedJobs.fetch_add(1, std::memory_order_release);
+
+        // take the sleep lock so a worker can't miss the wakeup between checking for work and going to sleep
+        {
+            std::lock_guard<std::mutex> lock(sleepLock);
+        }
+        wakeWorkers.notify_one();
+    }
+
+    // own queue first (newest job), then steal the oldest job of the other queues
+    bool tryGetJob(unsigned int self, Job& job)
+    {
+        if (queuedJobs.load(std::memory_order_acquire) == 0)
+            return false;
+
+        {
+            WorkQueue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.lock);
+            if (!own.jobs.empty())
+            {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        const size_t queueCount = queues.size();
+        for (size_t i = 1; i < queueCount; ++i)
+        {
+            WorkQueue& victim = *queues[(self + i) % queueCount];
+            std::unique_lock<std::mutex> lock(victim.lock, std::try_to_lock);
+            if (lock.owns_lock() && !victim.jobs.empty())
+            {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(Job& job)
+    {
+        job.work();
+
+        JobCounter* counter = job.counter;
+        if (!counter)
+            return;
+
+        // jobs that aren't the last just count down
+        int pending = counter->pending.load(std::memory_order_relaxed);
+        while (pending > 1 && !counter->pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel))
+        {
+        }
+        if (pending > 1)
+            return;
+
+        // Probably the last one. It drops the count to zero under the lock, so Wait (which
+        // takes the lock before returning) can't let the counter be destroyed while this
+        // thread still has hold of it, and doesn't touch the counter once the lock is released.
+        std::vector<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter->continuationLock);
+            if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                ready.swap(counter->continuations);
+        }
+        // release anything that was waiting on the group
+        for (std::function<void()>& release : ready)
+            release();
+    }
+
+    void workerMain(unsigned int index)
+    {
+        workerOwner() = this;
+        workerIndex() = index;
+
+        unsigned int attempt = 0;
+        for (;;)
+        {
+            Job job;
+            if (tryGetJob(index, job))
+            {
+                execute(job);
+                attempt = 0;
+                continue;
+            }
+
+            // spin for a bit in case more work is about to show up, then go to sleep
+            if (++attempt < 64)
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleepLock);
+            wakeWorkers.wait(lock, [this]() { return !running || queuedJobs.load(std::memory_order_acquire) > 0; });
+            if (!running)
+                return;
+            attempt = 0;
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<int> queuedJobs;
+
+    std::mutex sleepLock;
+    std::condition_variable wakeWorkers;
+    bool running;
+};
+#endif
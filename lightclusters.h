@@ -0,0 +1,255 @@
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include "jobsystem.h"
+#include "drawstats.h"
+#include "gpumemory.h"
+#include "shader.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// A point light as the GPU sees it: two vec4s, so it packs the same way in a vertex
+// buffer (light volume instances) as in a std430 block (clustered lighting)
+struct PointLight
+{
+    glm::vec4 positionRadius;   // world space position, radius of influence in w
+    glm::vec4 color;            // rgb color * intensity, w unused
+};
+
+// Clustered light assignment. The view frustum is cut into TILES_X x TILES_Y screen
+// tiles and SLICES depth slices (spaced exponentially for a perspective camera, so near
+// clusters aren't stretched out), and every cluster gets the list of lights whose sphere
+// reaches it. The object shader then only loops over the lights in its fragment's
+// cluster, so shading cost follows how many lights overlap a pixel, not the total.
+//
+// Assignment runs on the CPU across the job system, one depth slice per job, and the
+// result is uploaded to three shader storage buffers:
+//   binding + 0: PointLight pointLights[]
+//   binding + 1: uvec2 lightClusters[]  offset into lightIndices and count, per cluster
+//   binding + 2: uint lightIndices[]
+class LightClusters
+{
+public:
+    static const int TILES_X = 16;
+    static const int TILES_Y = 9;
+    static const int SLICES = 24;
+
+    LightClusters() : depthNear(0.1f), depthFar(100.0f), logarithmic(true), maxClusterLights(0)
+    {
+        buffers[0] = buffers[1] = buffers[2] = 0;
+    }
+
+    void Create()
+    {
+        if (buffers[0] == 0)
+            glGenBuffers(3, buffers);
+    }
+
+    void Destroy()
+    {
+        if (buffers[0] != 0)
+        {
+            glDeleteBuffers(3, buffers);
+            for (GLuint buffer : buffers)
+                GpuMemory::Get().ReleaseBuffer(buffer);
+        }
+        buffers[0] = buffers[1] = buffers[2] = 0;
+    }
+
+    // Works out which lights touch which clusters. depthNear and depthFar are the view
+    // depths the slices cover (anything past the far one lands in the last slice), and
+    // logarithmic picks exponential slices for perspective or even ones for orthographic.
+    void Assign(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection,
+        float sliceNear, float sliceFar, bool logarithmicSlices, JobSystem& jobs)
+    {
+        depthNear = sliceNear;
+        depthFar = sliceFar;
+        logarithmic = logarithmicSlices;
+
+        // cluster range each light covers
+        ranges.resize(lights.size());
+        jobs.ParallelFor(lights.size(), 256, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+                ranges[i] = clusterRange(lights[i], view, projection);
+        });
+
+        // each slice builds its own lists, so the jobs never write to the same memory
+        const int tilesPerSlice = TILES_X * TILES_Y;
+        clusters.resize(tilesPerSlice * SLICES);
+        sliceIndices.resize(SLICES);
+        jobs.ParallelFor(SLICES, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t slice = begin; slice < end; ++slice)
+                assignSlice((int)slice, &clusters[slice * tilesPerSlice], sliceIndices[slice]);
+        });
+
+        // stitch the slices together, turning their local offsets into global ones
+        indices.clear();
+        maxClusterLights = 0;
+        for (int slice = 0; slice < SLICES; ++slice)
+        {
+            uint32_t base = (uint32_t)indices.size();
+            for (int tile = 0; tile < tilesPerSlice; ++tile)
+            {
+                ClusterRange& cluster = clusters[slice * tilesPerSlice + tile];
+                cluster.offset += base;
+                maxClusterLights = std::max(maxClusterLights, cluster.count);
+            }
+            indices.insert(indices.end(), sliceIndices[slice].begin(), sliceIndices[slice].end());
+        }
+    }
+
+    // uploads the lights and the last assignment and binds them for the object shader
+    void Upload(const std::vector<PointLight>& lights, GLuint firstBinding) const
+    {
+        upload(buffers[0], lights.data(), lights.size() * sizeof(PointLight), sizeof(PointLight));
+        upload(buffers[1], clusters.data(), clusters.size() * sizeof(ClusterRange), sizeof(ClusterRange));
+        upload(buffers[2], indices.data(), indices.size() * sizeof(uint32_t), sizeof(uint32_t));
+        for (GLuint i = 0; i < 3; ++i)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, firstBinding + i, buffers[i]);
+    }
+
+    // the uniforms the object shader needs to find a fragment's cluster
+    void SetUniforms(const Shader& shader, int screenWidth, int screenHeight) const
+    {
+        shader.setVec3("clusterGrid", (float)TILES_X, (float)TILES_Y, (float)SLICES);
+        shader.setVec2("screenSize", (float)screenWidth, (float)screenHeight);
+        shader.setVec2("clusterDepthRange", depthNear, depthFar);
+        shader.setBool("clusterLogarithmic", logarithmic);
+    }
+
+    // most lights any single cluster ended up with, the worst case per-fragment loop
+    uint32_t MaxClusterLights() const { return maxClusterLights; }
+    size_t IndexCount() const { return indices.size(); }
+
+private:
+    struct ClusterRange
+    {
+        uint32_t offset;
+        uint32_t count;
+    };
+
+    // inclusive cluster coordinates a light's sphere overlaps, empty if x0 > x1
+    struct LightRange
+    {
+        int x0, x1, y0, y1, z0, z1;
+    };
+
+    int sliceFor(float depth) const
+    {
+        float t;
+        if (logarithmic)
+            t = depth <= depthNear ? 0.0f : std::log(depth / depthNear) / std::log(depthFar / depthNear);
+        else
+            t = (depth - depthNear) / (depthFar - depthNear);
+        return std::min(std::max((int)(t * SLICES), 0), SLICES - 1);
+    }
+
+    LightRange clusterRange(const PointLight& light, const glm::mat4& view, const glm::mat4& projection) const
+    {
+        LightRange range;
+        glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(light.positionRadius), 1.0f));
+        float radius = light.positionRadius.w;
+
+        // view space looks down -z
+        range.z0 = sliceFor(-center.z - radius);
+        range.z1 = sliceFor(-center.z + radius);
+
+        // Screen bounds of the box around the sphere. A corner behind the eye of a
+        // perspective camera can't be projected, so such a light covers every tile.
+        bool perspective = projection[3][3] == 0.0f;
+        glm::vec2 ndcMin(1.0f), ndcMax(-1.0f);
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            glm::vec3 offset((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius, (corner & 4) ? radius : -radius);
+            glm::vec4 clip = projection * glm::vec4(center + offset, 1.0f);
+            if (perspective && clip.w <= 0.0f)
+            {
+                ndcMin = glm::vec2(-1.0f);
+                ndcMax = glm::vec2(1.0f);
+                break;
+            }
+            glm::vec2 ndc(clip.x / clip.w, clip.y / clip.w);
+            ndcMin = glm::min(ndcMin, ndc);
+            ndcMax = glm::max(ndcMax, ndc);
+        }
+
+        range.x0 = std::max((int)std::floor((ndcMin.x * 0.5f + 0.5f) * TILES_X), 0);
+        range.x1 = std::min((int)std::floor((ndcMax.x * 0.5f + 0.5f) * TILES_X), TILES_X - 1);
+        range.y0 = std::max((int)std::floor((ndcMin.y * 0.5f + 0.5f) * TILES_Y), 0);
+        range.y1 = std::min((int)std::floor((ndcMax.y * 0.5f + 0.5f) * TILES_Y), TILES_Y - 1);
+        return range;
+    }
+
+    // counts the lights per cluster first so the indices can be written without growing lists
+    void assignSlice(int slice, ClusterRange* sliceClusters, std::vector<uint32_t>& out) const
+    {
+        const int tilesPerSlice = TILES_X * TILES_Y;
+        for (int tile = 0; tile < tilesPerSlice; ++tile)
+            sliceClusters[tile].count = 0;
+
+        for (const LightRange& range : ranges)
+        {
+            if (slice < range.z0 || slice > range.z1)
+                continue;
+            for (int y = range.y0; y <= range.y1; ++y)
+                for (int x = range.x0; x <= range.x1; ++x)
+                    ++sliceClusters[y * TILES_X + x].count;
+        }
+
+        uint32_t total = 0;
+        for (int tile = 0; tile < tilesPerSlice; ++tile)
+        {
+            sliceClusters[tile].offset = total;
+            total += sliceClusters[tile].count;
+        }
+        out.resize(total);
+
+        // second pass uses count as a cursor, then puts it back
+        for (int tile = 0; tile < tilesPerSlice; ++tile)
+            sliceClusters[tile].count = 0;
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            const LightRange& range = ranges[i];
+            if (slice < range.z0 || slice > range.z1)
+                continue;
+            for (int y = range.y0; y <= range.y1; ++y)
+            {
+                for (int x = range.x0; x <= range.x1; ++x)
+                {
+                    ClusterRange& cluster = sliceClusters[y * TILES_X + x];
+                    out[cluster.offset + cluster.count++] = (uint32_t)i;
+                }
+            }
+        }
+    }
+
+    // storage buffers can't be empty, so there's always at least one element's worth
+    static void upload(GLuint buffer, const void* data, size_t size, size_t elementSize)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(size, elementSize), NULL, GL_STREAM_DRAW);
+        GpuMemory::Get().TrackBuffer(buffer, GpuMemory::STORAGE_BUFFER, "light clusters", std::max(size, elementSize));
+        if (size > 0)
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+        DrawStats::Get().Add(DrawStats::BUFFER_BYTES, size);
+    }
+
+    GLuint buffers[3];
+    float depthNear;
+    float depthFar;
+    bool logarithmic;
+    uint32_t maxClusterLights;
+
+    std::vector<LightRange> ranges;
+    std::vector<ClusterRange> clusters;
+    std::vector<std::vector<uint32_t>> sliceIndices;
+    std::vector<uint32_t> indices;
+};
+#endif
@@ -0,0 +1,27 @@
+#version 440 core
+
+out vec4 FragColor;
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+
+in vec2 TexCoords;
+in vec2 LightmapCoords;
+
+uniform Material material;
+
+// Baked irradiance from the directional light and its bounce, ambient occlusion
+// included (see lightmapbaker.h). Stored as RGBM.
+uniform sampler2D lightmap;
+uniform float lightmapRange;
+
+void main()
+{
+    vec4 rgbm = texture(lightmap, LightmapCoords);
+    vec3 irradiance = rgbm.rgb * rgbm.a * lightmapRange;
+
+    FragColor = vec4(irradiance * vec3(texture(material.diffuse, TexCoords)), 1.0);
+}
@@ -0,0 +1,24 @@
+#version 440 core
+
+layout (location = 0) in vec3 aPosition;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec2 aLightmapCoords;		// only bound once a baked lightmap is loaded
+
+out vec2 TexCoords;
+out vec2 LightmapCoords;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// the depth prepass (depthVertexShader.vs) has to land on exactly the same depth
+invariant gl_Position;
+
+void main()
+{
+	vec3 FragPos = vec3(model * vec4(aPosition, 1.0));
+	TexCoords = aTexCoords;
+	LightmapCoords = aLightmapCoords;
+
+	gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,513 @@
+#ifndef LIGHTMAPBAKER_H
+#define LIGHTMAPBAKER_H
+
+#include "bvh.h"
+#include "jobsystem.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <vector>
+
+// Baked lighting as it's stored on disk and loaded at runtime. One atlas for the whole
+// static scene plus lightmap UVs for every vertex of every baked mesh, in the order the
+// meshes were added to the baker.
+//
+// Texels are RGBM: rgb * a * RGBM_RANGE is the irradiance, so HDR light fits in four
+// bytes a texel instead of twelve.
+//
+// File layout, little endian:
+//   char[4]  "LMAP"
+//   uint32   version, width, height, mesh count
+//   uint64   source hash (LightmapBaker::SourceHash of what was baked)
+//   per mesh: uint32 vertex count, float uv[vertex count * 2]
+//   uint8    texels[width * height * 4]
+struct Lightmap
+{
+    static const uint32_t VERSION = 2;
+    static constexpr float RGBM_RANGE = 6.0f;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint64_t sourceHash = 0;
+    std::vector<std::vector<float>> uvs;
+    std::vector<uint8_t> texels;
+
+    bool Save(const char* path) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+
+        uint32_t header[4] = { VERSION, width, height, (uint32_t)uvs.size() };
+        file.write("LMAP", 4);
+        file.write((const char*)header, sizeof(header));
+        file.write((const char*)&sourceHash, sizeof(sourceHash));
+        for (const std::vector<float>& meshUvs : uvs)
+        {
+            uint32_t vertexCount = (uint32_t)(meshUvs.size() / 2);
+            file.write((const char*)&vertexCount, sizeof(vertexCount));
+            file.write((const char*)meshUvs.data(), meshUvs.size() * sizeof(float));
+        }
+        file.write((const char*)texels.data(), texels.size());
+        file.close();
+        return (bool)file;
+    }
+
+    // Reads a lightmap baked for meshes with these vertex counts. Every count in the file
+    // is checked against them and against what's left of the file before anything is
+    // allocated for it, so a stale, truncated or corrupt file just fails to load.
+    bool Load(const char* path, const std::vector<uint32_t>& vertexCounts)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+        uint64_t remaining = (uint64_t)file.tellg();
+        file.seekg(0);
+
+        char magic[4];
+        uint32_t header[4];
+        const uint64_t headerSize = sizeof(magic) + sizeof(header) + sizeof(sourceHash);
+        if (remaining < headerSize || !file.read(magic, 4) || memcmp(magic, "LMAP", 4) != 0
+            || !file.read((char*)header, sizeof(header)) || !file.read((char*)&sourceHash, sizeof(sourceHash)))
+            return false;
+        remaining -= headerSize;
+        if (header[0] != VERSION || header[3] != vertexCounts.size())
+            return false;
+
+        uvs.assign(vertexCounts.size(), std::vector<float>());
+        for (size_t m = 0; m < vertexCounts.size(); ++m)
+        {
+            uint32_t vertexCount = 0;
+            if (remaining < sizeof(vertexCount) || !file.read((char*)&vertexCount, sizeof(vertexCount)) || vertexCount != vertexCounts[m])
+                return false;
+            remaining -= sizeof(vertexCount);
+
+            const uint64_t uvBytes = (uint64_t)vertexCount * 2 * sizeof(float);
+            if (uvBytes > remaining)
+                return false;
+            uvs[m].resize((size_t)vertexCount * 2);
+            if (!file.read((char*)uvs[m].data(), uvBytes))
+                return false;
+            remaining -= uvBytes;
+        }
+
+        width = header[1];
+        height = header[2];
+        const uint64_t texelBytes = (uint64_t)width * height * 4;
+        if (width == 0 || height == 0 || texelBytes != remaining)
+            return false;
+        texels.resize((size_t)texelBytes);
+        return (bool)file.read((char*)texels.data(), texelBytes);
+    }
+
+    static void EncodeRgbm(const glm::vec3& color, uint8_t* out)
+    {
+        glm::vec3 scaled = color * (1.0f / RGBM_RANGE);
+        float m = std::min(std::max(std::max(scaled.x, scaled.y), std::max(scaled.z, 1e-6f)), 1.0f);
+        m = std::ceil(m * 255.0f) / 255.0f;
+        for (int i = 0; i < 3; ++i)
+            out[i] = (uint8_t)std::min(std::max(scaled[i] / m * 255.0f + 0.5f, 0.0f), 255.0f);
+        out[3] = (uint8_t)(m * 255.0f);
+    }
+};
+
+// Bakes the light of a fixed directional light into a lightmap for static geometry.
+//
+// Every triangle gets its own chart: laid flat with its longest edge along x, so it isn't
+// distorted, and shelf packed into one atlas with a texel of padding all round. Each texel
+// a triangle covers is then lit by tracing rays through a BVH of the whole scene:
+//   direct    the sun, if a shadow ray towards it gets out
+//   indirect  cosine weighted hemisphere rays, one bounce: the direct light and sky
+//             reaching whatever they hit, times its albedo
+//   ambient   the sky term, scaled by how many of those rays escape (ambient occlusion)
+// Texels are spread over every core with the job system. Afterwards empty texels next to
+// a chart are filled from it so bilinear filtering doesn't pull in black at chart edges.
+//
+// What's stored is irradiance, the shader multiplies it by the surface's albedo.
+class LightmapBaker
+{
+public:
+    struct Settings
+    {
+        float texelsPerUnit = 8.0f;
+        int atlasWidth = 1024;
+        int samples = 64;               // hemisphere rays per texel
+        float aoDistance = 3.0f;        // occluders further away than this don't darken the ambient term
+        glm::vec3 sunDirection = glm::vec3(0.0f, 1.0f, 0.0f);  // towards the light
+        glm::vec3 sunColor = glm::vec3(0.7f);
+        glm::vec3 skyColor = glm::vec3(0.1f);
+    };
+
+    explicit LightmapBaker(const Settings& bakeSettings) : settings(bakeSettings)
+    {
+    }
+
+    // positions and normals hold three vertices per triangle
+    void AddMesh(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals, const glm::vec3& albedo)
+    {
+        Mesh mesh;
+        mesh.positions = positions;
+        mesh.normals = normals;
+        mesh.albedo = albedo;
+        meshes.push_back(mesh);
+    }
+
+    Lightmap Bake(JobSystem& jobs)
+    {
+        Lightmap lightmap;
+        lightmap.sourceHash = SourceHash();
+        buildScene();
+        layoutCharts(lightmap);
+        rasterizeTexels(lightmap);
+
+        std::vector<glm::vec3> irradiance((size_t)lightmap.width * lightmap.height, glm::vec3(0.0f));
+        std::vector<uint8_t> covered((size_t)lightmap.width * lightmap.height, 0);
+        jobs.ParallelFor(texels.size(), 64, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const Texel& texel = texels[i];
+                irradiance[texel.index] = shade(texel, (uint32_t)i);
+                covered[texel.index] = 1;
+            }
+        });
+
+        dilate(lightmap, irradiance, covered);
+
+        lightmap.texels.resize((size_t)lightmap.width * lightmap.height * 4);
+        for (size_t i = 0; i < irradiance.size(); ++i)
+            Lightmap::EncodeRgbm(irradiance[i], &lightmap.texels[i * 4]);
+        return lightmap;
+    }
+
+    size_t TexelCount() const { return texels.size(); }
+
+    // Identifies what a bake is made from: every mesh's vertices and albedo, in order, and
+    // the settings that change the lighting or the layout. The sample count is left out,
+    // it's the quality the bake was made at rather than something about the scene.
+    uint64_t SourceHash() const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (const Mesh& mesh : meshes)
+        {
+            const uint32_t vertexCount = (uint32_t)mesh.positions.size();
+            hashBytes(hash, &vertexCount, sizeof(vertexCount));
+            hashBytes(hash, mesh.positions.data(), mesh.positions.size() * sizeof(glm::vec3));
+            hashBytes(hash, mesh.normals.data(), mesh.normals.size() * sizeof(glm::vec3));
+            hashBytes(hash, &mesh.albedo, sizeof(mesh.albedo));
+        }
+        hashBytes(hash, &settings.texelsPerUnit, sizeof(settings.texelsPerUnit));
+        hashBytes(hash, &settings.atlasWidth, sizeof(settings.atlasWidth));
+        hashBytes(hash, &settings.aoDistance, sizeof(settings.aoDistance));
+        hashBytes(hash, &settings.sunDirection, sizeof(settings.sunDirection));
+        hashBytes(hash, &settings.sunColor, sizeof(settings.sunColor));
+        hashBytes(hash, &settings.skyColor, sizeof(settings.skyColor));
+        return hash;
+    }
+
+private:
+    struct Mesh
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> normals;
+        glm::vec3 albedo;
+    };
+
+    // a triangle laid flat: a at the origin, b along x, c above; in world units
+    struct Chart
+    {
+        uint32_t mesh;
+        uint32_t triangle;      // within the mesh
+        int corner[3];          // which source vertex each of a, b, c is
+        glm::vec2 a, b, c;
+        int x, y;               // atlas position of the padded rectangle
+        int width, height;
+    };
+
+    struct Texel
+    {
+        uint32_t index;         // y * width + x in the atlas
+        glm::vec3 position;
+        glm::vec3 normal;
+    };
+
+    static const int PADDING = 1;
+
+    // 64 bit FNV-1a
+    static void hashBytes(uint64_t& hash, const void* data, size_t size)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    void buildScene()
+    {
+        std::vector<glm::vec3> all;
+        triangleMesh.clear();
+        triangleFirst.clear();
+        for (uint32_t m = 0; m < meshes.size(); ++m)
+        {
+            triangleFirst.push_back((uint32_t)triangleMesh.size());
+            all.insert(all.end(), meshes[m].positions.begin(), meshes[m].positions.end());
+            triangleMesh.insert(triangleMesh.end(), meshes[m].positions.size() / 3, m);
+        }
+        bvh.Build(all);
+    }
+
+    // lays each triangle flat and shelf packs the charts, tallest first
+    void layoutCharts(Lightmap& lightmap)
+    {
+        charts.clear();
+        for (uint32_t m = 0; m < meshes.size(); ++m)
+        {
+            const std::vector<glm::vec3>& p = meshes[m].positions;
+            for (uint32_t t = 0; t < p.size() / 3; ++t)
+            {
+                // longest edge first so the third corner lands between its ends
+                int longest = 0;
+                float longestLength = -1.0f;
+                for (int e = 0; e < 3; ++e)
+                {
+                    float length = glm::length(p[t * 3 + (e + 1) % 3] - p[t * 3 + e]);
+                    if (length > longestLength)
+                    {
+                        longestLength = length;
+                        longest = e;
+                    }
+                }
+
+                Chart chart;
+                chart.mesh = m;
+                chart.triangle = t;
+                chart.corner[0] = longest;
+                chart.corner[1] = (longest + 1) % 3;
+                chart.corner[2] = (longest + 2) % 3;
+                glm::vec3 a = p[t * 3 + chart.corner[0]];
+                glm::vec3 b = p[t * 3 + chart.corner[1]];
+                glm::vec3 c = p[t * 3 + chart.corner[2]];
+                glm::vec3 axis = longestLength > 0.0f ? (b - a) / longestLength : glm::vec3(1.0f, 0.0f, 0.0f);
+                float along = glm::dot(c - a, axis);
+                chart.a = glm::vec2(0.0f, 0.0f);
+                chart.b = glm::vec2(longestLength, 0.0f);
+                chart.c = glm::vec2(along, glm::length(c - a - axis * along));
+
+                chart.width = std::max((int)std::ceil(longestLength * settings.texelsPerUnit), 1) + 2 * PADDING;
+                chart.height = std::max((int)std::ceil(chart.c.y * settings.texelsPerUnit), 1) + 2 * PADDING;
+                chart.width = std::min(chart.width, settings.atlasWidth);
+                charts.push_back(chart);
+            }
+        }
+
+        std::vector<size_t> byHeight(charts.size());
+        for (size_t i = 0; i < byHeight.size(); ++i)
+            byHeight[i] = i;
+        std::sort(byHeight.begin(), byHeight.end(), [&](size_t a, size_t b) { return charts[a].height > charts[b].height; });
+
+        int x = 0, y = 0, shelfHeight = 0;
+        for (size_t i : byHeight)
+        {
+            Chart& chart = charts[i];
+            if (x + chart.width > settings.atlasWidth)
+            {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            chart.x = x;
+            chart.y = y;
+            x += chart.width;
+            shelfHeight = std::max(shelfHeight, chart.height);
+        }
+
+        lightmap.width = (uint32_t)settings.atlasWidth;
+        lightmap.height = (uint32_t)(((y + shelfHeight) + 3) & ~3);
+
+        // UVs of the chart corners, at the texel positions they were laid out at
+        lightmap.uvs.resize(meshes.size());
+        for (uint32_t m = 0; m < meshes.size(); ++m)
+            lightmap.uvs[m].assign(meshes[m].positions.size() * 2, 0.0f);
+        for (const Chart& chart : charts)
+        {
+            const glm::vec2* corners[3] = { &chart.a, &chart.b, &chart.c };
+            for (int k = 0; k < 3; ++k)
+            {
+                glm::vec2 texel = chartToTexel(chart, *corners[k]);
+                size_t vertex = chart.triangle * 3 + chart.corner[k];
+                lightmap.uvs[chart.mesh][vertex * 2] = texel.x / lightmap.width;
+                lightmap.uvs[chart.mesh][vertex * 2 + 1] = texel.y / lightmap.height;
+            }
+        }
+    }
+
+    glm::vec2 chartToTexel(const Chart& chart, const glm::vec2& point) const
+    {
+        return glm::vec2(chart.x + PADDING + point.x * settings.texelsPerUnit, chart.y + PADDING + point.y * settings.texelsPerUnit);
+    }
+
+    // finds the world position and normal of every texel center a chart covers
+    void rasterizeTexels(const Lightmap& lightmap)
+    {
+        texels.clear();
+        for (const Chart& chart : charts)
+        {
+            const Mesh& mesh = meshes[chart.mesh];
+            glm::vec2 a = chartToTexel(chart, chart.a);
+            glm::vec2 b = chartToTexel(chart, chart.b);
+            glm::vec2 c = chartToTexel(chart, chart.c);
+            float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+            if (std::fabs(area) < 1e-8f)
+                continue;
+
+            for (int y = chart.y; y < chart.y + chart.height; ++y)
+            {
+                for (int x = chart.x; x < chart.x + chart.width; ++x)
+                {
+                    // centers a little outside the triangle still count, so edge texels
+                    // that are partly covered get lit too. Their sample point is
+                    // pulled back onto the triangle.
+                    glm::vec2 p(x + 0.5f, y + 0.5f);
+                    float wb = ((p.x - a.x) * (c.y - a.y) - (c.x - a.x) * (p.y - a.y)) / area;
+                    float wc = ((b.x - a.x) * (p.y - a.y) - (p.x - a.x) * (b.y - a.y)) / area;
+                    float wa = 1.0f - wb - wc;
+                    const float margin = 0.5f * std::sqrt(2.0f) / std::sqrt(std::fabs(area));
+                    if (wa < -margin || wb < -margin || wc < -margin)
+                        continue;
+                    wa = std::max(wa, 0.0f);
+                    wb = std::max(wb, 0.0f);
+                    wc = std::max(wc, 0.0f);
+                    float sum = wa + wb + wc;
+
+                    size_t base = chart.triangle * 3;
+                    Texel texel;
+                    texel.index = (uint32_t)y * lightmap.width + (uint32_t)x;
+                    texel.position = (mesh.positions[base + chart.corner[0]] * wa + mesh.positions[base + chart.corner[1]] * wb
+                        + mesh.positions[base + chart.corner[2]] * wc) / sum;
+                    texel.normal = glm::normalize(mesh.normals[base + chart.corner[0]] * wa + mesh.normals[base + chart.corner[1]] * wb
+                        + mesh.normals[base + chart.corner[2]] * wc);
+                    texels.push_back(texel);
+                }
+            }
+        }
+    }
+
+    // sun light arriving at a point, zero if something is in the way
+    glm::vec3 direct(const glm::vec3& position, const glm::vec3& normal) const
+    {
+        glm::vec3 sun = glm::normalize(settings.sunDirection);
+        float cosine = glm::dot(normal, sun);
+        if (cosine <= 0.0f || bvh.Occluded(position + normal * 1e-3f, sun, 1e-4f, 1e30f))
+            return glm::vec3(0.0f);
+        return settings.sunColor * cosine;
+    }
+
+    glm::vec3 shade(const Texel& texel, uint32_t seed) const
+    {
+        std::mt19937 random(seed * 9781u + 1u);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        // basis around the normal for the hemisphere rays
+        glm::vec3 n = texel.normal;
+        glm::vec3 helper = std::fabs(n.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 tangent = glm::normalize(glm::cross(helper, n));
+        glm::vec3 bitangent = glm::cross(n, tangent);
+        glm::vec3 origin = texel.position + n * 1e-3f;
+
+        glm::vec3 bounce(0.0f);
+        int open = 0;
+        for (int s = 0; s < settings.samples; ++s)
+        {
+            // cosine weighted, so the cosine and pdf cancel out of the estimate
+            float r = std::sqrt(unit(random));
+            float phi = 2.0f * 3.14159265f * unit(random);
+            glm::vec3 direction = tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + n * std::sqrt(std::max(1.0f - r * r, 0.0f));
+
+            Bvh::Hit hit;
+            if (!bvh.Intersect(origin, direction, 1e-4f, 1e30f, hit))
+            {
+                ++open;
+                continue;
+            }
+            if (hit.t > settings.aoDistance)
+                ++open;
+
+            const Mesh& mesh = meshes[triangleMesh[hit.triangle]];
+            glm::vec3 hitPosition = origin + direction * hit.t;
+            glm::vec3 hitNormal = glm::normalize(glm::cross(hitEdge(hit.triangle, 1), hitEdge(hit.triangle, 2)));
+            if (glm::dot(hitNormal, direction) > 0.0f)
+                hitNormal = -hitNormal;
+            bounce += mesh.albedo * (direct(hitPosition, hitNormal) + settings.skyColor);
+        }
+
+        float samples = (float)std::max(settings.samples, 1);
+        float ambientOcclusion = open / samples;
+        return direct(texel.position, n) + bounce / samples + settings.skyColor * ambientOcclusion;
+    }
+
+    // edge 1 or 2 of a triangle by its index across all meshes
+    glm::vec3 hitEdge(uint32_t triangle, int edge) const
+    {
+        uint32_t m = triangleMesh[triangle];
+        const std::vector<glm::vec3>& p = meshes[m].positions;
+        size_t base = (size_t)(triangle - triangleFirst[m]) * 3;
+        return p[base + edge] - p[base];
+    }
+
+    // fills empty texels from lit neighbors, a couple of rings out from every chart
+    static void dilate(const Lightmap& lightmap, std::vector<glm::vec3>& irradiance, std::vector<uint8_t>& covered)
+    {
+        const int width = (int)lightmap.width, height = (int)lightmap.height;
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            std::vector<uint8_t> next = covered;
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    size_t index = (size_t)y * width + x;
+                    if (covered[index])
+                        continue;
+
+                    glm::vec3 sum(0.0f);
+                    int count = 0;
+                    for (int dy = -1; dy <= 1; ++dy)
+                    {
+                        for (int dx = -1; dx <= 1; ++dx)
+                        {
+                            int nx = x + dx, ny = y + dy;
+                            if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+                                continue;
+                            size_t neighbor = (size_t)ny * width + nx;
+                            if (covered[neighbor])
+                            {
+                                sum += irradiance[neighbor];
+                                ++count;
+                            }
+                        }
+                    }
+                    if (count > 0)
+                    {
+                        irradiance[index] = sum / (float)count;
+                        next[index] = 1;
+                    }
+                }
+            }
+            covered.swap(next);
+        }
+    }
+
+    Settings settings;
+    std::vector<Mesh> meshes;
+    std::vector<uint32_t> triangleMesh;     // mesh of each triangle in the BVH
+    std::vector<uint32_t> triangleFirst;    // BVH index of each mesh's first triangle
+    std::vector<Chart> charts;
+    std::vector<Texel> texels;
+    Bvh bvh;
+};
+#endif
@@ -0,0 +1,348 @@
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// for types only ever bound to be ignored, like the loop variable of a benchmark
+#ifdef __GNUC__
+#define MICROBENCH_UNUSED __attribute__((unused))
+#else
+#define MICROBENCH_UNUSED
+#endif
+
+// A small microbenchmark harness in the style of Google Benchmark, so the helpers can be
+// timed on their own without another library. A benchmark is a function that loops over
+// its BenchmarkState:
+//
+//     void BM_Something(BenchmarkState& state)
+//     {
+//         for (auto _ : state)
+//             DoNotOptimize(Something(state.Arg(0)));
+//     }
+//     BENCHMARK(BM_Something)->Arg(64)->Arg(1024);
+//
+// The runner picks an iteration count that takes at least the minimum time, then times
+// that many iterations a few times over and reports the median and fastest run.
+
+// Keeps the compiler from throwing a result away as unused: the value has to be in
+// memory, as if something read it, and nothing is moved across the call
+template <class T>
+inline void DoNotOptimize(const T& value)
+{
+#ifdef __GNUC__
+    asm volatile("" : : "m"(value) : "memory");
+#else
+    // no inline assembly on x64 MSVC; a volatile store of the address can't be dropped
+    static const volatile char* volatile sink;
+    sink = &reinterpret_cast<const volatile char&>(value);
+    _ReadWriteBarrier();
+#endif
+}
+
+class BenchmarkState
+{
+public:
+    BenchmarkState(const std::vector<int64_t>& arguments, int64_t iterationCount)
+        : args(arguments), iterations(iterationCount), items(0), bytes(0), elapsed(0), running(false)
+    {
+    }
+
+    // drives the timed loop, the clock runs from begin() until the loop ends
+    struct Iterator
+    {
+        BenchmarkState* state;
+        int64_t remaining;
+
+        bool operator!=(const Iterator&)
+        {
+            if (remaining > 0)
+                return true;
+            state->stopTimer();
+            return false;
+        }
+        void operator++() { --remaining; }
+        // nothing to use, the loop only counts
+        struct MICROBENCH_UNUSED Value {};
+        Value operator*() const { return Value(); }
+    };
+
+    Iterator begin()
+    {
+        startTimer();
+        return Iterator{ this, iterations };
+    }
+
+    Iterator end()
+    {
+        return Iterator{ this, 0 };
+    }
+
+    int64_t Arg(size_t index) const
+    {
+        return index < args.size() ? args[index] : 0;
+    }
+
+    int64_t Iterations() const { return iterations; }
+
+    // leave setup inside the loop out of the time
+    void PauseTiming() { stopTimer(); }
+    void ResumeTiming() { startTimer(); }
+
+    // totals over all iterations, reported per second
+    void SetItemsProcessed(int64_t count) { items = count; }
+    void SetBytesProcessed(int64_t count) { bytes = count; }
+    void SetLabel(const std::string& text) { label = text; }
+
+    double ElapsedSeconds() const { return elapsed / 1.0e9; }
+    int64_t ItemsProcessed() const { return items; }
+    int64_t BytesProcessed() const { return bytes; }
+    const std::string& Label() const { return label; }
+
+private:
+    void startTimer()
+    {
+        if (running)
+            return;
+        running = true;
+        start = std::chrono::steady_clock::now();
+    }
+
+    void stopTimer()
+    {
+        if (!running)
+            return;
+        running = false;
+        elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::vector<int64_t> args;
+    int64_t iterations;
+    int64_t items;
+    int64_t bytes;
+    std::string label;
+    int64_t elapsed;        // nanoseconds
+    bool running;
+    std::chrono::steady_clock::time_point start;
+};
+
+class Benchmark
+{
+public:
+    typedef void (*Function)(BenchmarkState&);
+
+    Benchmark(const char* benchmarkName, Function benchmarkFunction) : name(benchmarkName), function(benchmarkFunction)
+    {
+    }
+
+    // runs the benchmark once more with these arguments (state.Arg(0) ...)
+    Benchmark* Arg(int64_t value)
+    {
+        argumentSets.push_back(std::vector<int64_t>(1, value));
+        return this;
+    }
+
+    Benchmark* Args(const std::vector<int64_t>& values)
+    {
+        argumentSets.push_back(values);
+        return this;
+    }
+
+    // Arg(start) to Arg(end), inclusive
+    Benchmark* DenseRange(int64_t start, int64_t end)
+    {
+        for (int64_t value = start; value <= end; ++value)
+            Arg(value);
+        return this;
+    }
+
+    // every combination of the values in each list
+    Benchmark* ArgsProduct(const std::vector<std::vector<int64_t>>& lists)
+    {
+        std::vector<std::vector<int64_t>> product(1);
+        for (const std::vector<int64_t>& list : lists)
+        {
+            std::vector<std::vector<int64_t>> next;
+            for (const std::vector<int64_t>& prefix : product)
+            {
+                for (int64_t value : list)
+                {
+                    next.push_back(prefix);
+                    next.back().push_back(value);
+                }
+            }
+            product.swap(next);
+        }
+        argumentSets.insert(argumentSets.end(), product.begin(), product.end());
+        return this;
+    }
+
+    const char* name;
+    Function function;
+    std::vector<std::vector<int64_t>> argumentSets;
+};
+
+class BenchmarkRegistry
+{
+public:
+    static Benchmark* Add(const char* name, Benchmark::Function function)
+    {
+        benchmarks().emplace_back(new Benchmark(name, function));
+        return benchmarks().back().get();
+    }
+
+    // Runs every benchmark whose name contains filter and prints a line per argument set.
+    // With a json path the results are written there as well. Returns how many ran.
+    static int RunAll(const std::string& filter, double minSeconds, int repetitions, const char* jsonPath)
+    {
+        std::ofstream json;
+        if (jsonPath)
+        {
+            json.open(jsonPath);
+            if (!json)
+                std::cout << "ERROR: Couldn't write " << jsonPath << std::endl;
+            json << "{\n  \"benchmarks\": [";
+        }
+
+        std::cout << std::left << std::setw(60) << "Benchmark" << std::right << std::setw(14) << "Median" << std::setw(14) << "Fastest"
+            << std::setw(12) << "Iterations" << "  Rate" << std::endl;
+        std::cout << std::string(112, '-') << std::endl;
+
+        int count = 0;
+        for (const std::unique_ptr<Benchmark>& benchmark : benchmarks())
+        {
+            std::vector<std::vector<int64_t>> argumentSets = benchmark->argumentSets;
+            if (argumentSets.empty())
+                argumentSets.push_back(std::vector<int64_t>());
+
+            for (const std::vector<int64_t>& args : argumentSets)
+            {
+                std::string name = benchmark->name;
+                for (int64_t arg : args)
+                    name += "/" + std::to_string(arg);
+                if (name.find(filter) == std::string::npos)
+                    continue;
+
+                Result result = run(*benchmark, args, minSeconds, repetitions);
+                if (!result.label.empty())
+                    name += " " + result.label;
+                print(name, result);
+                if (json.is_open())
+                {
+                    json << (count > 0 ? "," : "") << "\n    { \"name\": \"" << name << "\", \"iterations\": " << result.iterations
+                        << ", \"median_ns\": " << result.medianNs << ", \"fastest_ns\": " << result.fastestNs << ", \"samples_ns\": [";
+                    for (size_t i = 0; i < result.samplesNs.size(); ++i)
+                        json << (i > 0 ? ", " : "") << result.samplesNs[i];
+                    json << "] }";
+                }
+                ++count;
+            }
+        }
+
+        if (json.is_open())
+            json << "\n  ]\n}\n";
+        return count;
+    }
+
+private:
+    struct Result
+    {
+        int64_t iterations;
+        double medianNs;        // per iteration
+        double fastestNs;
+        std::vector<double> samplesNs;
+        double itemsPerSecond;
+        double bytesPerSecond;
+        std::string label;
+    };
+
+    static std::vector<std::unique_ptr<Benchmark>>& benchmarks()
+    {
+        static std::vector<std::unique_ptr<Benchmark>> list;
+        return list;
+    }
+
+    static Result run(const Benchmark& benchmark, const std::vector<int64_t>& args, double minSeconds, int repetitions)
+    {
+        // grow the iteration count until one run takes long enough to time reliably
+        int64_t iterations = 1;
+        for (;;)
+        {
+            BenchmarkState state(args, iterations);
+            benchmark.function(state);
+            double seconds = state.ElapsedSeconds();
+            if (seconds >= minSeconds || iterations >= 1000000000)
+                break;
+            // aim a bit past the minimum from what this run took, at most ten times more
+            double scale = seconds > 0.0 ? minSeconds * 1.4 / seconds : 10.0;
+            iterations = std::max(iterations + 1, (int64_t)(iterations * std::min(scale, 10.0)));
+        }
+
+        Result result = Result();
+        result.iterations = iterations;
+        for (int r = 0; r < std::max(repetitions, 1); ++r)
+        {
+            BenchmarkState state(args, iterations);
+            benchmark.function(state);
+            double seconds = state.ElapsedSeconds();
+            result.samplesNs.push_back(seconds * 1.0e9 / iterations);
+            if (seconds > 0.0)
+            {
+                result.itemsPerSecond = state.ItemsProcessed() / seconds;
+                result.bytesPerSecond = state.BytesProcessed() / seconds;
+            }
+            result.label = state.Label();
+        }
+
+        std::vector<double> sorted = result.samplesNs;
+        std::sort(sorted.begin(), sorted.end());
+        result.medianNs = sorted[sorted.size() / 2];
+        result.fastestNs = sorted.front();
+        return result;
+    }
+
+    static std::string formatTime(double ns)
+    {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(ns < 10.0 ? 2 : 1);
+        if (ns < 1.0e3)
+            text << ns << " ns";
+        else if (ns < 1.0e6)
+            text << ns / 1.0e3 << " us";
+        else
+            text << ns / 1.0e6 << " ms";
+        return text.str();
+    }
+
+    static void print(const std::string& name, const Result& result)
+    {
+        std::cout << std::left << std::setw(60) << name << std::right << std::setw(14) << formatTime(result.medianNs)
+            << std::setw(14) << formatTime(result.fastestNs) << std::setw(12) << result.iterations;
+        if (result.bytesPerSecond > 0.0)
+            std::cout << "  " << std::fixed << std::setprecision(1) << result.bytesPerSecond / (1024.0 * 1024.0) << " MiB/s";
+        else if (result.itemsPerSecond > 0.0)
+            std::cout << "  " << std::fixed << std::setprecision(1) << result.itemsPerSecond / 1.0e6 << " M items/s";
+        std::cout.unsetf(std::ios::floatfield);
+        std::cout << std::setprecision(6) << std::endl;
+    }
+};
+
+#define MICROBENCH_CONCAT_INNER(a, b) a##b
+#define MICROBENCH_CONCAT(a, b) MICROBENCH_CONCAT_INNER(a, b)
+#define BENCHMARK(function) \
+    static Benchmark* MICROBENCH_CONCAT(benchmarkRegistration, __LINE__) = BenchmarkRegistry::Add(#function, function)
+#endif
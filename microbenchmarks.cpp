@@ -0,0 +1,365 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include "camera.h"
+#include "glmesh.h"
+#include "imageutils.h"
+#include "shader.h"
+#include "headlesscontext.h"
+#include "microbench.h"
+
+// Microbenchmarks for the helpers the renderer leans on every frame or at startup, so a
+// change to one of them can be measured on its own. Runs from the project directory
+// like the program itself (the shaders and Images/ are loaded from there).
+//
+// Command line options:
+//   --filter TEXT        only run benchmarks whose name contains TEXT
+//   --min-time S         seconds each timed run lasts at least (default 0.2)
+//   --repetitions N      timed runs per benchmark, the median is reported (default 5)
+//   --json FILE          also write the results to FILE
+//   --headless           get the GL context from EGL or OSMesa instead of a hidden window
+
+using namespace std;
+
+namespace
+{
+	std::string gFilter;
+	double gMinTime = 0.2;
+	int gRepetitions = 5;
+	const char* gJsonOutput = nullptr;
+	bool gHeadless = false;
+
+	GLFWwindow* gWindow = nullptr;
+	HeadlessContext gHeadlessContext;
+	bool gHaveContext = false;
+	Shader* gObjectShader = nullptr;
+
+	// the textures the scene loads, and the rest of the folder
+	const char* const IMAGE_FILES[] = {
+		"Images/pavement.jpg",
+		"Images/steel.jpg",
+		"Images/OpenfootageNETgreen.jpg",
+		"Images/plastic.jpg",
+		"Images/HedgeTexture_01.jpg",
+		"Images/HedgeTexture_02.jpg",
+		"Images/container.jpg",
+		"Images/wall.jpg"
+	};
+	const int IMAGE_FILE_COUNT = sizeof(IMAGE_FILES) / sizeof(IMAGE_FILES[0]);
+}
+
+void UParseCommandLine(int argc, char* argv[]);
+bool UCreateContext();
+void UDestroyContext();
+std::vector<GLfloat> UMakeGridVertices(int vertexCount);
+
+// ---------------------------------------------------------------------
+// CAMERA
+// ---------------------------------------------------------------------
+void BM_CameraProcessMouseMovement(BenchmarkState& state)
+{
+	Camera camera(glm::vec3(0.0f, 4.0f, 20.0f));
+	float direction = 1.0f;
+	for (auto _ : state)
+	{
+		// back and forth so pitch never hits its limit
+		camera.ProcessMouseMovement(3.0f * direction, 2.0f * direction);
+		direction = -direction;
+		DoNotOptimize(camera.Front);
+	}
+	state.SetItemsProcessed(state.Iterations());
+}
+BENCHMARK(BM_CameraProcessMouseMovement);
+
+// updateCameraVectors is private, SetOrientation is it plus two stores
+void BM_CameraUpdateVectors(BenchmarkState& state)
+{
+	Camera camera(glm::vec3(0.0f, 4.0f, 20.0f));
+	float yaw = -90.0f;
+	for (auto _ : state)
+	{
+		camera.SetOrientation(yaw, 10.0f);
+		yaw += 0.5f;
+		DoNotOptimize(camera.Up);
+	}
+	state.SetItemsProcessed(state.Iterations());
+}
+BENCHMARK(BM_CameraUpdateVectors);
+
+void BM_CameraGetViewMatrix(BenchmarkState& state)
+{
+	Camera camera(glm::vec3(0.0f, 4.0f, 20.0f));
+	for (auto _ : state)
+	{
+		glm::mat4 view = camera.GetViewMatrix();
+		DoNotOptimize(view);
+	}
+	state.SetItemsProcessed(state.Iterations());
+}
+BENCHMARK(BM_CameraGetViewMatrix);
+
+// ---------------------------------------------------------------------
+// SHADER UNIFORMS
+// ---------------------------------------------------------------------
+// Arg 0 picks the setter. Arg 1 is 0 to set by name, which hashes the name and looks the
+// location up in the shader's table on every call, or 1 to set by a location looked up
+// beforehand.
+void BM_ShaderSetUniform(BenchmarkState& state)
+{
+	static const char* const SETTERS[] = { "setInt", "setFloat", "setVec3", "setMat4" };
+	static const char* const NAMES[] = { "material.diffuse", "material.shininess", "viewPos", "model" };
+	if (!gObjectShader)
+	{
+		state.SetLabel("(no GL context)");
+		return;
+	}
+
+	Shader& shader = *gObjectShader;
+	shader.use();
+	const int setter = (int)state.Arg(0);
+	const bool byLocation = state.Arg(1) != 0;
+	const GLint location = shader.Location(NAMES[setter]);
+	const glm::vec3 position(1.0f, 2.0f, 3.0f);
+	const glm::mat4 model = glm::translate(position);
+	for (auto _ : state)
+	{
+		if (byLocation)
+		{
+			switch (setter)
+			{
+			case 0: shader.setInt(location, 0); break;
+			case 1: shader.setFloat(location, 32.0f); break;
+			case 2: shader.setVec3(location, position); break;
+			default: shader.setMat4(location, model); break;
+			}
+		}
+		else
+		{
+			switch (setter)
+			{
+			case 0: shader.setInt("material.diffuse", 0); break;
+			case 1: shader.setFloat("material.shininess", 32.0f); break;
+			case 2: shader.setVec3("viewPos", position); break;
+			default: shader.setMat4("model", model); break;
+			}
+		}
+	}
+	// keep the driver from queueing up an unbounded amount of work
+	glFinish();
+	state.SetLabel(std::string(SETTERS[setter]) + (byLocation ? " by location" : " by name"));
+	state.SetItemsProcessed(state.Iterations());
+}
+BENCHMARK(BM_ShaderSetUniform)->ArgsProduct({ { 0, 1, 2, 3 }, { 0, 1 } });
+
+// ---------------------------------------------------------------------
+// IMAGES
+// ---------------------------------------------------------------------
+// Args: size (square images), channels
+void BM_FlipImageVertically(BenchmarkState& state)
+{
+	const int width = (int)state.Arg(0);
+	const int height = width;
+	const int channels = (int)state.Arg(1);
+	std::vector<unsigned char> image((size_t)width * height * channels);
+	for (size_t i = 0; i < image.size(); ++i)
+		image[i] = (unsigned char)(i * 7);
+
+	for (auto _ : state)
+	{
+		flipImageVertically(image.data(), width, height, channels);
+		DoNotOptimize(image[0]);
+	}
+	state.SetBytesProcessed(state.Iterations() * (int64_t)image.size());
+}
+BENCHMARK(BM_FlipImageVertically)->ArgsProduct({ { 256, 1024, 2048 }, { 1, 3, 4 } });
+
+// Arg 0 is the index into IMAGE_FILES. Decoding only, no flip or upload.
+void BM_StbiLoad(BenchmarkState& state)
+{
+	const char* path = IMAGE_FILES[state.Arg(0)];
+	int width = 0, height = 0, channels = 0;
+	int64_t bytes = 0;
+	for (auto _ : state)
+	{
+		unsigned char* data = stbi_load(path, &width, &height, &channels, 0);
+		if (!data)
+		{
+			state.SetLabel(std::string(path) + " (failed to load)");
+			return;
+		}
+		bytes += (int64_t)width * height * channels;
+		stbi_image_free(data);
+	}
+	state.SetLabel(std::string(path) + " " + std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(channels));
+	state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_StbiLoad)->DenseRange(0, IMAGE_FILE_COUNT - 1);
+
+// ---------------------------------------------------------------------
+// MESHES
+// ---------------------------------------------------------------------
+// UCreateMeshBuffers (bounds, VAO, VBO upload and attributes) and UDestroyMesh for a mesh
+// of Arg 0 vertices. 6 is the plane, 36 a cube like the hedges and gundam parts.
+void BM_MeshConstruction(BenchmarkState& state)
+{
+	if (!gHaveContext)
+	{
+		state.SetLabel("(no GL context)");
+		return;
+	}
+
+	const std::vector<GLfloat> verts = UMakeGridVertices((int)state.Arg(0));
+	const GLsizeiptr size = (GLsizeiptr)(verts.size() * sizeof(GLfloat));
+	for (auto _ : state)
+	{
+		GLMesh mesh;
+		UCreateMeshBuffers(mesh, verts.data(), size);
+		UDestroyMesh(mesh);
+	}
+	glFinish();
+	state.SetBytesProcessed(state.Iterations() * (int64_t)size);
+}
+BENCHMARK(BM_MeshConstruction)->Arg(6)->Arg(36)->Arg(1536)->Arg(24576);
+
+int main(int argc, char* argv[])
+{
+	UParseCommandLine(argc, argv);
+
+	// The GL benchmarks say so in their label and time nothing without a context
+	gHaveContext = UCreateContext();
+	if (gHaveContext)
+		gObjectShader = new Shader("objectVertexShader.vs", "objectFragmentShader.fs");
+	else
+		cout << "WARNING: No OpenGL context, the shader and mesh benchmarks won't run" << endl;
+
+	int count = BenchmarkRegistry::RunAll(gFilter, gMinTime, gRepetitions, gJsonOutput);
+	if (count == 0)
+		cout << "WARNING: No benchmark matches \"" << gFilter << "\"" << endl;
+
+	delete gObjectShader;
+	UDestroyContext();
+	return EXIT_SUCCESS;
+}
+
+void UParseCommandLine(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+		{
+			gFilter = argv[++i];
+		}
+		else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+		{
+			gMinTime = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+		{
+			gRepetitions = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+		{
+			gJsonOutput = argv[++i];
+		}
+		else if (strcmp(argv[i], "--headless") == 0)
+		{
+			gHeadless = true;
+		}
+		else
+		{
+			cout << "WARNING: Unknown command line option: " << argv[i] << endl;
+		}
+	}
+}
+
+// A hidden window's context, or a headless one. Same version and profile as the program.
+bool UCreateContext()
+{
+	if (gHeadless)
+	{
+		if (!gHeadlessContext.Create(""))
+			return false;
+	}
+	else
+	{
+		if (!glfwInit())
+			return false;
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		gWindow = glfwCreateWindow(64, 64, "microbenchmarks", NULL, NULL);
+		if (!gWindow)
+		{
+			glfwTerminate();
+			return false;
+		}
+		glfwMakeContextCurrent(gWindow);
+	}
+
+	glewExperimental = GL_TRUE;
+	GLenum result = glewInit();
+	if (result != GLEW_OK)
+	{
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+		// a GLX build of GLEW has loaded the GL functions by then, there's just no X display
+		if (!(gHeadless && result == GLEW_ERROR_NO_GLX_DISPLAY))
+#endif
+		{
+			std::cerr << glewGetErrorString(result) << std::endl;
+			return false;
+		}
+	}
+	cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+	return true;
+}
+
+void UDestroyContext()
+{
+	if (gWindow)
+	{
+		glfwDestroyWindow(gWindow);
+		glfwTerminate();
+		gWindow = nullptr;
+	}
+	gHeadlessContext.Destroy();
+}
+
+// vertexCount vertices (a multiple of 6) of quads laid out in a square grid, in the
+// position/normal/uv layout UCreateMeshBuffers takes
+std::vector<GLfloat> UMakeGridVertices(int vertexCount)
+{
+	const int quads = std::max(vertexCount / 6, 1);
+	const int side = (int)std::ceil(std::sqrt((double)quads));
+	const float corners[6][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 0 }, { 1, 1 }, { 0, 1 } };
+
+	std::vector<GLfloat> verts;
+	verts.reserve(quads * 6 * 8);
+	for (int q = 0; q < quads; ++q)
+	{
+		const float x = (float)(q % side);
+		const float z = (float)(q / side);
+		for (int c = 0; c < 6; ++c)
+		{
+			const GLfloat vertex[8] = { x + corners[c][0], 0.0f, z + corners[c][1], 0.0f, 1.0f, 0.0f, corners[c][0], corners[c][1] };
+			verts.insert(verts.end(), vertex, vertex + 8);
+		}
+	}
+	return verts;
+}
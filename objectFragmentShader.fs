@@ -15,6 +15,11 @@ struct Light {
     vec3 specular;
 };
 
+struct PointLight {
+    vec4 positionRadius;
+    vec4 color;
+};
+
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
@@ -24,7 +29,29 @@ uniform Material material;
 
 uniform Light light;
 
-vec3 calcLight(Light light, vec3 normal, vec3 viewDir);
+// Clustered point lights (see lightclusters.h). Only read when clusteredLights is set.
+layout (std430, binding = 0) readonly buffer PointLights { PointLight pointLights[]; };
+layout (std430, binding = 1) readonly buffer LightClusters { uvec2 lightClusters[]; };	// offset, count
+layout (std430, binding = 2) readonly buffer LightIndices { uint lightIndices[]; };
+
+uniform bool clusteredLights;
+uniform mat4 view;
+uniform vec3 clusterGrid;			// tiles across, tiles down, depth slices
+uniform vec2 screenSize;
+uniform vec2 clusterDepthRange;		// view depth of the first and last slice
+uniform bool clusterLogarithmic;
+
+// Cascaded shadows for the directional light (see shadowcascades.h)
+uniform bool shadowsEnabled;
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 shadowMatrices[3];
+uniform int shadowLayers[3];
+uniform bool shadowDepthZeroToOne;
+
+vec3 calcLight(Light light, vec3 normal, vec3 viewDir, float shadow);
+float calcShadow(vec3 normal);
+vec3 calcPointLight(PointLight pointLight, vec3 normal, vec3 viewDir);
+uint clusterIndex();
 
 void main()
 {
@@ -32,13 +59,22 @@ void main()
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
     
-    // Just getting a single light for the project for now
-    vec3 result = calcLight(light, norm, viewDir);
+    float shadow = shadowsEnabled ? calcShadow(norm) : 1.0;
+    vec3 result = calcLight(light, norm, viewDir, shadow);
+
+    // only the lights whose range reaches this fragment's cluster
+    if (clusteredLights)
+    {
+        uvec2 cluster = lightClusters[clusterIndex()];
+        for (uint i = 0; i < cluster.y; ++i)
+            result += calcPointLight(pointLights[lightIndices[cluster.x + i]], norm, viewDir);
+    }
 
     FragColor = vec4(result, 1.0);
 }
 
-vec3 calcLight(Light light, vec3 normal, vec3 viewDir)
+// shadow is 0 where the light is blocked, 1 where it isn't. Ambient ignores it.
+vec3 calcLight(Light light, vec3 normal, vec3 viewDir, float shadow)
 {
     vec3 lightDir = normalize(light.position);
     // diffuse shading
@@ -50,5 +86,69 @@ vec3 calcLight(Light light, vec3 normal, vec3 viewDir)
     vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
     vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
     vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
-    return (ambient + diffuse + specular);
-}
\ No newline at end of file
+    return (ambient + (diffuse + specular) * shadow);
+}
+
+// Looks the fragment up in the first cascade that covers it. Cascades are boxes around
+// the camera, smallest first, so the first hit is the sharpest map available.
+float calcShadow(vec3 normal)
+{
+    // nudging the lookup off the surface hides most acne the polygon offset doesn't
+    vec3 position = FragPos + normal * 0.02;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        vec3 coord = (shadowMatrices[i] * vec4(position, 1.0)).xyz;
+        if (any(greaterThan(abs(coord.xy), vec2(0.98))))
+            continue;
+
+        float depth = shadowDepthZeroToOne ? coord.z : coord.z * 0.5 + 0.5;
+        vec2 uv = coord.xy * 0.5 + 0.5;
+
+        // 3x3 taps of the hardware 2x2 comparison filter
+        vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+        float lit = 0.0;
+        for (int x = -1; x <= 1; ++x)
+            for (int y = -1; y <= 1; ++y)
+                lit += texture(shadowMap, vec4(uv + vec2(x, y) * texel, float(shadowLayers[i]), depth));
+        return lit / 9.0;
+    }
+    return 1.0;
+}
+
+// same falloff as the deferred light volumes (deferredPointFragmentShader.fs)
+vec3 calcPointLight(PointLight pointLight, vec3 normal, vec3 viewDir)
+{
+    vec3 toLight = pointLight.positionRadius.xyz - FragPos;
+    float dist = length(toLight);
+    float radius = pointLight.positionRadius.w;
+    if (dist >= radius)
+        return vec3(0.0);
+
+    vec3 lightDir = toLight / dist;
+    float window = clamp(1.0 - pow(dist / radius, 4.0), 0.0, 1.0);
+    float attenuation = window * window / (dist * dist + 1.0);
+
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+
+    vec3 diffuse = diff * vec3(texture(material.diffuse, TexCoords));
+    vec3 specular = spec * vec3(texture(material.specular, TexCoords));
+    return pointLight.color.rgb * attenuation * (diffuse + specular);
+}
+
+// which cluster the fragment falls in, matching LightClusters::sliceFor on the CPU
+uint clusterIndex()
+{
+    float depth = -(view * vec4(FragPos, 1.0)).z;
+    float t;
+    if (clusterLogarithmic)
+        t = depth <= clusterDepthRange.x ? 0.0 : log(depth / clusterDepthRange.x) / log(clusterDepthRange.y / clusterDepthRange.x);
+    else
+        t = (depth - clusterDepthRange.x) / (clusterDepthRange.y - clusterDepthRange.x);
+
+    uvec3 grid = uvec3(clusterGrid);
+    uvec3 cluster = uvec3(clamp(vec3(gl_FragCoord.xy / screenSize, t) * clusterGrid, vec3(0.0), clusterGrid - 1.0));
+    return (cluster.z * grid.y + cluster.y) * grid.x + cluster.x;
+}
@@ -12,6 +12,9 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// the depth prepass (depthVertexShader.vs) has to land on exactly the same depth
+invariant gl_Position;
+
 void main()
 {
 	FragPos = vec3(model * vec4(aPosition, 1.0));
@@ -0,0 +1,715 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "commandline.h"
+
+// Performance regression gate. Runs the benchmark flythrough (--benchmark) a few times
+// and the microbenchmarks once, then compares every metric against a checked-in baseline.
+// A metric regresses when its median got worse by more than the metric's tolerance AND
+// a one-sided Mann-Whitney U test over the samples says the difference isn't noise, so
+// a single slow run can't fail the gate and neither can a real but tolerated change.
+// Prints a table of every metric and exits with 1 on a regression, 2 when the
+// benchmarks couldn't be run or the baseline read, 0 otherwise.
+//
+// Run it from the project directory like the program itself. The baseline is this tool's
+// own output (--update-baseline); tolerances edited in it by hand are kept on updates.
+//
+// Command line options:
+//   --baseline FILE         baseline to compare with (default perf_baseline.json)
+//   --update-baseline       write the results as the new baseline instead of comparing
+//   --results FILE          also write this run's results, in the baseline format
+//   --app PATH              the program (default: next to this tool)
+//   --microbenchmarks PATH  the microbenchmark program (default: next to this tool)
+//   --path FILE             flythrough keyframes (default benchmark_path.txt)
+//   --runs N                flythrough runs, one sample each per metric (default 5)
+//   --frames N              measured frames per run (default 300)
+//   --warmup N              frames before measuring starts (default 30)
+//   --repetitions N         microbenchmark repetitions, one sample each (default 5)
+//   --filter TEXT           only run the microbenchmarks whose name contains TEXT
+//   --no-flythrough         skip the flythrough
+//   --no-microbenchmarks    skip the microbenchmarks
+//   --alpha P               significance level of the test (default 0.05)
+//   --headless              run the flythrough without a window
+//   -- ARGS                 everything after is passed to the program as well
+
+using namespace std;
+
+namespace
+{
+	std::string gBaselineFile = "perf_baseline.json";
+	bool gUpdateBaseline = false;
+	const char* gResultsFile = nullptr;
+	std::string gAppPath;
+	std::string gMicrobenchmarksPath;
+	std::string gPathFile = "benchmark_path.txt";
+	int gRuns = 5;
+	int gFrames = 300;
+	int gWarmup = 30;
+	int gRepetitions = 5;
+	std::string gFilter;
+	bool gRunFlythrough = true;
+	bool gRunMicrobenchmarks = true;
+	double gAlpha = 0.05;
+	bool gHeadless = false;
+	std::string gAppArguments;
+
+	// where the benchmarks write their results, removed again afterwards
+	const char* const FLYTHROUGH_RESULTS = "perfgate_flythrough.json";
+	const char* const MICROBENCHMARK_RESULTS = "perfgate_microbenchmarks.json";
+
+	// Fraction a metric's median may grow by before it counts, unless the baseline
+	// says otherwise. Startup is dominated by file loading and is noisier.
+	const double FRAME_TIME_TOLERANCE = 0.10;
+	const double STARTUP_TOLERANCE = 0.15;
+	const double MEMORY_TOLERANCE = 0.05;
+	const double MICROBENCHMARK_TOLERANCE = 0.10;
+
+	// below this many samples on either side the test can't reach any usual
+	// significance level, so the tolerance decides on its own
+	const size_t MIN_TEST_SAMPLES = 3;
+
+	// All metrics are lower-is-better
+	struct Metric
+	{
+		std::string name;
+		std::string unit;
+		double tolerance;
+		std::vector<double> samples;
+	};
+
+	// Just enough JSON for the benchmark results and the baseline
+	struct JsonValue
+	{
+		enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+		JsonValue() : type(NUL), number(0.0) {}
+
+		const JsonValue* Find(const std::string& key) const
+		{
+			for (const std::pair<std::string, JsonValue>& member : members)
+				if (member.first == key)
+					return &member.second;
+			return nullptr;
+		}
+
+		double NumberOr(const std::string& key, double fallback) const
+		{
+			const JsonValue* value = Find(key);
+			return value && value->type == NUMBER ? value->number : fallback;
+		}
+
+		Type type;
+		double number;					// NUMBER, and BOOLEAN as 0 or 1
+		std::string text;				// STRING
+		std::vector<JsonValue> items;	// ARRAY
+		std::vector<std::pair<std::string, JsonValue>> members;	// OBJECT, in file order
+	};
+
+	class JsonParser
+	{
+	public:
+		explicit JsonParser(const std::string& source) : text(source), pos(0) {}
+
+		bool Parse(JsonValue& value)
+		{
+			if (!parseValue(value))
+				return false;
+			skipSpace();
+			return pos == text.size();
+		}
+
+	private:
+		void skipSpace()
+		{
+			while (pos < text.size() && isspace((unsigned char)text[pos]))
+				++pos;
+		}
+
+		bool literal(const char* word)
+		{
+			size_t length = strlen(word);
+			if (text.compare(pos, length, word) != 0)
+				return false;
+			pos += length;
+			return true;
+		}
+
+		bool parseString(std::string& out)
+		{
+			if (text[pos] != '"')
+				return false;
+			for (++pos; pos < text.size(); ++pos)
+			{
+				char c = text[pos];
+				if (c == '"')
+				{
+					++pos;
+					return true;
+				}
+				if (c == '\\' && ++pos < text.size())
+				{
+					// \uXXXX escapes don't turn up in anything this reads
+					switch (text[pos])
+					{
+					case 'n': c = '\n'; break;
+					case 't': c = '\t'; break;
+					case 'r': c = '\r'; break;
+					default: c = text[pos]; break;
+					}
+				}
+				out += c;
+			}
+			return false;
+		}
+
+		bool parseValue(JsonValue& value)
+		{
+			skipSpace();
+			if (pos >= text.size())
+				return false;
+
+			char c = text[pos];
+			if (c == '{')
+			{
+				value.type = JsonValue::OBJECT;
+				++pos;
+				skipSpace();
+				if (pos < text.size() && text[pos] == '}')
+				{
+					++pos;
+					return true;
+				}
+				for (;;)
+				{
+					std::pair<std::string, JsonValue> member;
+					skipSpace();
+					if (pos >= text.size() || !parseString(member.first))
+						return false;
+					skipSpace();
+					if (pos >= text.size() || text[pos++] != ':' || !parseValue(member.second))
+						return false;
+					value.members.push_back(member);
+					skipSpace();
+					if (pos >= text.size())
+						return false;
+					if (text[pos] == '}')
+					{
+						++pos;
+						return true;
+					}
+					if (text[pos++] != ',')
+						return false;
+				}
+			}
+			if (c == '[')
+			{
+				value.type = JsonValue::ARRAY;
+				++pos;
+				skipSpace();
+				if (pos < text.size() && text[pos] == ']')
+				{
+					++pos;
+					return true;
+				}
+				for (;;)
+				{
+					value.items.push_back(JsonValue());
+					if (!parseValue(value.items.back()))
+						return false;
+					skipSpace();
+					if (pos >= text.size())
+						return false;
+					if (text[pos] == ']')
+					{
+						++pos;
+						return true;
+					}
+					if (text[pos++] != ',')
+						return false;
+				}
+			}
+			if (c == '"')
+			{
+				value.type = JsonValue::STRING;
+				return parseString(value.text);
+			}
+			if (literal("true"))
+			{
+				value.type = JsonValue::BOOLEAN;
+				value.number = 1.0;
+				return true;
+			}
+			if (literal("false"))
+			{
+				value.type = JsonValue::BOOLEAN;
+				return true;
+			}
+			if (literal("null"))
+				return true;
+
+			// strtod also takes what JSON doesn't (inf, hex), which does no harm here
+			const char* start = text.c_str() + pos;
+			char* end = nullptr;
+			value.type = JsonValue::NUMBER;
+			value.number = strtod(start, &end);
+			if (end == start)
+				return false;
+			pos += end - start;
+			return true;
+		}
+
+		const std::string& text;
+		size_t pos;
+	};
+}
+
+void UParseCommandLine(int argc, char* argv[]);
+std::string UDefaultProgramPath(const char* self, const char* program);
+int URunCommand(std::string command);
+bool UReadJson(const char* path, JsonValue& value);
+bool URunFlythrough(std::vector<Metric>& metrics);
+bool URunMicrobenchmarks(std::vector<Metric>& metrics);
+void UAddSample(std::vector<Metric>& metrics, const std::string& name, const char* unit, double tolerance, double value);
+bool UReadBaseline(const std::string& path, std::vector<Metric>& metrics, double& alpha);
+bool UWriteMetrics(const std::string& path, const std::vector<Metric>& metrics);
+bool UCompare(const std::vector<Metric>& baseline, const std::vector<Metric>& current);
+double UMedian(std::vector<double> samples);
+double UMannWhitneyGreater(const std::vector<double>& current, const std::vector<double>& baseline);
+std::string UFormatValue(double value, const std::string& unit);
+
+int main(int argc, char* argv[])
+{
+	UParseCommandLine(argc, argv);
+	if (gAppPath.empty())
+		gAppPath = UDefaultProgramPath(argv[0], "CS-330-FinalProject_v4");
+	if (gMicrobenchmarksPath.empty())
+		gMicrobenchmarksPath = UDefaultProgramPath(argv[0], "CS-330-FinalProject_v4.Benchmarks");
+
+	// the baseline's tolerances and significance level win over the defaults
+	std::vector<Metric> baseline;
+	double baselineAlpha = gAlpha;
+	bool haveBaseline = UReadBaseline(gBaselineFile, baseline, baselineAlpha);
+	if (!haveBaseline && !gUpdateBaseline)
+	{
+		cout << "ERROR: Couldn't read the baseline " << gBaselineFile << ", make one with --update-baseline" << endl;
+		return 2;
+	}
+
+	std::vector<Metric> current;
+	if (gRunFlythrough && !URunFlythrough(current))
+		return 2;
+	if (gRunMicrobenchmarks && !URunMicrobenchmarks(current))
+		return 2;
+
+	for (Metric& metric : current)
+		for (const Metric& base : baseline)
+			if (base.name == metric.name)
+				metric.tolerance = base.tolerance;
+
+	if (gResultsFile && !UWriteMetrics(gResultsFile, current))
+		cout << "ERROR: Couldn't write " << gResultsFile << endl;
+
+	if (gUpdateBaseline)
+	{
+		if (!UWriteMetrics(gBaselineFile, current))
+		{
+			cout << "ERROR: Couldn't write " << gBaselineFile << endl;
+			return 2;
+		}
+		cout << "INFO: Wrote " << current.size() << " metrics to " << gBaselineFile << endl;
+		return EXIT_SUCCESS;
+	}
+
+	gAlpha = baselineAlpha;
+	return UCompare(baseline, current) ? EXIT_SUCCESS : 1;
+}
+
+void UParseCommandLine(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+		{
+			gBaselineFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--update-baseline") == 0)
+		{
+			gUpdateBaseline = true;
+		}
+		else if (strcmp(argv[i], "--results") == 0 && i + 1 < argc)
+		{
+			gResultsFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--app") == 0 && i + 1 < argc)
+		{
+			gAppPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--microbenchmarks") == 0 && i + 1 < argc)
+		{
+			gMicrobenchmarksPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--path") == 0 && i + 1 < argc)
+		{
+			gPathFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+		{
+			gRuns = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			gFrames = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+		{
+			gWarmup = std::max(atoi(argv[++i]), 0);
+		}
+		else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+		{
+			gRepetitions = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+		{
+			gFilter = argv[++i];
+		}
+		else if (strcmp(argv[i], "--no-flythrough") == 0)
+		{
+			gRunFlythrough = false;
+		}
+		else if (strcmp(argv[i], "--no-microbenchmarks") == 0)
+		{
+			gRunMicrobenchmarks = false;
+		}
+		else if (strcmp(argv[i], "--alpha") == 0 && i + 1 < argc)
+		{
+			gAlpha = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--headless") == 0)
+		{
+			gHeadless = true;
+		}
+		else if (strcmp(argv[i], "--") == 0)
+		{
+			while (++i < argc)
+				gAppArguments += " " + UQuoteArgument(argv[i]);
+		}
+		else
+		{
+			cout << "WARNING: Unknown command line option: " << argv[i] << endl;
+		}
+	}
+}
+
+// program in the directory this tool was started from, where the build puts them all
+std::string UDefaultProgramPath(const char* self, const char* program)
+{
+	std::string path(self);
+	size_t slash = path.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+#ifdef _WIN32
+	return directory + "\\" + program + ".exe";
+#else
+	return directory + "/" + program;
+#endif
+}
+
+int URunCommand(std::string command)
+{
+#ifdef _WIN32
+	// cmd.exe drops the first and last quote of the line, give it a pair to drop
+	command = "\"" + command + "\"";
+#endif
+	return std::system(command.c_str());
+}
+
+bool UReadJson(const char* path, JsonValue& value)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+	std::stringstream contents;
+	contents << file.rdbuf();
+	const std::string text = contents.str();
+	return JsonParser(text).Parse(value);
+}
+
+// Each run of the flythrough is one sample of each metric
+bool URunFlythrough(std::vector<Metric>& metrics)
+{
+	std::string command = UQuoteArgument(gAppPath) + " --benchmark " + UQuoteArgument(gPathFile)
+		+ " --benchmark-frames " + std::to_string(gFrames) + " --benchmark-warmup " + std::to_string(gWarmup)
+		+ " --benchmark-output " + FLYTHROUGH_RESULTS + (gHeadless ? " --headless" : "") + gAppArguments;
+
+	for (int run = 0; run < gRuns; ++run)
+	{
+		cout << "INFO: Flythrough run " << run + 1 << " of " << gRuns << endl;
+		std::remove(FLYTHROUGH_RESULTS);
+		int status = URunCommand(command);
+		JsonValue results;
+		if (status != 0 || !UReadJson(FLYTHROUGH_RESULTS, results))
+		{
+			cout << "ERROR: The flythrough failed (exit status " << status << "): " << command << endl;
+			return false;
+		}
+
+		const JsonValue* cpu = results.Find("cpu_ms");
+		const JsonValue* gpu = results.Find("gpu_ms");
+		const JsonValue* memory = results.Find("memory");
+		if (cpu)
+		{
+			UAddSample(metrics, "flythrough/cpu_ms_mean", "ms", FRAME_TIME_TOLERANCE, cpu->NumberOr("mean", 0.0));
+			UAddSample(metrics, "flythrough/cpu_ms_p95", "ms", FRAME_TIME_TOLERANCE, cpu->NumberOr("p95", 0.0));
+		}
+		if (gpu && gpu->Find("mean"))
+		{
+			UAddSample(metrics, "flythrough/gpu_ms_mean", "ms", FRAME_TIME_TOLERANCE, gpu->NumberOr("mean", 0.0));
+			UAddSample(metrics, "flythrough/gpu_ms_p95", "ms", FRAME_TIME_TOLERANCE, gpu->NumberOr("p95", 0.0));
+		}
+		if (results.Find("startup_ms"))
+			UAddSample(metrics, "flythrough/startup_ms", "ms", STARTUP_TOLERANCE, results.NumberOr("startup_ms", 0.0));
+		if (memory && memory->Find("peak_resident_bytes"))
+			UAddSample(metrics, "flythrough/peak_memory_mb", "MiB", MEMORY_TOLERANCE, memory->NumberOr("peak_resident_bytes", 0.0) / (1024.0 * 1024.0));
+		if (memory && memory->Find("gpu_peak_bytes"))
+			UAddSample(metrics, "flythrough/gpu_memory_mb", "MiB", MEMORY_TOLERANCE, memory->NumberOr("gpu_peak_bytes", 0.0) / (1024.0 * 1024.0));
+	}
+	std::remove(FLYTHROUGH_RESULTS);
+	return true;
+}
+
+// Every repetition of a microbenchmark is one sample, in nanoseconds per iteration
+bool URunMicrobenchmarks(std::vector<Metric>& metrics)
+{
+	std::string command = UQuoteArgument(gMicrobenchmarksPath) + " --repetitions " + std::to_string(gRepetitions)
+		+ " --json " + MICROBENCHMARK_RESULTS + (gHeadless ? " --headless" : "");
+	if (!gFilter.empty())
+		command += " --filter " + UQuoteArgument(gFilter);
+
+	cout << "INFO: Running the microbenchmarks" << endl;
+	std::remove(MICROBENCHMARK_RESULTS);
+	int status = URunCommand(command);
+	JsonValue results;
+	const JsonValue* benchmarks = nullptr;
+	if (status != 0 || !UReadJson(MICROBENCHMARK_RESULTS, results) || !(benchmarks = results.Find("benchmarks")))
+	{
+		cout << "ERROR: The microbenchmarks failed (exit status " << status << "): " << command << endl;
+		return false;
+	}
+
+	for (const JsonValue& benchmark : benchmarks->items)
+	{
+		const JsonValue* name = benchmark.Find("name");
+		const JsonValue* samples = benchmark.Find("samples_ns");
+		if (!name || !samples)
+			continue;
+		// the name ends with the label after a space, which can differ from run to run
+		const std::string key = "micro/" + name->text.substr(0, name->text.find(' '));
+		for (const JsonValue& sample : samples->items)
+			UAddSample(metrics, key, "ns", MICROBENCHMARK_TOLERANCE, sample.number);
+	}
+	std::remove(MICROBENCHMARK_RESULTS);
+	return true;
+}
+
+void UAddSample(std::vector<Metric>& metrics, const std::string& name, const char* unit, double tolerance, double value)
+{
+	for (Metric& metric : metrics)
+	{
+		if (metric.name == name)
+		{
+			metric.samples.push_back(value);
+			return;
+		}
+	}
+	Metric metric;
+	metric.name = name;
+	metric.unit = unit;
+	metric.tolerance = tolerance;
+	metric.samples.push_back(value);
+	metrics.push_back(metric);
+}
+
+bool UReadBaseline(const std::string& path, std::vector<Metric>& metrics, double& alpha)
+{
+	JsonValue root;
+	if (!UReadJson(path.c_str(), root))
+		return false;
+	const JsonValue* list = root.Find("metrics");
+	if (!list)
+		return false;
+
+	alpha = root.NumberOr("alpha", alpha);
+	for (const std::pair<std::string, JsonValue>& member : list->members)
+	{
+		Metric metric;
+		metric.name = member.first;
+		const JsonValue* unit = member.second.Find("unit");
+		metric.unit = unit ? unit->text : "";
+		metric.tolerance = member.second.NumberOr("tolerance", 0.0);
+		if (const JsonValue* samples = member.second.Find("samples"))
+			for (const JsonValue& sample : samples->items)
+				metric.samples.push_back(sample.number);
+		metrics.push_back(metric);
+	}
+	return true;
+}
+
+bool UWriteMetrics(const std::string& path, const std::vector<Metric>& metrics)
+{
+	std::ofstream out(path);
+	out << std::setprecision(10);
+	out << "{\n";
+	out << "  \"alpha\": " << gAlpha << ",\n";
+	out << "  \"metrics\": {";
+	for (size_t i = 0; i < metrics.size(); ++i)
+	{
+		const Metric& metric = metrics[i];
+		out << (i > 0 ? "," : "") << "\n    \"" << metric.name << "\": { \"unit\": \"" << metric.unit
+			<< "\", \"tolerance\": " << metric.tolerance << ", \"samples\": [";
+		for (size_t s = 0; s < metric.samples.size(); ++s)
+			out << (s > 0 ? ", " : "") << metric.samples[s];
+		out << "] }";
+	}
+	out << "\n  }\n}\n";
+	out.close();
+	return (bool)out;
+}
+
+// Prints a line per metric and returns false if any of them regressed. Metrics only in
+// one of the two are listed but don't fail the gate.
+bool UCompare(const std::vector<Metric>& baseline, const std::vector<Metric>& current)
+{
+	cout << std::left << std::setw(44) << "Metric" << std::right << std::setw(14) << "Baseline" << std::setw(14) << "Current"
+		<< std::setw(10) << "Change" << std::setw(11) << "Tolerance" << std::setw(9) << "p" << "  Status" << endl;
+	cout << std::string(112, '-') << endl;
+
+	int regressions = 0;
+	std::vector<const Metric*> seen;
+	for (const Metric& base : baseline)
+	{
+		const Metric* now = nullptr;
+		for (const Metric& metric : current)
+			if (metric.name == base.name)
+				now = &metric;
+		if (!now)
+		{
+			// skipped with --no-flythrough or a filter, or gone from the benchmarks
+			cout << std::left << std::setw(44) << base.name << std::right << std::setw(14) << UFormatValue(UMedian(base.samples), base.unit)
+				<< std::setw(14) << "-" << std::setw(30) << "" << "  not run" << endl;
+			continue;
+		}
+		seen.push_back(now);
+
+		const double before = UMedian(base.samples);
+		const double after = UMedian(now->samples);
+		const double change = before != 0.0 ? after / before - 1.0 : 0.0;
+		const bool testable = base.samples.size() >= MIN_TEST_SAMPLES && now->samples.size() >= MIN_TEST_SAMPLES;
+		const double pWorse = testable ? UMannWhitneyGreater(now->samples, base.samples) : 0.0;
+		const double pBetter = testable ? UMannWhitneyGreater(base.samples, now->samples) : 0.0;
+
+		const char* status = "ok";
+		if (change > base.tolerance)
+		{
+			status = pWorse < gAlpha ? "REGRESSED" : "noise";
+			if (pWorse < gAlpha)
+				++regressions;
+		}
+		else if (change < -base.tolerance && pBetter < gAlpha)
+		{
+			status = "improved";
+		}
+
+		std::ostringstream changeText, toleranceText, pText;
+		changeText << std::fixed << std::setprecision(1) << std::showpos << change * 100.0 << "%";
+		toleranceText << std::fixed << std::setprecision(1) << base.tolerance * 100.0 << "%";
+		if (testable)
+			pText << std::fixed << std::setprecision(3) << (change >= 0.0 ? pWorse : pBetter);
+		else
+			pText << "n/a";
+		cout << std::left << std::setw(44) << base.name << std::right << std::setw(14) << UFormatValue(before, base.unit)
+			<< std::setw(14) << UFormatValue(after, base.unit) << std::setw(10) << changeText.str() << std::setw(11) << toleranceText.str()
+			<< std::setw(9) << pText.str() << "  " << status << endl;
+	}
+
+	for (const Metric& metric : current)
+	{
+		if (std::find(seen.begin(), seen.end(), &metric) == seen.end())
+			cout << std::left << std::setw(44) << metric.name << std::right << std::setw(14) << "-"
+				<< std::setw(14) << UFormatValue(UMedian(metric.samples), metric.unit) << std::setw(30) << "" << "  new, not in the baseline" << endl;
+	}
+
+	cout << endl;
+	if (regressions > 0)
+		cout << "FAILED: " << regressions << " metric(s) regressed beyond their tolerance (Mann-Whitney, alpha " << gAlpha << ")" << endl;
+	else
+		cout << "PASSED: no regressions against " << gBaselineFile << endl;
+	return regressions == 0;
+}
+
+double UMedian(std::vector<double> samples)
+{
+	if (samples.empty())
+		return 0.0;
+	std::sort(samples.begin(), samples.end());
+	size_t middle = samples.size() / 2;
+	return samples.size() % 2 ? samples[middle] : 0.5 * (samples[middle - 1] + samples[middle]);
+}
+
+// One-sided Mann-Whitney U test: the p-value of current's values tending to be larger
+// than baseline's by chance. Normal approximation with tie and continuity corrections,
+// which holds up from about five samples a side.
+double UMannWhitneyGreater(const std::vector<double>& current, const std::vector<double>& baseline)
+{
+	const size_t n1 = current.size();
+	const size_t n2 = baseline.size();
+	const double n = (double)(n1 + n2);
+
+	// rank everything together, ties share the average of their ranks
+	std::vector<std::pair<double, int>> values;
+	for (double value : current)
+		values.push_back(std::make_pair(value, 0));
+	for (double value : baseline)
+		values.push_back(std::make_pair(value, 1));
+	std::sort(values.begin(), values.end());
+
+	double rankSum = 0.0;		// of current
+	double tieTerm = 0.0;		// sum of t^3 - t over groups of t ties
+	for (size_t i = 0; i < values.size();)
+	{
+		size_t j = i;
+		while (j < values.size() && values[j].first == values[i].first)
+			++j;
+		const double rank = 0.5 * (i + 1 + j);
+		for (size_t k = i; k < j; ++k)
+			if (values[k].second == 0)
+				rankSum += rank;
+		const double t = (double)(j - i);
+		tieTerm += t * t * t - t;
+		i = j;
+	}
+
+	const double u = rankSum - n1 * (n1 + 1) / 2.0;
+	const double mean = n1 * n2 / 2.0;
+	const double variance = n1 * n2 / 12.0 * ((n + 1.0) - tieTerm / (n * (n - 1.0)));
+	if (variance <= 0.0)
+		return 1.0;		// every value the same
+	const double z = (u - mean - 0.5) / std::sqrt(variance);
+	return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+std::string UFormatValue(double value, const std::string& unit)
+{
+	std::ostringstream text;
+	text << std::fixed << std::setprecision(value < 10.0 ? 3 : value < 1000.0 ? 2 : 0) << value << " " << unit;
+	return text.str();
+}
@@ -0,0 +1,319 @@
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// Minimal PNG encoder for 8 bit RGB and RGBA images, so rendered frames can be saved
+// without another library. Each row gets the PNG filter that leaves the smallest
+// residuals (the usual heuristic) and the result is deflated with LZ77 matching and the
+// fixed Huffman codes. That's not as tight as zlib at its best but it's a single pass,
+// needs no tables to be built and gets most of the way there on rendered images.
+//
+// Stateless, so any number of threads can encode at once.
+class PngWriter
+{
+public:
+    // pixels are rows top to bottom, channels is 3 (RGB) or 4 (RGBA)
+    static void Encode(const unsigned char* pixels, int width, int height, int channels, std::vector<unsigned char>& out)
+    {
+        // filtered scanlines: a filter type byte in front of every row
+        const size_t rowSize = (size_t)width * channels;
+        std::vector<unsigned char> filtered((rowSize + 1) * height);
+        std::vector<unsigned char> candidate(rowSize);
+        for (int y = 0; y < height; ++y)
+        {
+            const unsigned char* row = pixels + y * rowSize;
+            const unsigned char* above = y > 0 ? row - rowSize : nullptr;
+            unsigned char* target = &filtered[y * (rowSize + 1)];
+
+            long bestCost = -1;
+            for (int type = 0; type < 5; ++type)
+            {
+                long cost = filterRow(type, row, above, rowSize, channels, candidate.data());
+                if (bestCost < 0 || cost < bestCost)
+                {
+                    bestCost = cost;
+                    target[0] = (unsigned char)type;
+                    memcpy(target + 1, candidate.data(), rowSize);
+                }
+            }
+        }
+
+        std::vector<unsigned char> compressed;
+        zlibCompress(filtered.data(), filtered.size(), compressed);
+
+        static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        out.assign(signature, signature + 8);
+
+        unsigned char header[13];
+        putBigEndian(header, (uint32_t)width);
+        putBigEndian(header + 4, (uint32_t)height);
+        header[8] = 8;                          // bits per channel
+        header[9] = channels == 4 ? 6 : 2;      // RGBA or RGB
+        header[10] = 0;                         // deflate
+        header[11] = 0;                         // adaptive filtering
+        header[12] = 0;                         // not interlaced
+        writeChunk(out, "IHDR", header, sizeof(header));
+        writeChunk(out, "IDAT", compressed.data(), compressed.size());
+        writeChunk(out, "IEND", nullptr, 0);
+    }
+
+    static bool Write(const char* path, const unsigned char* pixels, int width, int height, int channels)
+    {
+        std::vector<unsigned char> png;
+        Encode(pixels, width, height, channels, png);
+
+        std::ofstream file(path, std::ios::binary);
+        file.write((const char*)png.data(), png.size());
+        file.close();
+        return (bool)file;
+    }
+
+private:
+    static void putBigEndian(unsigned char* out, uint32_t value)
+    {
+        out[0] = (unsigned char)(value >> 24);
+        out[1] = (unsigned char)(value >> 16);
+        out[2] = (unsigned char)(value >> 8);
+        out[3] = (unsigned char)value;
+    }
+
+    static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size)
+    {
+        struct Table
+        {
+            uint32_t entries[256];
+            Table()
+            {
+                for (uint32_t i = 0; i < 256; ++i)
+                {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; ++k)
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    entries[i] = c;
+                }
+            }
+        };
+        static const Table table;      // built once, thread safe
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+            crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static void writeChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t size)
+    {
+        unsigned char length[4];
+        putBigEndian(length, (uint32_t)size);
+        out.insert(out.end(), length, length + 4);
+        size_t typeStart = out.size();
+        out.insert(out.end(), type, type + 4);
+        if (size > 0)
+            out.insert(out.end(), data, data + size);
+
+        unsigned char crc[4];
+        putBigEndian(crc, crc32(0, &out[typeStart], size + 4));
+        out.insert(out.end(), crc, crc + 4);
+    }
+
+    static unsigned char paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc)
+            return (unsigned char)a;
+        return (unsigned char)(pb <= pc ? b : c);
+    }
+
+    // filters a row with the given type and returns the sum of the residuals as signed bytes
+    static long filterRow(int type, const unsigned char* row, const unsigned char* above, size_t size, int bpp, unsigned char* out)
+    {
+        long cost = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            int left = i >= (size_t)bpp ? row[i - bpp] : 0;
+            int up = above ? above[i] : 0;
+            int upLeft = above && i >= (size_t)bpp ? above[i - bpp] : 0;
+            int predicted = 0;
+            switch (type)
+            {
+            case 1: predicted = left; break;
+            case 2: predicted = up; break;
+            case 3: predicted = (left + up) / 2; break;
+            case 4: predicted = paeth(left, up, upLeft); break;
+            default: break;
+            }
+            out[i] = (unsigned char)(row[i] - predicted);
+            cost += out[i] < 128 ? out[i] : 256 - out[i];
+        }
+        return cost;
+    }
+
+    // LSB first bit packing, the way deflate wants it
+    struct BitWriter
+    {
+        std::vector<unsigned char>& out;
+        uint32_t buffer;
+        int count;
+
+        explicit BitWriter(std::vector<unsigned char>& target) : out(target), buffer(0), count(0) {}
+
+        void Bits(uint32_t value, int bits)
+        {
+            buffer |= value << count;
+            count += bits;
+            while (count >= 8)
+            {
+                out.push_back((unsigned char)buffer);
+                buffer >>= 8;
+                count -= 8;
+            }
+        }
+
+        // Huffman codes go in most significant bit first
+        void Code(uint32_t code, int bits)
+        {
+            uint32_t reversed = 0;
+            for (int i = 0; i < bits; ++i)
+                reversed |= ((code >> i) & 1) << (bits - 1 - i);
+            Bits(reversed, bits);
+        }
+
+        void Flush()
+        {
+            if (count > 0)
+                out.push_back((unsigned char)buffer);
+            buffer = 0;
+            count = 0;
+        }
+    };
+
+    // the fixed literal/length code of RFC 1951 3.2.6
+    static void writeSymbol(BitWriter& bits, int symbol)
+    {
+        if (symbol < 144)
+            bits.Code(0x30 + symbol, 8);
+        else if (symbol < 256)
+            bits.Code(0x190 + symbol - 144, 9);
+        else if (symbol < 280)
+            bits.Code(symbol - 256, 7);
+        else
+            bits.Code(0xC0 + symbol - 280, 8);
+    }
+
+    static void writeMatch(BitWriter& bits, int length, int distance)
+    {
+        static const int LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const int LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const int DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+            4097, 6145, 8193, 12289, 16385, 24577 };
+        static const int DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+        int l = 28;
+        while (LENGTH_BASE[l] > length)
+            --l;
+        writeSymbol(bits, 257 + l);
+        bits.Bits(length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+
+        int d = 29;
+        while (DISTANCE_BASE[d] > distance)
+            --d;
+        bits.Code(d, 5);
+        bits.Bits(distance - DISTANCE_BASE[d], DISTANCE_EXTRA[d]);
+    }
+
+    // zlib stream holding one fixed Huffman deflate block. Matches are found through a
+    // hash of the next three bytes, following a short chain of earlier positions.
+    static void zlibCompress(const unsigned char* data, size_t size, std::vector<unsigned char>& out)
+    {
+        const int WINDOW = 32768;
+        const int MIN_MATCH = 3;
+        const int MAX_MATCH = 258;
+        const int MAX_CHAIN = 16;
+        const int HASH_BITS = 15;
+
+        out.clear();
+        out.push_back(0x78);    // deflate, 32K window
+        out.push_back(0x01);    // no dictionary, fastest level, header checksum
+
+        BitWriter bits(out);
+        bits.Bits(1, 1);        // last block
+        bits.Bits(1, 2);        // fixed Huffman codes
+
+        std::vector<int> head(1 << HASH_BITS, -1);
+        std::vector<int> previous(WINDOW, -1);
+        auto hashAt = [&](size_t i)
+        {
+            return (int)(((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & ((1 << HASH_BITS) - 1));
+        };
+        auto insert = [&](size_t i)
+        {
+            if (i + MIN_MATCH > size)
+                return;
+            int hash = hashAt(i);
+            previous[i % WINDOW] = head[hash];
+            head[hash] = (int)i;
+        };
+
+        size_t i = 0;
+        while (i < size)
+        {
+            int bestLength = 0, bestDistance = 0;
+            if (i + MIN_MATCH <= size)
+            {
+                int candidate = head[hashAt(i)];
+                int maxLength = (int)std::min((size_t)MAX_MATCH, size - i);
+                for (int chain = 0; chain < MAX_CHAIN && candidate >= 0 && (int)i - candidate <= WINDOW; ++chain)
+                {
+                    int length = 0;
+                    while (length < maxLength && data[candidate + length] == data[i + length])
+                        ++length;
+                    if (length > bestLength)
+                    {
+                        bestLength = length;
+                        bestDistance = (int)i - candidate;
+                        if (length == maxLength)
+                            break;
+                    }
+                    int next = previous[candidate % WINDOW];
+                    if (next >= candidate)
+                        break;      // the slot was reused for a newer position
+                    candidate = next;
+                }
+            }
+
+            if (bestLength >= MIN_MATCH)
+            {
+                writeMatch(bits, bestLength, bestDistance);
+                for (int k = 0; k < bestLength; ++k)
+                    insert(i + k);
+                i += bestLength;
+            }
+            else
+            {
+                writeSymbol(bits, data[i]);
+                insert(i);
+                ++i;
+            }
+        }
+        writeSymbol(bits, 256);     // end of block
+        bits.Flush();
+
+        // Adler-32 of the uncompressed data
+        uint32_t a = 1, b = 0;
+        for (size_t k = 0; k < size; ++k)
+        {
+            a = (a + data[k]) % 65521;
+            b = (b + a) % 65521;
+        }
+        unsigned char adler[4];
+        putBigEndian(adler, (b << 16) | a);
+        out.insert(out.end(), adler, adler + 4);
+    }
+};
+#endif
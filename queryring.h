@@ -0,0 +1,78 @@
+#ifndef QUERYRING_H
+#define QUERYRING_H
+
+#include <vector>
+
+// A ring of GL query objects so query results can be read back a few frames
+// late instead of stalling the pipeline waiting for the GPU to catch up.
+// One Begin/End pair per frame; Poll hands back finished results oldest first.
+class QueryRing
+{
+public:
+    QueryRing() : target(0), next(0), pending(0)
+    {
+    }
+
+    // target is the query type, e.g. GL_TIME_ELAPSED or GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+    void Create(GLenum queryTarget, int size = 4)
+    {
+        Destroy();
+        target = queryTarget;
+        queries.resize(size);
+        glGenQueries(size, queries.data());
+        next = 0;
+        pending = 0;
+    }
+
+    void Destroy()
+    {
+        if (!queries.empty())
+            glDeleteQueries((GLsizei)queries.size(), queries.data());
+        queries.clear();
+        pending = 0;
+    }
+
+    bool IsCreated() const
+    {
+        return !queries.empty();
+    }
+
+    void Begin()
+    {
+        // if nobody read the oldest result in time it gets overwritten
+        if (pending == (int)queries.size())
+            --pending;
+        glBeginQuery(target, queries[next]);
+    }
+
+    void End()
+    {
+        glEndQuery(target);
+        next = (next + 1) % (int)queries.size();
+        ++pending;
+    }
+
+    // returns true and the result of the oldest query if the GPU has finished it
+    bool Poll(GLuint64& result)
+    {
+        if (pending == 0)
+            return false;
+
+        int oldest = (next - pending + (int)queries.size()) % (int)queries.size();
+        GLint available = 0;
+        glGetQueryObjectiv(queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+
+        glGetQueryObjectui64v(queries[oldest], GL_QUERY_RESULT, &result);
+        --pending;
+        return true;
+    }
+
+private:
+    GLenum target;
+    std::vector<GLuint> queries;
+    int next;
+    int pending;
+};
+#endif
@@ -0,0 +1,116 @@
+#ifndef RENDERTARGET_H
+#define RENDERTARGET_H
+
+#include "gpumemory.h"
+
+#include <iostream>
+
+// Offscreen framebuffer with a color texture and a depth texture. The scene can be
+// drawn into it (with a depth format the default framebuffer doesn't offer) and then
+// blitted to the window.
+class RenderTarget
+{
+public:
+    RenderTarget() : fbo(0), colorTexture(0), depthTexture(0), width(0), height(0),
+        colorFormat(GL_RGBA8), depthFormat(GL_DEPTH_COMPONENT32F), owner("render target")
+    {
+    }
+
+    // what the attachments are listed as in the GPU memory accounting
+    void SetOwner(const char* name)
+    {
+        owner = name;
+    }
+
+    // chooses the attachment formats. Takes effect the next time the target is (re)created.
+    void SetFormats(GLenum color, GLenum depth)
+    {
+        colorFormat = color;
+        depthFormat = depth;
+    }
+
+    // makes sure the attachments are the given size, recreating them if they aren't
+    void Resize(int newWidth, int newHeight)
+    {
+        if (fbo != 0 && newWidth == width && newHeight == height)
+            return;
+
+        Destroy();
+        width = newWidth;
+        height = newHeight;
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+        glGenTextures(1, &colorTexture);
+        glBindTexture(GL_TEXTURE_2D, colorTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, colorFormat, width, height);
+        GpuMemory::Get().TrackTexture(colorTexture, GpuMemory::RENDER_TARGET, owner, colorFormat, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, depthFormat, width, height);
+        GpuMemory::Get().TrackTexture(depthTexture, GpuMemory::RENDER_TARGET, owner, depthFormat, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: Render target is not complete" << std::endl;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void Bind() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    }
+
+    // copies the color of the bottom left sourceWidth x sourceHeight region into the window,
+    // or into destination if it isn't 0, and leaves that bound
+    void BlitToDefault(int sourceWidth, int sourceHeight, int windowWidth, int windowHeight, GLenum filter = GL_NEAREST, GLuint destination = 0) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, destination);
+        glBlitFramebuffer(0, 0, sourceWidth, sourceHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, filter);
+        glBindFramebuffer(GL_FRAMEBUFFER, destination);
+    }
+
+    void Destroy()
+    {
+        if (fbo == 0)
+            return;
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteTextures(1, &colorTexture);
+        glDeleteTextures(1, &depthTexture);
+        GpuMemory::Get().ReleaseTexture(colorTexture);
+        GpuMemory::Get().ReleaseTexture(depthTexture);
+        fbo = 0;
+        colorTexture = 0;
+        depthTexture = 0;
+    }
+
+    GLuint Framebuffer() const { return fbo; }
+    GLuint ColorTexture() const { return colorTexture; }
+    GLuint DepthTexture() const { return depthTexture; }
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+private:
+    GLuint fbo;
+    GLuint colorTexture;
+    GLuint depthTexture;
+    int width;
+    int height;
+    GLenum colorFormat;
+    GLenum depthFormat;
+    const char* owner;
+};
+#endif
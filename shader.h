@@ -4,11 +4,36 @@
 //#include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "drawstats.h"
+
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+// A uniform's name as the hash Shader looks its location up by. From a literal the hash
+// can be worked out at compile time (a constexpr UniformName always is), and either way
+// nothing is allocated or asked of the driver.
+struct UniformName
+{
+    constexpr UniformName(const char* name) : hash(Hash(name)) {}
+    UniformName(const std::string& name) : hash(Hash(name.c_str())) {}
+
+    // 32 bit FNV-1a
+    static constexpr uint32_t Hash(const char* text)
+    {
+        uint32_t hash = 2166136261u;
+        for (; *text != '\0'; ++text)
+            hash = (hash ^ (unsigned char)*text) * 16777619u;
+        return hash;
+    }
+
+    uint32_t hash;
+};
+
 class Shader
 {
 public:
@@ -72,7 +97,7 @@ public:
         glCompileShader(fragment);
         checkCompileErrors(fragment, "FRAGMENT");
         // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
+        unsigned int geometry = 0;
         if (geometryPath != nullptr)
         {
             const char* gShaderCode = geometryCode.c_str();
@@ -89,6 +114,7 @@ public:
             glAttachShader(ID, geometry);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        reflectUniforms();
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
@@ -101,67 +127,189 @@ public:
     void use()
     {
         glUseProgram(ID);
+        DrawStats::Get().Add(DrawStats::PROGRAM_BINDS);
+    }
+    // the location of an active uniform, -1 (which the setters ignore) for anything else.
+    // Look it up once and set by location where the same uniform is set over and over.
+    GLint Location(UniformName name) const
+    {
+        std::vector<UniformSlot>::const_iterator slot = std::lower_bound(uniforms.begin(), uniforms.end(), name.hash,
+            [](const UniformSlot& entry, uint32_t hash) { return entry.hash < hash; });
+        return slot != uniforms.end() && slot->hash == name.hash ? slot->location : -1;
     }
-    // utility uniform functions
+    // utility uniform functions, by name or by location
     // ------------------------------------------------------------------------
-    void setBool(const std::string& name, bool value) const
+    void setBool(UniformName name, bool value) const
+    {
+        setBool(Location(name), value);
+    }
+    void setBool(GLint location, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1i(location, (int)value);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string& name, int value) const
+    void setInt(UniformName name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        setInt(Location(name), value);
+    }
+    void setInt(GLint location, int value) const
+    {
+        glUniform1i(location, value);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string& name, float value) const
+    void setFloat(UniformName name, float value) const
+    {
+        setFloat(Location(name), value);
+    }
+    void setFloat(GLint location, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(location, value);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string& name, const glm::vec2& value) const
+    void setVec2(UniformName name, const glm::vec2& value) const
+    {
+        setVec2(Location(name), value);
+    }
+    void setVec2(GLint location, const glm::vec2& value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform2fv(location, 1, &value[0]);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
     }
-    void setVec2(const std::string& name, float x, float y) const
+    void setVec2(UniformName name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        setVec2(Location(name), x, y);
+    }
+    void setVec2(GLint location, float x, float y) const
+    {
+        glUniform2f(location, x, y);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string& name, const glm::vec3& value) const
+    void setVec3(UniformName name, const glm::vec3& value) const
+    {
+        setVec3(Location(name), value);
+    }
+    void setVec3(GLint location, const glm::vec3& value) const
+    {
+        glUniform3fv(location, 1, &value[0]);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
+    }
+    void setVec3(UniformName name, float x, float y, float z) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec3(Location(name), x, y, z);
     }
-    void setVec3(const std::string& name, float x, float y, float z) const
+    void setVec3(GLint location, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3f(location, x, y, z);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string& name, const glm::vec4& value) const
+    void setVec4(UniformName name, const glm::vec4& value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        setVec4(Location(name), value);
     }
-    void setVec4(const std::string& name, float x, float y, float z, float w)
+    void setVec4(GLint location, const glm::vec4& value) const
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4fv(location, 1, &value[0]);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
+    }
+    void setVec4(UniformName name, float x, float y, float z, float w) const
+    {
+        setVec4(Location(name), x, y, z, w);
+    }
+    void setVec4(GLint location, float x, float y, float z, float w) const
+    {
+        glUniform4f(location, x, y, z, w);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string& name, const glm::mat2& mat) const
+    void setMat2(UniformName name, const glm::mat2& mat) const
+    {
+        setMat2(Location(name), mat);
+    }
+    void setMat2(GLint location, const glm::mat2& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string& name, const glm::mat3& mat) const
+    void setMat3(UniformName name, const glm::mat3& mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat3(Location(name), mat);
+    }
+    void setMat3(GLint location, const glm::mat3& mat) const
+    {
+        glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string& name, const glm::mat4& mat) const
+    void setMat4(UniformName name, const glm::mat4& mat) const
+    {
+        setMat4(Location(name), mat);
+    }
+    void setMat4(GLint location, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+        DrawStats::Get().Add(DrawStats::UNIFORM_UPLOADS);
     }
 
 private:
+    struct UniformSlot
+    {
+        uint32_t hash;      // UniformName::Hash of the name
+        GLint location;
+    };
+
+    // Lists every active uniform with its location, sorted by hash for Location(). Arrays
+    // come back as their first element, "lights[0]"; the bare name and the other elements
+    // get entries too. Members of uniform blocks have no location and are left out.
+    void reflectUniforms()
+    {
+        std::vector<std::pair<std::string, GLint>> active;
+        GLint count = 0, maxLength = 0;
+        glGetProgramInterfaceiv(ID, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+        glGetProgramInterfaceiv(ID, GL_UNIFORM, GL_MAX_NAME_LENGTH, &maxLength);
+        std::vector<GLchar> nameBuffer(std::max(maxLength, 1));
+        const GLenum properties[] = { GL_LOCATION, GL_ARRAY_SIZE };
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint values[2] = { -1, 1 };
+            glGetProgramResourceiv(ID, GL_UNIFORM, i, 2, properties, 2, NULL, values);
+            if (values[0] < 0)
+                continue;
+            glGetProgramResourceName(ID, GL_UNIFORM, i, (GLsizei)nameBuffer.size(), NULL, nameBuffer.data());
+            const std::string name = nameBuffer.data();
+            active.push_back(std::make_pair(name, values[0]));
+
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                const std::string base = name.substr(0, name.size() - 3);
+                active.push_back(std::make_pair(base, values[0]));
+                for (GLint element = 1; element < values[1]; ++element)
+                {
+                    const std::string elementName = base + "[" + std::to_string(element) + "]";
+                    active.push_back(std::make_pair(elementName, glGetUniformLocation(ID, elementName.c_str())));
+                }
+            }
+        }
+
+        uniforms.clear();
+        for (const std::pair<std::string, GLint>& uniform : active)
+        {
+            UniformSlot slot = { UniformName::Hash(uniform.first.c_str()), uniform.second };
+            uniforms.push_back(slot);
+        }
+        std::sort(uniforms.begin(), uniforms.end(), [](const UniformSlot& a, const UniformSlot& b) { return a.hash < b.hash; });
+        for (size_t i = 1; i < uniforms.size(); ++i)
+            if (uniforms[i].hash == uniforms[i - 1].hash)
+                std::cout << "ERROR::SHADER::UNIFORM_NAME_HASH_COLLISION at location " << uniforms[i].location << std::endl;
+    }
+
+    std::vector<UniformSlot> uniforms;      // sorted by hash
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,245 @@
+#ifndef SHADOWCASCADES_H
+#define SHADOWCASCADES_H
+
+#include "drawstats.h"
+#include "gpumemory.h"
+#include "shader.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <iostream>
+#include <string>
+
+// Cascaded shadow maps for a directional light that never moves, built so a frame
+// where nothing changed costs next to nothing.
+//
+// Each cascade is a light space box of fixed size around the camera, snapped to whole
+// shadow map texels so it only moves when the camera has moved a full texel. Static
+// casters are drawn into a cached layer that is only redrawn when the box moves or the
+// scene changes, and a cascade that needs redrawing waits for its turn in a staggered
+// schedule (the near cascade every frame, the next every 2nd, the far one every 4th).
+// A cascade that's out of date keeps its old matrix along with its old map, so the pair
+// stays consistent; the shader picks the first cascade whose box holds the fragment.
+//
+// Things that move can't be cached. When there are any, the cached layer is copied into
+// a composite layer each frame and they're drawn on top of that, so the static part is
+// still never redrawn.
+//
+// Layout of the depth array texture: layers 0..CASCADES-1 hold the cached static
+// depth, CASCADES..2*CASCADES-1 the composites.
+class ShadowCascades
+{
+public:
+    static const int CASCADES = 3;
+
+    ShadowCascades() : texture(0), fbo(0), size(0), reverseDepth(false), updateIndex(0), staticRenders(0)
+    {
+        for (int i = 0; i < CASCADES; ++i)
+        {
+            cascades[i].valid = false;
+            cascades[i].needsStatic = false;
+            cascades[i].hasDynamic = false;
+            sampledLayers[i] = i;
+        }
+    }
+
+    // mapSize is the width and height of each layer. With reverseDepth the maps use
+    // [0, 1] depth with 1 nearest the light, to match glClipControl(..., GL_ZERO_TO_ONE).
+    void Create(int mapSize, bool reverse)
+    {
+        Destroy();
+        size = mapSize;
+        reverseDepth = reverse;
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, size, size, CASCADES * 2);
+        GpuMemory::Get().TrackTexture(texture, GpuMemory::SHADOW_MAP, "shadow cascades", GL_DEPTH_COMPONENT32F, size, size, CASCADES * 2);
+        // linear filtering on a comparison sampler gives 2x2 PCF for free
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, reverseDepth ? GL_GEQUAL : GL_LEQUAL);
+
+        glGenFramebuffers(1, &fbo);
+        for (int i = 0; i < CASCADES; ++i)
+            cascades[i].valid = false;
+    }
+
+    // throws the cached static depth away, so every cascade is redrawn by the next
+    // Update instead of over several frames. For when the view jumps somewhere new.
+    void Invalidate()
+    {
+        for (int i = 0; i < CASCADES; ++i)
+            cascades[i].valid = false;
+    }
+
+    void Destroy()
+    {
+        if (texture == 0)
+            return;
+        glDeleteTextures(1, &texture);
+        glDeleteFramebuffers(1, &fbo);
+        GpuMemory::Get().ReleaseTexture(texture);
+        texture = 0;
+        fbo = 0;
+    }
+
+    // Works out where each cascade should be this frame and which cascades have to
+    // redraw their static layer. lightDirection points towards the light, focus is
+    // where the cascades are centered (the camera) and forward the way it looks.
+    void Update(const glm::vec3& lightDirection, const glm::vec3& focus, const glm::vec3& forward, unsigned int sceneVersion)
+    {
+        static const float HALF_SIZES[CASCADES] = { 5.0f, 12.0f, 30.0f };
+        static const int STAGGER[CASCADES] = { 1, 2, 4 };
+        static const float DEPTH_RANGE = 60.0f;    // light space depth either side of the origin
+
+        glm::vec3 direction = glm::normalize(lightDirection);
+        glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        lightView = glm::lookAt(direction, glm::vec3(0.0f), up);
+
+        ++updateIndex;
+        for (int i = 0; i < CASCADES; ++i)
+        {
+            Cascade& cascade = cascades[i];
+            float halfSize = HALF_SIZES[i];
+
+            // center a bit ahead of the camera so the box covers more of what's visible
+            glm::vec3 center = glm::vec3(lightView * glm::vec4(focus + forward * halfSize * 0.5f, 1.0f));
+            float texel = 2.0f * halfSize / size;
+            float x = std::floor(center.x / texel) * texel;
+            float y = std::floor(center.y / texel) * texel;
+
+            bool moved = !cascade.valid || x != cascade.x || y != cascade.y || sceneVersion != cascade.sceneVersion;
+            bool due = (updateIndex + i) % STAGGER[i] == 0;
+            cascade.needsStatic = moved && (due || !cascade.valid);
+            if (!cascade.needsStatic)
+                continue;
+
+            glm::mat4 projection;
+            if (reverseDepth)
+                projection = reverseOrtho(x - halfSize, x + halfSize, y - halfSize, y + halfSize, -DEPTH_RANGE, DEPTH_RANGE);
+            else
+                projection = glm::ortho(x - halfSize, x + halfSize, y - halfSize, y + halfSize, -DEPTH_RANGE, DEPTH_RANGE);
+
+            cascade.x = x;
+            cascade.y = y;
+            cascade.sceneVersion = sceneVersion;
+            cascade.viewProjection = projection * lightView;
+            cascade.valid = true;
+        }
+    }
+
+    bool NeedsStatic(int cascade) const { return cascades[cascade].needsStatic; }
+    const glm::mat4& ViewProjection(int cascade) const { return cascades[cascade].viewProjection; }
+
+    // how many times a static layer has been redrawn, to check the cache is doing its job
+    long StaticRenders() const { return staticRenders; }
+
+    // binds the cascade's cached layer as the depth target and clears it
+    void BeginStatic(int cascade)
+    {
+        bindLayer(cascade);
+        clear();
+        cascades[cascade].hasDynamic = false;
+        ++staticRenders;
+    }
+
+    // starts this frame's composite for the cascade: a copy of the cached layer that
+    // moving casters can then be drawn into
+    void BeginDynamic(int cascade)
+    {
+        glCopyImageSubData(texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade,
+            texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, CASCADES + cascade, size, size, 1);
+        bindLayer(CASCADES + cascade);
+        cascades[cascade].hasDynamic = true;
+    }
+
+    // the composite is only sampled on frames it was drawn
+    void EndFrame()
+    {
+        for (int i = 0; i < CASCADES; ++i)
+        {
+            sampledLayers[i] = cascades[i].hasDynamic ? CASCADES + i : i;
+            cascades[i].hasDynamic = false;
+        }
+    }
+
+    // binds the shadow maps to the unit and sets the matrices and layers to sample
+    void SetUniforms(const Shader& shader, GLuint unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glActiveTexture(GL_TEXTURE0);
+        DrawStats::Get().Add(DrawStats::TEXTURE_BINDS);
+
+        static constexpr UniformName MATRICES[CASCADES] = { "shadowMatrices[0]", "shadowMatrices[1]", "shadowMatrices[2]" };
+        static constexpr UniformName LAYERS[CASCADES] = { "shadowLayers[0]", "shadowLayers[1]", "shadowLayers[2]" };
+        shader.setBool("shadowDepthZeroToOne", reverseDepth);
+        for (int i = 0; i < CASCADES; ++i)
+        {
+            shader.setMat4(MATRICES[i], cascades[i].viewProjection);
+            shader.setInt(LAYERS[i], sampledLayers[i]);
+        }
+    }
+
+    int Size() const { return size; }
+    bool ReverseDepth() const { return reverseDepth; }
+
+private:
+    struct Cascade
+    {
+        glm::mat4 viewProjection;
+        float x, y;                 // snapped light space center
+        unsigned int sceneVersion;
+        bool valid;
+        bool needsStatic;
+        bool hasDynamic;
+    };
+
+    void bindLayer(int layer) const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: Shadow map layer " << layer << " is not complete" << std::endl;
+        glViewport(0, 0, size, size);
+    }
+
+    void clear() const
+    {
+        glDepthMask(GL_TRUE);
+        glClearDepth(reverseDepth ? 0.0 : 1.0);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    // orthographic projection with [0, 1] depth, 1 at zNear
+    static glm::mat4 reverseOrtho(float left, float right, float bottom, float top, float zNear, float zFar)
+    {
+        glm::mat4 projection(1.0f);
+        projection[0][0] = 2.0f / (right - left);
+        projection[1][1] = 2.0f / (top - bottom);
+        projection[2][2] = 1.0f / (zFar - zNear);
+        projection[3][0] = -(right + left) / (right - left);
+        projection[3][1] = -(top + bottom) / (top - bottom);
+        projection[3][2] = zFar / (zFar - zNear);
+        return projection;
+    }
+
+    GLuint texture;
+    GLuint fbo;
+    int size;
+    bool reverseDepth;
+    glm::mat4 lightView;
+    long updateIndex;
+    long staticRenders;
+    Cascade cascades[CASCADES];
+    int sampledLayers[CASCADES];
+};
+#endif
@@ -0,0 +1,90 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// The producer only ever writes tail and the consumer only ever writes head, so the
+// two sides never contend on the same index. One slot is kept empty to tell a full
+// ring from an empty one.
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1), head(0), tail(0)
+    {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer side. Returns false without blocking if the queue is full.
+    bool TryPush(const T& value)
+    {
+        const size_t currentTail = tail.load(std::memory_order_relaxed);
+        const size_t nextTail = increment(currentTail);
+        if (nextTail == head.load(std::memory_order_acquire))
+            return false;
+
+        slots[currentTail] = value;
+        tail.store(nextTail, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side. Returns false without blocking if the queue is empty.
+    bool TryPop(T& value)
+    {
+        const size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire))
+            return false;
+
+        value = slots[currentHead];
+        head.store(increment(currentHead), std::memory_order_release);
+        return true;
+    }
+
+    // blocking versions. They spin briefly, then yield, then sleep so a side that
+    // is waiting on the other one doesn't burn a whole core.
+    void Push(const T& value)
+    {
+        for (unsigned int attempt = 0; !TryPush(value); ++attempt)
+            backoff(attempt);
+    }
+
+    void Pop(T& value)
+    {
+        for (unsigned int attempt = 0; !TryPop(value); ++attempt)
+            backoff(attempt);
+    }
+
+    size_t Capacity() const
+    {
+        return slots.size() - 1;
+    }
+
+private:
+    size_t increment(size_t index) const
+    {
+        return (index + 1) == slots.size() ? 0 : index + 1;
+    }
+
+    static void backoff(unsigned int attempt)
+    {
+        if (attempt < 64)
+            return;
+        if (attempt < 128)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    std::vector<T> slots;
+    // keep the two indices on separate cache lines so the threads don't false-share
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+#endif
@@ -0,0 +1,25 @@
+#version 440 core
+
+// Writes each pixel's material as its depth, so the resolve passes can use an
+// EQUAL depth test to run only on their own material's pixels.
+
+struct DrawInfo {
+    uint firstVertex;
+    uint materialId;
+    uint pad0;
+    uint pad1;
+};
+
+layout (std430, binding = 1) readonly buffer DrawInfos { DrawInfo drawInfos[]; };
+
+uniform usampler2D visibility;
+
+void main()
+{
+    uvec2 id = texelFetch(visibility, ivec2(gl_FragCoord.xy), 0).xy;
+    if (id.x == 0u)
+        discard;
+
+    // has to match VisibilityBuffer::MaterialDepth in visibilitybuffer.h
+    gl_FragDepth = float(drawInfos[id.x - 1u].materialId + 1u) / 1024.0;
+}
@@ -0,0 +1,11 @@
+#version 440 core
+
+// draw id + 1 (0 means nothing was drawn here), triangle within the draw
+layout (location = 0) out uvec2 VisibilityId;
+
+uniform int drawId;
+
+void main()
+{
+    VisibilityId = uvec2(uint(drawId) + 1u, uint(gl_PrimitiveID));
+}
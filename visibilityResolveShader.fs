@@ -0,0 +1,112 @@
+#version 440 core
+
+// Shades one material's pixels of the visibility buffer. The triangle is fetched from
+// the vertex storage buffer by id, its attributes are interpolated with perspective
+// correct barycentrics worked out from the pixel position, and the texture gradients
+// come from the barycentrics one pixel over, since neighboring pixels can belong to
+// other triangles.
+
+out vec4 FragColor;
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+
+struct Light {
+    vec3 position;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct DrawInfo {
+    uint firstVertex;
+    uint materialId;
+    uint pad0;
+    uint pad1;
+};
+
+// interleaved position, normal, uv: 8 floats per vertex, same as the mesh VBOs
+layout (std430, binding = 0) readonly buffer Vertices { float vertices[]; };
+layout (std430, binding = 1) readonly buffer DrawInfos { DrawInfo drawInfos[]; };
+
+uniform usampler2D visibility;
+uniform mat4 viewProjection;
+uniform vec2 screenSize;
+uniform vec3 viewPos;
+uniform Material material;
+uniform Light light;
+
+vec3 vertexVec3(uint vertex, uint offset)
+{
+    uint base = vertex * 8u + offset;
+    return vec3(vertices[base], vertices[base + 1u], vertices[base + 2u]);
+}
+
+vec2 vertexVec2(uint vertex, uint offset)
+{
+    uint base = vertex * 8u + offset;
+    return vec2(vertices[base], vertices[base + 1u]);
+}
+
+// perspective correct barycentrics of the point at ndc inside the clip space triangle
+vec3 barycentrics(vec4 c0, vec4 c1, vec4 c2, vec2 ndc)
+{
+    vec3 invW = 1.0 / vec3(c0.w, c1.w, c2.w);
+    vec2 p0 = c0.xy * invW.x;
+    vec2 p1 = c1.xy * invW.y;
+    vec2 p2 = c2.xy * invW.z;
+
+    // screen space barycentrics, then undo the perspective divide
+    float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+    float b1 = ((ndc.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (ndc.y - p0.y)) / area;
+    float b2 = ((p1.x - p0.x) * (ndc.y - p0.y) - (ndc.x - p0.x) * (p1.y - p0.y)) / area;
+    vec3 screen = vec3(1.0 - b1 - b2, b1, b2);
+
+    vec3 perspective = screen * invW;
+    return perspective / (perspective.x + perspective.y + perspective.z);
+}
+
+void main()
+{
+    uvec2 id = texelFetch(visibility, ivec2(gl_FragCoord.xy), 0).xy;
+    uint vertex = drawInfos[id.x - 1u].firstVertex + id.y * 3u;
+
+    // static geometry is already in world space
+    vec3 p0 = vertexVec3(vertex, 0u);
+    vec3 p1 = vertexVec3(vertex + 1u, 0u);
+    vec3 p2 = vertexVec3(vertex + 2u, 0u);
+    vec4 c0 = viewProjection * vec4(p0, 1.0);
+    vec4 c1 = viewProjection * vec4(p1, 1.0);
+    vec4 c2 = viewProjection * vec4(p2, 1.0);
+
+    vec2 ndc = gl_FragCoord.xy / screenSize * 2.0 - 1.0;
+    vec2 pixel = 2.0 / screenSize;
+    vec3 b = barycentrics(c0, c1, c2, ndc);
+    vec3 bx = barycentrics(c0, c1, c2, ndc + vec2(pixel.x, 0.0));
+    vec3 by = barycentrics(c0, c1, c2, ndc + vec2(0.0, pixel.y));
+
+    vec3 fragPos = b.x * p0 + b.y * p1 + b.z * p2;
+    vec3 normal = normalize(b.x * vertexVec3(vertex, 3u) + b.y * vertexVec3(vertex + 1u, 3u) + b.z * vertexVec3(vertex + 2u, 3u));
+    mat3x2 uvs = mat3x2(vertexVec2(vertex, 6u), vertexVec2(vertex + 1u, 6u), vertexVec2(vertex + 2u, 6u));
+    vec2 uv = uvs * b;
+    vec2 uvDx = uvs * bx - uv;
+    vec2 uvDy = uvs * by - uv;
+
+    vec3 diffuseColor = textureGrad(material.diffuse, uv, uvDx, uvDy).rgb;
+    vec3 specularColor = textureGrad(material.specular, uv, uvDx, uvDy).rgb;
+
+    // same Phong model as objectFragmentShader.fs
+    vec3 viewDir = normalize(viewPos - fragPos);
+    vec3 lightDir = normalize(light.position);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
+    FragColor = vec4(ambient + diffuse + specular, 1.0);
+}
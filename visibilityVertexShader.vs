@@ -0,0 +1,15 @@
+#version 440 core
+
+layout (location = 0) in vec3 aPosition;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// the resolve pass rebuilds the triangle from the same matrices and has to agree with this
+invariant gl_Position;
+
+void main()
+{
+	gl_Position = projection * view * model * vec4(aPosition, 1.0);
+}
@@ -0,0 +1,214 @@
+#ifndef VISIBILITYBUFFER_H
+#define VISIBILITYBUFFER_H
+
+#include "drawlist.h"
+#include "drawstats.h"
+#include "gpumemory.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Targets and buffers for visibility buffer rendering. The geometry pass only writes
+// which triangle covers each pixel (draw id + 1 and primitive id, RG32UI) and depth.
+// A classify pass turns each pixel's material into a depth value in a second depth
+// buffer, then one full-screen resolve per material runs with an EQUAL depth test, so
+// early depth testing limits it to that material's pixels and every pixel is shaded
+// exactly once, whatever the overdraw, with no partially covered 2x2 quads.
+//
+// The resolve shaders fetch triangles themselves, so the static geometry is also kept
+// in one storage buffer (binding 0) next to a per-draw table (binding 1).
+class VisibilityBuffer
+{
+public:
+    VisibilityBuffer() : idFbo(0), materialFbo(0), sceneFbo(0), idTexture(0), depthTexture(0),
+        colorTexture(0), materialDepthTexture(0), width(0), height(0), vertexBuffer(0), drawBuffer(0)
+    {
+    }
+
+    // The material depth buffer clears to 1, so only materials below this get a depth of
+    // their own. The resolve skips the rest.
+    static const int MAX_MATERIALS = 1023;
+
+    // Window depth the classify pass writes for a material, (material + 1) / 1024, which a
+    // float holds exactly. visibilityClassifyShader.fs encodes it the same way.
+    static float MaterialDepth(size_t material)
+    {
+        return (float)(material + 1) / (float)(MAX_MATERIALS + 1);
+    }
+
+    // makes sure the attachments are the given size, recreating them if they aren't
+    void Resize(int newWidth, int newHeight)
+    {
+        if (idFbo != 0 && newWidth == width && newHeight == height)
+            return;
+
+        DestroyTargets();
+        width = newWidth;
+        height = newHeight;
+
+        idTexture = createTexture(GL_RG32UI);
+        depthTexture = createTexture(GL_DEPTH_COMPONENT32F);
+        colorTexture = createTexture(GL_RGBA8);
+        materialDepthTexture = createTexture(GL_DEPTH_COMPONENT32F);
+
+        idFbo = createFramebuffer(idTexture, depthTexture, "Visibility buffer");
+        materialFbo = createFramebuffer(colorTexture, materialDepthTexture, "Material target");
+        // same color as the material target but the scene's depth, for forward drawn extras
+        sceneFbo = createFramebuffer(colorTexture, depthTexture, "Visibility scene target");
+    }
+
+    // Gathers the vertices of every recorded draw into the vertex storage buffer and
+    // fills in the per-draw table. Call again whenever the draw list is re-recorded.
+    void BuildGeometry(const DrawList& draws)
+    {
+        const GLsizeiptr vertexSize = 8 * sizeof(float);
+        const std::vector<DrawCommand>& commands = draws.Commands();
+
+        GLsizeiptr totalSize = 0;
+        for (const DrawCommand& command : commands)
+            totalSize += command.count * vertexSize;
+
+        if (vertexBuffer == 0)
+        {
+            glGenBuffers(1, &vertexBuffer);
+            glGenBuffers(1, &drawBuffer);
+        }
+
+        // copied buffer to buffer, the vertex data never comes back to the CPU
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, std::max(totalSize, vertexSize), NULL, GL_STATIC_DRAW);
+        GpuMemory::Get().TrackBuffer(vertexBuffer, GpuMemory::STORAGE_BUFFER, "visibility buffer vertices", std::max(totalSize, vertexSize));
+
+        std::vector<DrawInfo> infos(commands.size());
+        GLsizeiptr offset = 0;
+        for (size_t i = 0; i < commands.size(); ++i)
+        {
+            const DrawCommand& command = commands[i];
+            glBindBuffer(GL_COPY_READ_BUFFER, command.vbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, command.first * vertexSize, offset, command.count * vertexSize);
+
+            infos[i].firstVertex = (uint32_t)(offset / vertexSize);
+            infos[i].materialId = command.materialId;
+            infos[i].pad0 = 0;
+            infos[i].pad1 = 0;
+            offset += command.count * vertexSize;
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(infos.size(), (size_t)1) * sizeof(DrawInfo), infos.empty() ? NULL : infos.data(), GL_STATIC_DRAW);
+        DrawStats::Get().Add(DrawStats::BUFFER_BYTES, infos.size() * sizeof(DrawInfo));
+        GpuMemory::Get().TrackBuffer(drawBuffer, GpuMemory::STORAGE_BUFFER, "visibility buffer draws", std::max(infos.size(), (size_t)1) * sizeof(DrawInfo));
+    }
+
+    // the id pass: triangle ids and scene depth
+    void BindIds() const { glBindFramebuffer(GL_FRAMEBUFFER, idFbo); }
+    // the classify and resolve passes: lit color and material depth
+    void BindMaterial() const { glBindFramebuffer(GL_FRAMEBUFFER, materialFbo); }
+    // lit color with the scene depth, for anything drawn forward afterwards
+    void BindScene() const { glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo); }
+
+    // binds the id texture to the given unit and the geometry storage buffers
+    void BindForResolve(GLuint idUnit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + idUnit);
+        glBindTexture(GL_TEXTURE_2D, idTexture);
+        glActiveTexture(GL_TEXTURE0);
+        DrawStats::Get().Add(DrawStats::TEXTURE_BINDS);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vertexBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, drawBuffer);
+    }
+
+    // copies the lit image into the window, or into destination if it isn't 0, and leaves that bound
+    void BlitToDefault(int windowWidth, int windowHeight, GLuint destination = 0) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, destination);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, destination);
+    }
+
+    void DestroyTargets()
+    {
+        if (idFbo == 0)
+            return;
+        GLuint fbos[] = { idFbo, materialFbo, sceneFbo };
+        glDeleteFramebuffers(3, fbos);
+        GLuint textures[] = { idTexture, depthTexture, colorTexture, materialDepthTexture };
+        glDeleteTextures(4, textures);
+        for (GLuint texture : textures)
+            GpuMemory::Get().ReleaseTexture(texture);
+        idFbo = materialFbo = sceneFbo = 0;
+        idTexture = depthTexture = colorTexture = materialDepthTexture = 0;
+    }
+
+    void Destroy()
+    {
+        DestroyTargets();
+        if (vertexBuffer != 0)
+        {
+            glDeleteBuffers(1, &vertexBuffer);
+            glDeleteBuffers(1, &drawBuffer);
+            GpuMemory::Get().ReleaseBuffer(vertexBuffer);
+            GpuMemory::Get().ReleaseBuffer(drawBuffer);
+        }
+        vertexBuffer = 0;
+        drawBuffer = 0;
+    }
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+private:
+    // matches DrawInfo in the visibility shaders (std430)
+    struct DrawInfo
+    {
+        uint32_t firstVertex;
+        uint32_t materialId;
+        uint32_t pad0;
+        uint32_t pad1;
+    };
+
+    GLuint createTexture(GLenum format) const
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+        GpuMemory::Get().TrackTexture(texture, GpuMemory::RENDER_TARGET, "visibility buffer", format, width, height);
+        // ids can't be filtered, and every pass reads exactly one texel per pixel anyway
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    static GLuint createFramebuffer(GLuint color, GLuint depth, const char* name)
+    {
+        GLuint fbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: " << name << " is not complete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return fbo;
+    }
+
+    GLuint idFbo;
+    GLuint materialFbo;
+    GLuint sceneFbo;
+    GLuint idTexture;
+    GLuint depthTexture;
+    GLuint colorTexture;
+    GLuint materialDepthTexture;
+    int width;
+    int height;
+
+    GLuint vertexBuffer;
+    GLuint drawBuffer;
+};
+#endif